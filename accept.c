@@ -17,7 +17,12 @@
  */
 
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "ldpd.h"
 #include "ldpe.h"
@@ -31,21 +36,116 @@ struct accept_ev {
 	int			 fd;
 };
 
+/* maximum number of connections accepted per listener wakeup */
+#define ACCEPT_BATCH_MAX	16
+/* pause bounds in milliseconds, doubled on every consecutive pause */
+#define ACCEPT_PAUSE_MIN	50
+#define ACCEPT_PAUSE_MAX	5000
+
 struct {
 	LIST_HEAD(, accept_ev)	queue;
 	struct event		evt;
+	int			reserve_fd;
+	int			done;
+	unsigned int		pause_ms;
+	uint64_t		accepted;
+	uint64_t		refused;
+	uint64_t		paused;
 } accept_queue;
 
 static void	accept_arm(void);
 static void	accept_unarm(void);
 static void	accept_cb(int, short, void *);
 static void	accept_timeout(int, short, void *);
+static int	accept_reserve(void);
+static int	accept_shed(int);
+
+PROF_CALLBACK(accept_timeout)
 
 void
 accept_init(void)
 {
 	LIST_INIT(&accept_queue.queue);
-	evtimer_set(&accept_queue.evt, accept_timeout, NULL);
+	evtimer_set(&accept_queue.evt, PROF(accept_timeout), NULL);
+	accept_queue.reserve_fd = -1;
+	accept_queue.pause_ms = ACCEPT_PAUSE_MIN;
+	accept_reserve();
+}
+
+/*
+ * Keep a spare descriptor around so that we can still accept and drop a
+ * connection when we run out of descriptors. Otherwise the peer would be
+ * left waiting in the listen queue while we sit in accept_pause().
+ */
+static int
+accept_reserve(void)
+{
+	if (accept_queue.reserve_fd != -1)
+		return (0);
+
+	accept_queue.reserve_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC,
+	    0);
+	return (accept_queue.reserve_fd == -1 ? -1 : 0);
+}
+
+/*
+ * Drop one pending connection using the reserve descriptor. Returns -1 if
+ * the reserve is gone and could not be recovered, in which case the caller
+ * has to pause the listeners.
+ */
+static int
+accept_shed(int fd)
+{
+	int	 connfd;
+
+	if (accept_queue.reserve_fd == -1)
+		return (-1);
+
+	close(accept_queue.reserve_fd);
+	accept_queue.reserve_fd = -1;
+	if ((connfd = accept4(fd, NULL, NULL, SOCK_CLOEXEC)) != -1) {
+		close(connfd);
+		accept_queue.refused++;
+		log_debug("%s: out of descriptors, connection dropped",
+		    __func__);
+	}
+	return (accept_reserve());
+}
+
+/*
+ * Wrapper around accept4(2) for the accept_add() callbacks. Sets
+ * accept_queue.done when the listener has nothing left to give, which
+ * ends the batch in accept_cb().
+ */
+int
+accept_sock(int fd, struct sockaddr *sa, socklen_t *len)
+{
+	int	 connfd;
+
+	connfd = accept4(fd, sa, len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (connfd == -1) {
+		accept_queue.done = 1;
+		/*
+		 * Out of file descriptors: keep dropping connections through
+		 * the reserve descriptor while the listener stays armed. Only
+		 * pause accept when the reserve is lost, or libevent will
+		 * haunt us here too.
+		 */
+		if (errno == ENFILE || errno == EMFILE) {
+			if (accept_shed(fd) == -1)
+				accept_pause();
+		} else if (errno != EWOULDBLOCK && errno != EINTR &&
+		    errno != ECONNABORTED)
+			log_debug("%s: accept error: %s", __func__,
+			    strerror(errno));
+		return (-1);
+	}
+
+	accept_queue.accepted++;
+	accept_queue.pause_ms = ACCEPT_PAUSE_MIN;
+	accept_queue.done = 0;
+
+	return (connfd);
 }
 
 int
@@ -86,9 +186,20 @@ accept_del(int fd)
 void
 accept_pause(void)
 {
-	struct timeval evtpause = { 1, 0 };
+	struct timeval evtpause;
+
+	if (evtimer_pending(&accept_queue.evt, NULL))
+		return;
+
+	evtpause.tv_sec = accept_queue.pause_ms / 1000;
+	evtpause.tv_usec = (accept_queue.pause_ms % 1000) * 1000;
+	log_debug("%s: %u ms", __func__, accept_queue.pause_ms);
+	accept_queue.paused++;
+
+	/* back off further if we are still starved after the timeout */
+	accept_queue.pause_ms = min(accept_queue.pause_ms * 2,
+	    ACCEPT_PAUSE_MAX);
 
-	log_debug(__func__);
 	accept_unarm();
 	evtimer_add(&accept_queue.evt, &evtpause);
 }
@@ -123,13 +234,36 @@ static void
 accept_cb(int fd, short event, void *arg)
 {
 	struct accept_ev	*av = arg;
+	int			 i;
+
 	event_add(&av->ev, NULL);
-	av->accept_cb(fd, event, av->arg);
+	for (i = 0; i < ACCEPT_BATCH_MAX; i++) {
+		/* the callback clears this through accept_sock() */
+		accept_queue.done = 1;
+		av->accept_cb(fd, event, av->arg);
+		if (accept_queue.done)
+			break;
+	}
 }
 
 static void
 accept_timeout(int fd, short event, void *bula)
 {
 	log_debug(__func__);
+	accept_reserve();
 	accept_arm();
 }
+
+struct ctl_accept *
+accept_to_ctl(void)
+{
+	static struct ctl_accept	 actl;
+
+	actl.accepted = accept_queue.accepted;
+	actl.refused = accept_queue.refused;
+	actl.paused = accept_queue.paused;
+	actl.pause_ms = accept_queue.pause_ms;
+	actl.reserve = (accept_queue.reserve_fd != -1);
+
+	return (&actl);
+}
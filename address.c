@@ -28,8 +28,6 @@
 
 static void	 send_address(struct nbr *, int, struct if_addr_head *,
 		    unsigned int, int);
-static int	 gen_address_list_tlv(struct ibuf *, uint16_t, int,
-		    struct if_addr_head *, unsigned int);
 static void	 address_list_add(struct if_addr_head *, struct if_addr *);
 static void	 address_list_clr(struct if_addr_head *);
 
@@ -104,7 +102,7 @@ send_address(struct nbr *nbr, int af, struct if_addr_head *addr_list,
 				break;
 		}
 
-		evbuf_enqueue(&nbr->tcp->wbuf, buf);
+		session_enqueue(nbr->tcp, buf, msg_type, 1);
 	}
 
 	nbr_fsm(nbr, NBR_EVT_PDU_SENT);
@@ -236,42 +234,6 @@ recv_address(struct nbr *nbr, char *buf, uint16_t len)
 	return (0);
 }
 
-static int
-gen_address_list_tlv(struct ibuf *buf, uint16_t size, int af,
-    struct if_addr_head *addr_list, unsigned int tlv_addr_count)
-{
-	struct address_list_tlv	 alt;
-	uint16_t		 addr_size;
-	struct if_addr		*if_addr;
-	int			 err = 0;
-
-	memset(&alt, 0, sizeof(alt));
-	alt.type = TLV_TYPE_ADDRLIST;
-	alt.length = htons(size - TLV_HDR_SIZE);
-
-	switch (af) {
-	case AF_INET:
-		alt.family = htons(AF_IPV4);
-		addr_size = sizeof(struct in_addr);
-		break;
-	case AF_INET6:
-		alt.family = htons(AF_IPV6);
-		addr_size = sizeof(struct in6_addr);
-		break;
-	default:
-		fatalx("gen_address_list_tlv: unknown af");
-	}
-
-	err |= ibuf_add(buf, &alt, sizeof(alt));
-	LIST_FOREACH(if_addr, addr_list, entry) {
-		err |= ibuf_add(buf, &if_addr->addr, addr_size);
-		if (--tlv_addr_count == 0)
-			break;
-	}
-
-	return (err);
-}
-
 static void
 address_list_add(struct if_addr_head *addr_list, struct if_addr *if_addr)
 {
@@ -35,6 +35,9 @@ static void	 tnbr_hello_timer(int, short, void *);
 static void	 tnbr_start_hello_timer(struct tnbr *);
 static void	 tnbr_stop_hello_timer(struct tnbr *);
 
+PROF_CALLBACK(adj_itimer)
+PROF_CALLBACK(tnbr_hello_timer)
+
 struct adj *
 adj_new(struct in_addr lsr_id, struct hello_source *source,
     union ldpd_addr *addr)
@@ -46,13 +49,14 @@ adj_new(struct in_addr lsr_id, struct hello_source *source,
 
 	if ((adj = calloc(1, sizeof(*adj))) == NULL)
 		fatal(__func__);
+	mem_add(MEM_ADJ, sizeof(*adj));
 
 	adj->lsr_id = lsr_id;
 	adj->nbr = NULL;
 	adj->source = *source;
 	adj->trans_addr = *addr;
 
-	evtimer_set(&adj->inactivity_timer, adj_itimer, adj);
+	evtimer_set(&adj->inactivity_timer, PROF(adj_itimer), adj);
 
 	LIST_INSERT_HEAD(&global.adj_list, adj, global_entry);
 
@@ -88,6 +92,7 @@ adj_del_single(struct adj *adj)
 		break;
 	}
 
+	mem_del(MEM_ADJ, sizeof(*adj));
 	free(adj);
 }
 
@@ -159,6 +164,7 @@ adj_itimer(int fd, short event, void *arg)
 {
 	struct adj *adj = arg;
 
+	trace(TRACE_TIMER, TRACE_TIMER_ADJ_TIMEOUT, adj->lsr_id.s_addr, 0, 0);
 	log_debug("%s: lsr-id %s", __func__, inet_ntoa(adj->lsr_id));
 
 	if (adj->source.type == HELLO_TARGETED) {
@@ -269,7 +275,7 @@ tnbr_update(struct tnbr *tnbr)
 		tnbr->state = TNBR_STA_ACTIVE;
 		send_hello(HELLO_TARGETED, NULL, tnbr);
 
-		evtimer_set(&tnbr->hello_timer, tnbr_hello_timer, tnbr);
+		evtimer_set(&tnbr->hello_timer, PROF(tnbr_hello_timer), tnbr);
 		tnbr_start_hello_timer(tnbr);
 	} else if (tnbr->state == TNBR_STA_ACTIVE) {
 		if (socket_ok && rtr_id_ok)
@@ -299,6 +305,8 @@ tnbr_hello_timer(int fd, short event, void *arg)
 {
 	struct tnbr	*tnbr = arg;
 
+	trace(TRACE_TIMER, TRACE_TIMER_TNBR_HELLO,
+	    tnbr->af == AF_INET ? tnbr->addr.v4.s_addr : 0, 0, 0);
 	send_hello(HELLO_TARGETED, NULL, tnbr);
 	tnbr_start_hello_timer(tnbr);
 }
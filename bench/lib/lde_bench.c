@@ -0,0 +1,451 @@
+/*	$OpenBSD$ */
+
+/*
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * LIB benchmark. The lde is built into this program and driven through
+ * the same functions its imsg handlers call, so that only the LIB
+ * algorithms are timed; what it would send to the other processes is
+ * counted and dropped by the stubs (see stubs.c). Every phase is a fixed
+ * workload over the same addresses and the same pseudo-random sequence,
+ * so that the figures of two builds can be compared line by line.
+ *
+ * usage: ldplibbench [-v] fecs nbrs [rounds]
+ *
+ * fecs /32 routes from 10.0.0.0 up are spread evenly over nbrs neighbors
+ * from 172.16.0.1 up. Route churn and neighbor flaps are repeated rounds
+ * times. A run with 1000000 FECs and 100 neighbors needs several
+ * gigabytes of memory.
+ */
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netmpls/mpls.h>
+#include <arpa/inet.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ldp.h"
+#include "ldpd.h"
+#include "ldpe.h"
+#include "lde.h"
+#include "log.h"
+#include "bench.h"
+
+#define BENCH_FEC_BASE		0x0a000000	/* 10.0.0.0 */
+#define BENCH_NBR_BASE		0xac100001	/* 172.16.0.1 */
+#define BENCH_SEED		0x2545f491
+#define BENCH_CHURN		10		/* % of the routes per round */
+#define BENCH_MAX_NBRS		(PEERID_SLOT_MAX - 1)	/* slot 0 is unused */
+#define BENCH_MAX_FECS		(MPLS_LABEL_MAX - MPLS_LABEL_RESERVED_MAX)
+#define BENCH_MAX_ROUNDS	1000
+
+static __dead void usage(void);
+static void	 bench_fec(uint32_t, struct fec *);
+static void	 bench_nexthop(uint32_t, union ldpd_addr *);
+static void	 bench_map(uint32_t, struct map *);
+static struct in_addr	 bench_nbr_id(uint32_t);
+static struct lde_nbr	*bench_nbr_up(uint32_t, struct in_addr);
+static uint32_t	 bench_random(void);
+static void	 bench_start(void);
+static void	 bench_end(const char *, uint64_t);
+static void	 bench_mem(int, pid_t, void *, uint16_t);
+static void	 bench_route_add(void);
+static void	 bench_mapping(void);
+static void	 bench_route_churn(void);
+static void	 bench_nbr_flap(void);
+static void	 bench_withdraw(void);
+static void	 bench_withdraw_wcard(void);
+static void	 bench_route_del(void);
+static void	 bench_gc(void);
+
+static struct {
+	uint32_t		 nfecs;
+	uint32_t		 nnbrs;
+	uint32_t		 rounds;
+	struct lde_nbr		**nbrs;
+	uint32_t		 seed;
+
+	uint64_t		 t_start;
+	uint64_t		 objects;
+	uint64_t		 bytes;
+} bench;
+
+static __dead void
+usage(void)
+{
+	extern char *__progname;
+
+	fprintf(stderr, "usage: %s [-v] fecs nbrs [rounds]\n", __progname);
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct rusage	 ru;
+	const char	*errstr;
+	uint32_t	 i;
+	int		 ch, verbose = 0;
+
+	while ((ch = getopt(argc, argv, "v")) != -1) {
+		switch (ch) {
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 2 && argc != 3)
+		usage();
+
+	bench.nfecs = strtonum(argv[0], 1, BENCH_MAX_FECS, &errstr);
+	if (errstr)
+		errx(1, "number of fecs is %s: %s", errstr, argv[0]);
+	/* half the neighbors withdraw one by one, half with a wildcard */
+	bench.nnbrs = strtonum(argv[1], 2, BENCH_MAX_NBRS, &errstr);
+	if (errstr)
+		errx(1, "number of neighbors is %s: %s", errstr, argv[1]);
+	bench.rounds = 1;
+	if (argc == 3) {
+		bench.rounds = strtonum(argv[2], 1, BENCH_MAX_ROUNDS, &errstr);
+		if (errstr)
+			errx(1, "number of rounds is %s: %s", errstr, argv[2]);
+	}
+
+	/* the lde logs every label it handles at debug level */
+	log_init(1);
+	log_verbose(verbose);
+	ldpd_process = PROC_LDE_ENGINE;
+
+	event_init();
+	ldeconf = config_new_empty();
+	evtimer_set(&gc_timer, lde_gc_timer, NULL);
+	bench.seed = BENCH_SEED;
+
+	printf("# %u fecs, %u neighbors, %u rounds, seed %#x\n",
+	    bench.nfecs, bench.nnbrs, bench.rounds, BENCH_SEED);
+	printf("%-14s %12s %9s %12s %12s %14s %12s\n", "workload", "ops",
+	    "secs", "ops/s", "lib objects", "lib bytes", "imsgs");
+
+	if ((bench.nbrs = calloc(bench.nnbrs, sizeof(*bench.nbrs))) == NULL)
+		err(1, NULL);
+	for (i = 0; i < bench.nnbrs; i++)
+		bench.nbrs[i] = bench_nbr_up(PEERID_MAKE(1, i + 1),
+		    bench_nbr_id(i));
+
+	bench_route_add();
+	bench_mapping();
+	bench_route_churn();
+	bench_nbr_flap();
+	bench_withdraw();
+	bench_withdraw_wcard();
+	bench_route_del();
+	bench_gc();
+
+	if (getrusage(RUSAGE_SELF, &ru) == -1)
+		err(1, "getrusage");
+	printf("# peak rss %ld KB\n", ru.ru_maxrss);
+
+	return (0);
+}
+
+static void
+bench_fec(uint32_t i, struct fec *fec)
+{
+	memset(fec, 0, sizeof(*fec));
+	fec->type = FEC_TYPE_IPV4;
+	fec->u.ipv4.prefix.s_addr = htonl(BENCH_FEC_BASE + i);
+	fec->u.ipv4.prefixlen = 32;
+}
+
+/* the routes are spread evenly over the neighbors */
+static void
+bench_nexthop(uint32_t i, union ldpd_addr *nexthop)
+{
+	memset(nexthop, 0, sizeof(*nexthop));
+	nexthop->v4 = bench_nbr_id(i % bench.nnbrs);
+}
+
+static void
+bench_map(uint32_t i, struct map *map)
+{
+	memset(map, 0, sizeof(*map));
+	map->type = MAP_TYPE_PREFIX;
+	map->fec.prefix.af = AF_INET;
+	map->fec.prefix.prefix.v4.s_addr = htonl(BENCH_FEC_BASE + i);
+	map->fec.prefix.prefixlen = 32;
+	map->label = MPLS_LABEL_RESERVED_MAX + 1 + i;
+}
+
+/* each neighbor has a single address, its LSR-ID */
+static struct in_addr
+bench_nbr_id(uint32_t nbr)
+{
+	struct in_addr	 id;
+
+	id.s_addr = htonl(BENCH_NBR_BASE + nbr);
+	return (id);
+}
+
+/* what IMSG_NEIGHBOR_UP, IMSG_ADDRESS_ADD and IMSG_LABEL_MAPPING_FULL do */
+static struct lde_nbr *
+bench_nbr_up(uint32_t peerid, struct in_addr id)
+{
+	struct lde_nbr	 new, *ln;
+	struct lde_addr	 lde_addr;
+
+	memset(&new, 0, sizeof(new));
+	new.id = id;
+	new.v4_enabled = 1;
+	ln = lde_nbr_new(peerid, &new);
+
+	memset(&lde_addr, 0, sizeof(lde_addr));
+	lde_addr.af = AF_INET;
+	lde_addr.addr.v4 = id;
+	lde_address_add(ln, &lde_addr);
+
+	fec_snap(ln);
+
+	return (ln);
+}
+
+/* xorshift, the same sequence on every run */
+static uint32_t
+bench_random(void)
+{
+	bench.seed ^= bench.seed << 13;
+	bench.seed ^= bench.seed >> 17;
+	bench.seed ^= bench.seed << 5;
+	return (bench.seed);
+}
+
+static void
+bench_start(void)
+{
+	bench_imsgs = 0;
+	bench.t_start = stats_now();
+}
+
+static void
+bench_end(const char *name, uint64_t ops)
+{
+	double		 secs;
+
+	secs = (stats_now() - bench.t_start) / 1000000000.0;
+	if (secs == 0)
+		secs = 0.000000001;
+
+	bench.objects = bench.bytes = 0;
+	mem_ctl(0, IMSG_NONE, bench_mem);
+
+	printf("%-14s %12llu %9.3f %12.0f %12llu %14llu %12llu\n", name,
+	    (unsigned long long)ops, secs, ops / secs,
+	    (unsigned long long)bench.objects,
+	    (unsigned long long)bench.bytes,
+	    (unsigned long long)bench_imsgs);
+	fflush(stdout);
+}
+
+/* sum the allocation counters of the LIB, see mem.c */
+static void
+bench_mem(int type, pid_t pid, void *data, uint16_t len)
+{
+	struct ctl_mem	 mctl;
+
+	if (type != IMSG_CTL_SHOW_MEMORY || len != sizeof(mctl))
+		return;
+	memcpy(&mctl, data, sizeof(mctl));
+
+	switch (mctl.type) {
+	case MEM_FEC_NODE:
+	case MEM_FEC_NH:
+	case MEM_LDE_NBR:
+	case MEM_LDE_MAP:
+	case MEM_LDE_REQ:
+	case MEM_LDE_WDRAW:
+		bench.objects += mctl.objects;
+		bench.bytes += mctl.bytes;
+		break;
+	default:
+		break;
+	}
+}
+
+/* every route learned, a mapping sent to every neighbor for each */
+static void
+bench_route_add(void)
+{
+	struct fec	 fec;
+	union ldpd_addr	 nexthop;
+	uint32_t	 i;
+
+	bench_start();
+	for (i = 0; i < bench.nfecs; i++) {
+		bench_fec(i, &fec);
+		bench_nexthop(i, &nexthop);
+		lde_kernel_insert(&fec, AF_INET, &nexthop, 0, 0, NULL);
+	}
+	bench_end("route-add", bench.nfecs);
+}
+
+/* a mapping from every neighbor for every FEC */
+static void
+bench_mapping(void)
+{
+	struct map	 map;
+	uint32_t	 i, n;
+
+	bench_start();
+	for (n = 0; n < bench.nnbrs; n++)
+		for (i = 0; i < bench.nfecs; i++) {
+			bench_map(i, &map);
+			lde_check_mapping(&map, bench.nbrs[n]);
+		}
+	bench_end("mapping", (uint64_t)bench.nfecs * bench.nnbrs);
+}
+
+/* routes moving to the next neighbor, in random order */
+static void
+bench_route_churn(void)
+{
+	struct fec	 fec;
+	union ldpd_addr	 nexthop;
+	uint32_t	 i, r, changes, *shift;
+	uint64_t	 ops = 0;
+
+	/* how far each route moved from its initial nexthop */
+	if ((shift = calloc(bench.nfecs, sizeof(*shift))) == NULL)
+		err(1, NULL);
+
+	changes = bench.nfecs / 100 * BENCH_CHURN;
+	if (changes == 0)
+		changes = 1;
+
+	bench_start();
+	for (r = 0; r < bench.rounds; r++) {
+		for (i = 0; i < changes; i++) {
+			uint32_t	 f = bench_random() % bench.nfecs;
+
+			bench_fec(f, &fec);
+			bench_nexthop(f + shift[f], &nexthop);
+			lde_kernel_remove(&fec, AF_INET, &nexthop, 0);
+
+			shift[f]++;
+			bench_nexthop(f + shift[f], &nexthop);
+			lde_kernel_insert(&fec, AF_INET, &nexthop, 0, 0, NULL);
+			ops += 2;
+		}
+	}
+	bench_end("route-churn", ops);
+
+	free(shift);
+}
+
+/* each neighbor goes down, comes back and advertises everything again */
+static void
+bench_nbr_flap(void)
+{
+	struct lde_nbr	*ln;
+	struct map	 map;
+	uint32_t	 i, n, r;
+	uint64_t	 ops = 0;
+
+	bench_start();
+	for (r = 0; r < bench.rounds; r++) {
+		for (n = 0; n < bench.nnbrs; n++) {
+			ln = bench.nbrs[n];
+			bench.nbrs[n] = NULL;
+			lde_nbr_del(ln);
+
+			ln = bench_nbr_up(PEERID_MAKE(r + 2, n + 1),
+			    bench_nbr_id(n));
+			bench.nbrs[n] = ln;
+
+			for (i = 0; i < bench.nfecs; i++) {
+				bench_map(i, &map);
+				lde_check_mapping(&map, ln);
+				}
+			ops++;
+		}
+	}
+	bench_end("nbr-flap", ops);
+}
+
+/* the first half of the neighbors withdraws its labels one by one */
+static void
+bench_withdraw(void)
+{
+	struct map	 map;
+	uint32_t	 i, n;
+
+	bench_start();
+	for (n = 0; n < bench.nnbrs / 2; n++)
+		for (i = 0; i < bench.nfecs; i++) {
+			bench_map(i, &map);
+			map.label = NO_LABEL;
+			lde_check_withdraw(&map, bench.nbrs[n]);
+		}
+	bench_end("withdraw", (uint64_t)bench.nfecs * (bench.nnbrs / 2));
+}
+
+/* the second half withdraws them all at once */
+static void
+bench_withdraw_wcard(void)
+{
+	struct map	 map;
+	uint32_t	 n;
+
+	memset(&map, 0, sizeof(map));
+	map.type = MAP_TYPE_WILDCARD;
+	map.label = NO_LABEL;
+
+	bench_start();
+	for (n = bench.nnbrs / 2; n < bench.nnbrs; n++)
+		lde_check_withdraw_wcard(&map, bench.nbrs[n]);
+	bench_end("withdraw-wcard", bench.nnbrs - bench.nnbrs / 2);
+}
+
+static void
+bench_route_del(void)
+{
+	struct fec	 fec;
+	union ldpd_addr	 nexthop;
+	uint32_t	 i;
+
+	bench_start();
+	for (i = 0; i < bench.nfecs; i++) {
+		bench_fec(i, &fec);
+		bench_nexthop(i, &nexthop);
+		lde_kernel_remove(&fec, AF_INET, &nexthop, 0);
+	}
+	bench_end("route-del", bench.nfecs);
+}
+
+static void
+bench_gc(void)
+{
+	bench_start();
+	lde_gc_timer(0, 0, NULL);
+	bench_end("gc", 1);
+}
@@ -0,0 +1,100 @@
+/*	$OpenBSD$ */
+
+/*
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * What the lde takes from the parent and the ldpe, for the benchmark.
+ * Nothing is sent to the other processes, and so nothing reaches the
+ * kernel either: the imsgs are counted and dropped. The configuration,
+ * the targeted neighbors and the pseudowires never come into play.
+ */
+
+#include <sys/types.h>
+#include <stdlib.h>
+
+#include "ldpd.h"
+#include "ldpe.h"
+#include "log.h"
+#include "bench.h"
+
+struct ldpd_global	 global;
+struct ldpd_conf	*leconf;
+uint64_t		 bench_imsgs;
+
+int
+imsg_compose_event(struct imsgev *iev, uint16_t type, uint32_t peerid,
+    pid_t pid, int fd, void *data, uint16_t datalen)
+{
+	bench_imsgs++;
+	return (0);
+}
+
+void
+imsg_event_add(struct imsgev *iev)
+{
+}
+
+struct ldpd_conf *
+config_new_empty(void)
+{
+	struct ldpd_conf	*xconf;
+
+	xconf = calloc(1, sizeof(*xconf));
+	if (xconf == NULL)
+		fatal(NULL);
+
+	LIST_INIT(&xconf->iface_list);
+	LIST_INIT(&xconf->tnbr_list);
+	LIST_INIT(&xconf->nbrp_list);
+	LIST_INIT(&xconf->l2vpn_list);
+	LIST_INIT(&xconf->plist_list);
+
+	return (xconf);
+}
+
+void
+config_clear(struct ldpd_conf *conf)
+{
+	fatalx("config_clear: not in the benchmark");
+}
+
+void
+merge_config(struct ldpd_conf *conf, struct ldpd_conf *xconf)
+{
+	fatalx("merge_config: not in the benchmark");
+}
+
+struct tnbr *
+tnbr_new(struct ldpd_conf *xconf, int af, union ldpd_addr *addr)
+{
+	fatalx("tnbr_new: not in the benchmark");
+}
+
+struct tnbr *
+tnbr_find(struct ldpd_conf *xconf, int af, union ldpd_addr *addr)
+{
+	return (NULL);
+}
+
+struct tnbr *
+tnbr_check(struct tnbr *tnbr)
+{
+	return (tnbr);
+}
+
+void
+tnbr_update(struct tnbr *tnbr)
+{
+}
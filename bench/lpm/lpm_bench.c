@@ -0,0 +1,335 @@
+/*	$OpenBSD$ */
+
+/*
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Longest prefix match benchmark. The same routes are loaded into the trie
+ * kroute_match() uses (see ptrie.c) and into a red-black tree keyed on
+ * prefix and length, which is looked up once per prefix length from the
+ * longest down, as kroute_match() used to. Both are then asked for the
+ * same addresses and must give the same answers.
+ *
+ * usage: ldplpmbench [-6] routes [lookups]
+ *
+ * The routes are pseudo-random, most of them /24s (/48s with -6) and the
+ * rest spread over the other lengths. Half the lookups fall inside a
+ * route, the other half anywhere. The sequence is the same on every run,
+ * so that the figures of two builds can be compared line by line.
+ */
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/tree.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ldpd.h"
+#include "log.h"
+
+#define BENCH_SEED		0x2545f491
+#define BENCH_MAX_ROUTES	10000000
+#define BENCH_MAX_LOOKUPS	100000000
+
+struct bench_route {
+	RB_ENTRY(bench_route)	 entry;
+	union ldpd_addr		 prefix;
+	uint8_t			 prefixlen;
+};
+RB_HEAD(bench_tree, bench_route);
+
+static __dead void usage(void);
+static int	 bench_compare(struct bench_route *, struct bench_route *);
+static uint32_t	 bench_random(void);
+static void	 bench_addr(union ldpd_addr *);
+static uint8_t	 bench_prefixlen(void);
+static struct bench_route *bench_rb_match(union ldpd_addr *);
+static void	 bench_start(void);
+static void	 bench_end(const char *, uint64_t);
+static void	 bench_load(void);
+static void	 bench_lookup(void);
+
+RB_PROTOTYPE(bench_tree, bench_route, entry, bench_compare)
+RB_GENERATE(bench_tree, bench_route, entry, bench_compare)
+
+static struct {
+	int			 af;
+	uint8_t			 maxprefixlen;
+	uint32_t		 nroutes;
+	uint32_t		 nlookups;
+	uint32_t		 seed;
+
+	struct bench_route	**routes;
+	struct bench_tree	 tree;
+	struct ptrie_node	*trie;
+	union ldpd_addr		*keys;
+	struct bench_route	**found;
+
+	struct timespec		 t_start;
+} bench;
+
+static __dead void
+usage(void)
+{
+	extern char *__progname;
+
+	fprintf(stderr, "usage: %s [-6] routes [lookups]\n", __progname);
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct rusage	 ru;
+	const char	*errstr;
+	int		 ch;
+
+	bench.af = AF_INET;
+	while ((ch = getopt(argc, argv, "6")) != -1) {
+		switch (ch) {
+		case '6':
+			bench.af = AF_INET6;
+			break;
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1 && argc != 2)
+		usage();
+
+	bench.nroutes = strtonum(argv[0], 1, BENCH_MAX_ROUTES, &errstr);
+	if (errstr)
+		errx(1, "number of routes is %s: %s", errstr, argv[0]);
+	bench.nlookups = bench.nroutes;
+	if (argc == 2) {
+		bench.nlookups = strtonum(argv[1], 1, BENCH_MAX_LOOKUPS,
+		    &errstr);
+		if (errstr)
+			errx(1, "number of lookups is %s: %s", errstr, argv[1]);
+	}
+
+	log_init(1);
+	ldpd_process = PROC_MAIN;
+	bench.maxprefixlen = bench.af == AF_INET ? 32 : 128;
+	bench.seed = BENCH_SEED;
+	RB_INIT(&bench.tree);
+
+	bench.routes = calloc(bench.nroutes, sizeof(*bench.routes));
+	bench.keys = calloc(bench.nlookups, sizeof(*bench.keys));
+	bench.found = calloc(bench.nlookups, sizeof(*bench.found));
+	if (bench.routes == NULL || bench.keys == NULL || bench.found == NULL)
+		err(1, NULL);
+
+	printf("# %u %s routes, %u lookups, seed %#x\n", bench.nroutes,
+	    bench.af == AF_INET ? "ipv4" : "ipv6", bench.nlookups, BENCH_SEED);
+	printf("%-14s %12s %9s %12s\n", "workload", "ops", "secs", "ops/s");
+
+	bench_load();
+	bench_lookup();
+
+	if (getrusage(RUSAGE_SELF, &ru) == -1)
+		err(1, "getrusage");
+	printf("# peak rss %ld KB\n", ru.ru_maxrss);
+
+	return (0);
+}
+
+static int
+bench_compare(struct bench_route *a, struct bench_route *b)
+{
+	int		 addrcmp;
+
+	addrcmp = ldp_addrcmp(bench.af, &a->prefix, &b->prefix);
+	if (addrcmp != 0)
+		return (addrcmp);
+	return (a->prefixlen - b->prefixlen);
+}
+
+static uint32_t
+bench_random(void)
+{
+	bench.seed ^= bench.seed << 13;
+	bench.seed ^= bench.seed >> 17;
+	bench.seed ^= bench.seed << 5;
+	return (bench.seed);
+}
+
+static void
+bench_addr(union ldpd_addr *addr)
+{
+	uint32_t	 r;
+	int		 i;
+
+	memset(addr, 0, sizeof(*addr));
+	if (bench.af == AF_INET) {
+		addr->v4.s_addr = bench_random();
+		return;
+	}
+	/* global unicast, 2000::/3 */
+	for (i = 0; i < 4; i++) {
+		r = bench_random();
+		memcpy(&addr->v6.s6_addr[i * 4], &r, sizeof(r));
+	}
+	addr->v6.s6_addr[0] = (addr->v6.s6_addr[0] & 0x1f) | 0x20;
+}
+
+/* roughly the shape of a full table */
+static uint8_t
+bench_prefixlen(void)
+{
+	uint32_t	 r;
+
+	r = bench_random() % 100;
+	if (bench.af == AF_INET) {
+		if (r < 60)
+			return (24);
+		if (r < 70)
+			return (32);
+		return (8 + r % 16);
+	}
+	if (r < 50)
+		return (48);
+	if (r < 60)
+		return (128);
+	if (r < 70)
+		return (64);
+	return (16 + r % 32);
+}
+
+/* the longest match the way kroute_match() used to find it */
+static struct bench_route *
+bench_rb_match(union ldpd_addr *addr)
+{
+	struct bench_route	 s, *route;
+	int			 i;
+
+	for (i = bench.maxprefixlen; i >= 0; i--) {
+		ldp_applymask(bench.af, &s.prefix, addr, i);
+		s.prefixlen = i;
+		route = RB_FIND(bench_tree, &bench.tree, &s);
+		if (route != NULL)
+			return (route);
+	}
+
+	return (NULL);
+}
+
+static void
+bench_start(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &bench.t_start);
+}
+
+static void
+bench_end(const char *name, uint64_t ops)
+{
+	struct timespec	 now, elapsed;
+	double		 secs;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	timespecsub(&now, &bench.t_start, &elapsed);
+	secs = elapsed.tv_sec + elapsed.tv_nsec / 1000000000.0;
+	if (secs == 0)
+		secs = 0.000000001;
+
+	printf("%-14s %12llu %9.3f %12.0f\n", name, (unsigned long long)ops,
+	    secs, ops / secs);
+	fflush(stdout);
+}
+
+/* the same routes into both; duplicates are drawn again */
+static void
+bench_load(void)
+{
+	struct bench_route	*route;
+	union ldpd_addr		 addr;
+	uint32_t		 i;
+
+	for (i = 0; i < bench.nroutes; i++) {
+		if ((route = calloc(1, sizeof(*route))) == NULL)
+			err(1, NULL);
+		do {
+			bench_addr(&addr);
+			route->prefixlen = bench_prefixlen();
+			ldp_applymask(bench.af, &route->prefix, &addr,
+			    route->prefixlen);
+		} while (RB_FIND(bench_tree, &bench.tree, route) != NULL);
+		RB_INSERT(bench_tree, &bench.tree, route);
+		bench.routes[i] = route;
+	}
+	RB_INIT(&bench.tree);
+
+	bench_start();
+	for (i = 0; i < bench.nroutes; i++)
+		RB_INSERT(bench_tree, &bench.tree, bench.routes[i]);
+	bench_end("rb-insert", bench.nroutes);
+
+	bench_start();
+	for (i = 0; i < bench.nroutes; i++) {
+		route = bench.routes[i];
+		ptrie_insert(&bench.trie, bench.af, &route->prefix,
+		    route->prefixlen)->data = route;
+	}
+	bench_end("trie-insert", bench.nroutes);
+}
+
+static void
+bench_lookup(void)
+{
+	struct bench_route	*route;
+	struct ptrie_node	*n;
+	union ldpd_addr		 addr, host;
+	uint32_t		 i, j, nmatch = 0;
+
+	/* a random host of a random route, or a random address */
+	for (i = 0; i < bench.nlookups; i++) {
+		bench_addr(&host);
+		if (i % 2) {
+			bench.keys[i] = host;
+			continue;
+		}
+		route = bench.routes[bench_random() % bench.nroutes];
+		ldp_applymask(bench.af, &addr, &host, route->prefixlen);
+		for (j = 0; j < sizeof(addr.v6.s6_addr); j++)
+			bench.keys[i].v6.s6_addr[j] =
+			    route->prefix.v6.s6_addr[j] |
+			    (host.v6.s6_addr[j] ^ addr.v6.s6_addr[j]);
+	}
+
+	bench_start();
+	for (i = 0; i < bench.nlookups; i++)
+		bench.found[i] = bench_rb_match(&bench.keys[i]);
+	bench_end("rb-match", bench.nlookups);
+
+	bench_start();
+	for (i = 0; i < bench.nlookups; i++) {
+		n = ptrie_match(bench.trie, bench.af, &bench.keys[i],
+		    bench.maxprefixlen);
+		route = n ? n->data : NULL;
+		if (route != bench.found[i])
+			errx(1, "lookup %u: the trie and the tree disagree", i);
+		if (route)
+			nmatch++;
+	}
+	bench_end("trie-match", bench.nlookups);
+
+	printf("# %u lookups matched a route\n", nmatch);
+}
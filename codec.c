@@ -0,0 +1,326 @@
+/*	$OpenBSD$ */
+
+/*
+ * Copyright (c) 2013, 2016 Renato Westphal <renato@openbsd.org>
+ * Copyright (c) 2009 Michele Marchetto <michele@openbsd.org>
+ * Copyright (c) 2004, 2005, 2008 Esben Norby <norby@openbsd.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * LDP header and TLV encoders, and the PDU framing of a session stream.
+ * They depend on nothing but their arguments, so that ldploadgen(8)
+ * builds its messages with them too.
+ */
+
+#include <sys/types.h>
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ldpd.h"
+#include "ldpe.h"
+#include "log.h"
+
+int
+gen_pdu_hdr(struct ibuf *buf, uint16_t size, struct in_addr lsr_id)
+{
+	struct ldp_hdr	ldp_hdr;
+
+	memset(&ldp_hdr, 0, sizeof(ldp_hdr));
+	ldp_hdr.version = htons(LDP_VERSION);
+	/* exclude the 'Version' and 'PDU Length' fields from the total */
+	ldp_hdr.length = htons(size - LDP_HDR_DEAD_LEN);
+	ldp_hdr.lsr_id = lsr_id.s_addr;
+	ldp_hdr.lspace_id = 0;
+
+	return (ibuf_add(buf, &ldp_hdr, LDP_HDR_SIZE));
+}
+
+int
+gen_msg_hdr(struct ibuf *buf, uint16_t type, uint16_t size)
+{
+	static int	msgcnt = 0;
+	struct ldp_msg	msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.type = htons(type);
+	/* exclude the 'Type' and 'Length' fields from the total */
+	msg.length = htons(size - LDP_MSG_DEAD_LEN);
+	msg.id = htonl(++msgcnt);
+
+	return (ibuf_add(buf, &msg, sizeof(msg)));
+}
+
+int
+gen_hello_prms_tlv(struct ibuf *buf, uint16_t holdtime, uint16_t flags)
+{
+	struct hello_prms_tlv	parms;
+
+	memset(&parms, 0, sizeof(parms));
+	parms.type = htons(TLV_TYPE_COMMONHELLO);
+	parms.length = htons(sizeof(parms.holdtime) + sizeof(parms.flags));
+	parms.holdtime = htons(holdtime);
+	parms.flags = htons(flags);
+
+	return (ibuf_add(buf, &parms, sizeof(parms)));
+}
+
+int
+gen_opt4_hello_prms_tlv(struct ibuf *buf, uint16_t type, uint32_t value)
+{
+	struct hello_prms_opt4_tlv	parms;
+
+	memset(&parms, 0, sizeof(parms));
+	parms.type = htons(type);
+	parms.length = htons(sizeof(parms.value));
+	parms.value = value;
+
+	return (ibuf_add(buf, &parms, sizeof(parms)));
+}
+
+int
+gen_opt16_hello_prms_tlv(struct ibuf *buf, uint16_t type, uint8_t *value)
+{
+	struct hello_prms_opt16_tlv	parms;
+
+	memset(&parms, 0, sizeof(parms));
+	parms.type = htons(type);
+	parms.length = htons(sizeof(parms.value));
+	memcpy(&parms.value, value, sizeof(parms.value));
+
+	return (ibuf_add(buf, &parms, sizeof(parms)));
+}
+
+int
+gen_init_prms_tlv(struct ibuf *buf, uint16_t keepalive, struct in_addr lsr_id)
+{
+	struct sess_prms_tlv	parms;
+
+	memset(&parms, 0, sizeof(parms));
+	parms.type = htons(TLV_TYPE_COMMONSESSION);
+	parms.length = htons(SESS_PRMS_LEN);
+	parms.proto_version = htons(LDP_VERSION);
+	parms.keepalive_time = htons(keepalive);
+	parms.reserved = 0;
+	parms.pvlim = 0;
+	parms.max_pdu_len = 0;
+	parms.lsr_id = lsr_id.s_addr;
+	parms.lspace_id = 0;
+
+	return (ibuf_add(buf, &parms, SESS_PRMS_SIZE));
+}
+
+int
+gen_address_list_tlv(struct ibuf *buf, uint16_t size, int af,
+    struct if_addr_head *addr_list, unsigned int tlv_addr_count)
+{
+	struct address_list_tlv	 alt;
+	uint16_t		 addr_size;
+	struct if_addr		*if_addr;
+	int			 err = 0;
+
+	memset(&alt, 0, sizeof(alt));
+	alt.type = TLV_TYPE_ADDRLIST;
+	alt.length = htons(size - TLV_HDR_SIZE);
+
+	switch (af) {
+	case AF_INET:
+		alt.family = htons(AF_IPV4);
+		addr_size = sizeof(struct in_addr);
+		break;
+	case AF_INET6:
+		alt.family = htons(AF_IPV6);
+		addr_size = sizeof(struct in6_addr);
+		break;
+	default:
+		fatalx("gen_address_list_tlv: unknown af");
+	}
+
+	err |= ibuf_add(buf, &alt, sizeof(alt));
+	LIST_FOREACH(if_addr, addr_list, entry) {
+		err |= ibuf_add(buf, &if_addr->addr, addr_size);
+		if (--tlv_addr_count == 0)
+			break;
+	}
+
+	return (err);
+}
+
+int
+gen_label_tlv(struct ibuf *buf, uint32_t label)
+{
+	struct label_tlv	lt;
+
+	lt.type = htons(TLV_TYPE_GENERICLABEL);
+	lt.length = htons(LABEL_TLV_LEN);
+	lt.label = htonl(label);
+
+	return (ibuf_add(buf, &lt, sizeof(lt)));
+}
+
+int
+gen_reqid_tlv(struct ibuf *buf, uint32_t reqid)
+{
+	struct reqid_tlv	rt;
+
+	rt.type = htons(TLV_TYPE_LABELREQUEST);
+	rt.length = htons(REQID_TLV_LEN);
+	rt.reqid = htonl(reqid);
+
+	return (ibuf_add(buf, &rt, sizeof(rt)));
+}
+
+int
+gen_pw_status_tlv(struct ibuf *buf, uint32_t status)
+{
+	struct pw_status_tlv	st;
+
+	st.type = htons(TLV_TYPE_PW_STATUS);
+	st.length = htons(PW_STATUS_TLV_LEN);
+	st.value = htonl(status);
+
+	return (ibuf_add(buf, &st, sizeof(st)));
+}
+
+int
+gen_fec_tlv(struct ibuf *buf, struct map *map)
+{
+	struct tlv	ft;
+	uint16_t	family, len, pw_type, ifmtu;
+	uint8_t		pw_len = 0;
+	uint32_t	group_id, pwid;
+	int		err = 0;
+
+	ft.type = htons(TLV_TYPE_FEC);
+
+	switch (map->type) {
+	case MAP_TYPE_WILDCARD:
+		ft.length = htons(sizeof(uint8_t));
+		err |= ibuf_add(buf, &ft, sizeof(ft));
+		err |= ibuf_add(buf, &map->type, sizeof(map->type));
+		break;
+	case MAP_TYPE_PREFIX:
+		len = PREFIX_SIZE(map->fec.prefix.prefixlen);
+		ft.length = htons(sizeof(map->type) + sizeof(family) +
+		    sizeof(map->fec.prefix.prefixlen) + len);
+		err |= ibuf_add(buf, &ft, sizeof(ft));
+		err |= ibuf_add(buf, &map->type, sizeof(map->type));
+		switch (map->fec.prefix.af) {
+		case AF_INET:
+			family = htons(AF_IPV4);
+			break;
+		case AF_INET6:
+			family = htons(AF_IPV6);
+			break;
+		default:
+			fatalx("gen_fec_tlv: unknown af");
+			break;
+		}
+		err |= ibuf_add(buf, &family, sizeof(family));
+		err |= ibuf_add(buf, &map->fec.prefix.prefixlen,
+		    sizeof(map->fec.prefix.prefixlen));
+		if (len)
+			err |= ibuf_add(buf, &map->fec.prefix.prefix, len);
+		break;
+	case MAP_TYPE_PWID:
+		if (map->flags & F_MAP_PW_ID)
+			pw_len += PW_STATUS_TLV_LEN;
+		if (map->flags & F_MAP_PW_IFMTU)
+			pw_len += FEC_SUBTLV_IFMTU_SIZE;
+
+		len = FEC_PWID_ELM_MIN_LEN + pw_len;
+
+		ft.length = htons(len);
+		err |= ibuf_add(buf, &ft, sizeof(ft));
+
+		err |= ibuf_add(buf, &map->type, sizeof(uint8_t));
+		pw_type = map->fec.pwid.type;
+		if (map->flags & F_MAP_PW_CWORD)
+			pw_type |= CONTROL_WORD_FLAG;
+		pw_type = htons(pw_type);
+		err |= ibuf_add(buf, &pw_type, sizeof(uint16_t));
+		err |= ibuf_add(buf, &pw_len, sizeof(uint8_t));
+		group_id = htonl(map->fec.pwid.group_id);
+		err |= ibuf_add(buf, &group_id, sizeof(uint32_t));
+		if (map->flags & F_MAP_PW_ID) {
+			pwid = htonl(map->fec.pwid.pwid);
+			err |= ibuf_add(buf, &pwid, sizeof(uint32_t));
+		}
+		if (map->flags & F_MAP_PW_IFMTU) {
+			struct subtlv 	stlv;
+
+			stlv.type = SUBTLV_IFMTU;
+			stlv.length = FEC_SUBTLV_IFMTU_SIZE;
+			err |= ibuf_add(buf, &stlv, sizeof(uint16_t));
+
+			ifmtu = htons(map->fec.pwid.ifmtu);
+			err |= ibuf_add(buf, &ifmtu, sizeof(uint16_t));
+		}
+		break;
+	default:
+		break;
+	}
+
+	return (err);
+}
+
+int
+gen_status_tlv(struct ibuf *buf, uint32_t status_code, uint32_t msg_id,
+    uint16_t msg_type)
+{
+	struct status_tlv	st;
+
+	memset(&st, 0, sizeof(st));
+	st.type = htons(TLV_TYPE_STATUS);
+	st.length = htons(STATUS_TLV_LEN);
+	st.status_code = htonl(status_code);
+	/*
+	 * For convenience, msg_id and msg_type are already in network
+	 * byte order.
+	 */
+	st.msg_id = msg_id;
+	st.msg_type = msg_type;
+
+	return (ibuf_add(buf, &st, STATUS_SIZE));
+}
+
+ssize_t
+session_get_pdu(struct ibuf_read *r, char **b)
+{
+	struct ldp_hdr	l;
+	size_t		av, dlen, left;
+
+	av = r->wpos;
+	if (av < sizeof(l))
+		return (0);
+
+	memcpy(&l, r->buf, sizeof(l));
+	dlen = ntohs(l.length) + LDP_HDR_DEAD_LEN;
+	if (dlen > av)
+		return (0);
+
+	if ((*b = malloc(dlen)) == NULL)
+		return (-1);
+
+	memcpy(*b, r->buf, dlen);
+	if (dlen < av) {
+		left = av - dlen;
+		memmove(r->buf, r->buf + dlen, left);
+		r->wpos = left;
+	} else
+		r->wpos = 0;
+
+	return (dlen);
+}
@@ -37,6 +37,9 @@ static struct ctl_conn	*control_connbypid(pid_t);
 static void		 control_close(int);
 static void		 control_dispatch_imsg(int, short, void *);
 
+PROF_CALLBACK(control_accept)
+PROF_CALLBACK(control_dispatch_imsg)
+
 struct ctl_conns	 ctl_conns;
 
 static int		 control_fd;
@@ -94,7 +97,7 @@ control_listen(void)
 		return (-1);
 	}
 
-	return (accept_add(control_fd, control_accept, NULL));
+	return (accept_add(control_fd, PROF(control_accept), NULL));
 }
 
 void
@@ -115,19 +118,9 @@ control_accept(int listenfd, short event, void *bula)
 	struct ctl_conn		*c;
 
 	len = sizeof(sun);
-	if ((connfd = accept4(listenfd, (struct sockaddr *)&sun, &len,
-	    SOCK_NONBLOCK | SOCK_CLOEXEC)) == -1) {
-		/*
-		 * Pause accept if we are out of file descriptors, or
-		 * libevent will haunt us here too.
-		 */
-		if (errno == ENFILE || errno == EMFILE)
-			accept_pause();
-		else if (errno != EWOULDBLOCK && errno != EINTR &&
-		    errno != ECONNABORTED)
-			log_warn("%s: accept4", __func__);
+	if ((connfd = accept_sock(listenfd, (struct sockaddr *)&sun,
+	    &len)) == -1)
 		return;
-	}
 
 	if ((c = calloc(1, sizeof(struct ctl_conn))) == NULL) {
 		log_warn(__func__);
@@ -136,7 +129,7 @@ control_accept(int listenfd, short event, void *bula)
 	}
 
 	imsg_init(&c->iev.ibuf, connfd);
-	c->iev.handler = control_dispatch_imsg;
+	c->iev.handler = PROF(control_dispatch_imsg);
 	c->iev.events = EV_READ;
 	event_set(&c->iev.ev, c->iev.ibuf.fd, c->iev.events,
 	    c->iev.handler, &c->iev);
@@ -182,6 +175,11 @@ control_close(int fd)
 	msgbuf_clear(&c->iev.ibuf.w);
 	TAILQ_REMOVE(&ctl_conns, c, entry);
 
+	/* stop the replies still being built for this client */
+	if (c->iev.ibuf.pid != 0 && control_connbypid(c->iev.ibuf.pid) == NULL)
+		ldpe_imsg_compose_lde(IMSG_CTL_CLIENT_GONE, 0, c->iev.ibuf.pid,
+		    NULL, 0);
+
 	event_del(&c->iev.ev);
 	close(c->iev.ibuf.fd);
 	accept_unpause();
@@ -192,11 +190,12 @@ control_close(int fd)
 static void
 control_dispatch_imsg(int fd, short event, void *bula)
 {
-	struct ctl_conn	*c;
-	struct imsg	 imsg;
-	ssize_t		 n;
-	unsigned int	 ifidx;
-	int		 verbose;
+	struct ctl_conn		*c;
+	struct imsg		 imsg;
+	struct ctl_prof_req	 profreq;
+	ssize_t			 n;
+	unsigned int		 ifidx;
+	int			 verbose, proc;
 
 	if ((c = control_connbyfd(fd)) == NULL) {
 		log_warnx("%s: fd %d: not found", __func__, fd);
@@ -236,6 +235,8 @@ control_dispatch_imsg(int fd, short event, void *bula)
 		case IMSG_CTL_KROUTE:
 		case IMSG_CTL_KROUTE_ADDR:
 		case IMSG_CTL_IFINFO:
+		case IMSG_CTL_SHOW_FIB:
+		case IMSG_CTL_LIB_SNAPSHOT:
 			c->iev.ibuf.pid = imsg.hdr.pid;
 			ldpe_imsg_compose_parent(imsg.hdr.type,
 			    imsg.hdr.pid, imsg.data,
@@ -263,6 +264,68 @@ control_dispatch_imsg(int fd, short event, void *bula)
 		case IMSG_CTL_SHOW_NBR:
 			ldpe_nbr_ctl(c);
 			break;
+		case IMSG_CTL_SHOW_PENDING_CONN:
+			ldpe_pending_conn_ctl(c);
+			break;
+		case IMSG_CTL_SHOW_NBR_CONNQ:
+			ldpe_nbr_connq_ctl(c);
+			break;
+		case IMSG_CTL_SHOW_ACCEPT:
+			ldpe_accept_ctl(c);
+			break;
+		case IMSG_CTL_SHOW_MEMORY:
+			c->iev.ibuf.pid = imsg.hdr.pid;
+			ldpe_memory_ctl(c);
+			break;
+		case IMSG_CTL_SHOW_TRACE:
+		case IMSG_CTL_SHOW_STATS:
+		case IMSG_CTL_SHOW_PROF:
+			if (imsg.hdr.len != IMSG_HEADER_SIZE + sizeof(proc))
+				break;
+
+			c->iev.ibuf.pid = imsg.hdr.pid;
+			memcpy(&proc, imsg.data, sizeof(proc));
+			switch (proc) {
+			case PROC_MAIN:
+				ldpe_imsg_compose_parent(imsg.hdr.type,
+				    imsg.hdr.pid, NULL, 0);
+				break;
+			case PROC_LDE_ENGINE:
+				ldpe_imsg_compose_lde(imsg.hdr.type, 0,
+				    imsg.hdr.pid, NULL, 0);
+				break;
+			default:
+				if (imsg.hdr.type == IMSG_CTL_SHOW_TRACE)
+					trace_ctl(imsg.hdr.pid,
+					    control_compose);
+				else if (imsg.hdr.type == IMSG_CTL_SHOW_STATS)
+					stats_ctl(imsg.hdr.pid,
+					    control_compose);
+				else
+					prof_ctl(imsg.hdr.pid,
+					    control_compose);
+				break;
+			}
+			break;
+		case IMSG_CTL_PROF:
+			if (imsg.hdr.len != IMSG_HEADER_SIZE + sizeof(profreq))
+				break;
+
+			memcpy(&profreq, imsg.data, sizeof(profreq));
+			switch (profreq.proc) {
+			case PROC_MAIN:
+				ldpe_imsg_compose_parent(imsg.hdr.type, 0,
+				    &profreq, sizeof(profreq));
+				break;
+			case PROC_LDE_ENGINE:
+				ldpe_imsg_compose_lde(imsg.hdr.type, 0, 0,
+				    &profreq, sizeof(profreq));
+				break;
+			default:
+				prof_cmd(profreq.cmd);
+				break;
+			}
+			break;
 		case IMSG_CTL_CLEAR_NBR:
 			if (imsg.hdr.len != IMSG_HEADER_SIZE +
 			    sizeof(struct ctl_nbr))
@@ -295,6 +358,18 @@ control_dispatch_imsg(int fd, short event, void *bula)
 	imsg_event_add(&c->iev);
 }
 
+/* answer a client identified by its pid, for replies built in the ldpe */
+void
+control_compose(int type, pid_t pid, void *data, uint16_t datalen)
+{
+	struct ctl_conn	*c;
+
+	if ((c = control_connbypid(pid)) == NULL)
+		return;
+
+	imsg_compose_event(&c->iev, type, 0, pid, -1, data, datalen);
+}
+
 int
 control_imsg_relay(struct imsg *imsg)
 {
@@ -34,5 +34,6 @@ int	control_init(void);
 int	control_listen(void);
 void	control_cleanup(void);
 int	control_imsg_relay(struct imsg *);
+void	control_compose(int, pid_t, void *, uint16_t);
 
 #endif	/* _CONTROL_H_ */
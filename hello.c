@@ -25,9 +25,6 @@
 #include "ldpe.h"
 #include "log.h"
 
-static int	gen_hello_prms_tlv(struct ibuf *buf, uint16_t, uint16_t);
-static int	gen_opt4_hello_prms_tlv(struct ibuf *, uint16_t, uint32_t);
-static int	gen_opt16_hello_prms_tlv(struct ibuf *, uint16_t, uint8_t *);
 static int	gen_ds_hello_prms_tlv(struct ibuf *, uint32_t);
 static int	tlv_decode_hello_prms(char *, uint16_t, uint16_t *, uint16_t *);
 static int	tlv_decode_opt_hello_prms(char *, uint16_t, int *, int,
@@ -405,46 +402,6 @@ recv_hello(struct in_addr lsr_id, struct ldp_msg *msg, int af,
 		nbr_establish_connection(nbr);
 }
 
-static int
-gen_hello_prms_tlv(struct ibuf *buf, uint16_t holdtime, uint16_t flags)
-{
-	struct hello_prms_tlv	parms;
-
-	memset(&parms, 0, sizeof(parms));
-	parms.type = htons(TLV_TYPE_COMMONHELLO);
-	parms.length = htons(sizeof(parms.holdtime) + sizeof(parms.flags));
-	parms.holdtime = htons(holdtime);
-	parms.flags = htons(flags);
-
-	return (ibuf_add(buf, &parms, sizeof(parms)));
-}
-
-static int
-gen_opt4_hello_prms_tlv(struct ibuf *buf, uint16_t type, uint32_t value)
-{
-	struct hello_prms_opt4_tlv	parms;
-
-	memset(&parms, 0, sizeof(parms));
-	parms.type = htons(type);
-	parms.length = htons(sizeof(parms.value));
-	parms.value = value;
-
-	return (ibuf_add(buf, &parms, sizeof(parms)));
-}
-
-static int
-gen_opt16_hello_prms_tlv(struct ibuf *buf, uint16_t type, uint8_t *value)
-{
-	struct hello_prms_opt16_tlv	parms;
-
-	memset(&parms, 0, sizeof(parms));
-	parms.type = htons(type);
-	parms.length = htons(sizeof(parms.value));
-	memcpy(&parms.value, value, sizeof(parms.value));
-
-	return (ibuf_add(buf, &parms, sizeof(parms)));
-}
-
 static int
 gen_ds_hello_prms_tlv(struct ibuf *buf, uint32_t value)
 {
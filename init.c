@@ -24,7 +24,6 @@
 #include "ldpe.h"
 #include "log.h"
 
-static int	gen_init_prms_tlv(struct ibuf *, struct nbr *);
 
 void
 send_init(struct nbr *nbr)
@@ -43,13 +42,14 @@ send_init(struct nbr *nbr)
 	size -= LDP_HDR_SIZE;
 	err |= gen_msg_hdr(buf, MSG_TYPE_INIT, size);
 	size -= LDP_MSG_SIZE;
-	err |= gen_init_prms_tlv(buf, nbr);
+	err |= gen_init_prms_tlv(buf, nbr_get_keepalive(nbr->af, nbr->id),
+	    nbr->id);
 	if (err) {
 		ibuf_free(buf);
 		return;
 	}
 
-	evbuf_enqueue(&nbr->tcp->wbuf, buf);
+	session_enqueue(nbr->tcp, buf, MSG_TYPE_INIT, 1);
 }
 
 int
@@ -146,21 +146,3 @@ recv_init(struct nbr *nbr, char *buf, uint16_t len)
 	return (0);
 }
 
-static int
-gen_init_prms_tlv(struct ibuf *buf, struct nbr *nbr)
-{
-	struct sess_prms_tlv	parms;
-
-	memset(&parms, 0, sizeof(parms));
-	parms.type = htons(TLV_TYPE_COMMONSESSION);
-	parms.length = htons(SESS_PRMS_LEN);
-	parms.proto_version = htons(LDP_VERSION);
-	parms.keepalive_time = htons(nbr_get_keepalive(nbr->af, nbr->id));
-	parms.reserved = 0;
-	parms.pvlim = 0;
-	parms.max_pdu_len = 0;
-	parms.lsr_id = nbr->id.s_addr;
-	parms.lspace_id = 0;
-
-	return (ibuf_add(buf, &parms, SESS_PRMS_SIZE));
-}
@@ -41,6 +41,8 @@ static int		 if_leave_ipv4_group(struct iface *, struct in_addr *);
 static int		 if_join_ipv6_group(struct iface *, struct in6_addr *);
 static int		 if_leave_ipv6_group(struct iface *, struct in6_addr *);
 
+PROF_CALLBACK(if_hello_timer)
+
 struct iface *
 if_new(struct kif *kif)
 {
@@ -258,7 +260,7 @@ if_start(struct iface *iface, int af)
 
 	send_hello(HELLO_LINK, ia, NULL);
 
-	evtimer_set(&ia->hello_timer, if_hello_timer, ia);
+	evtimer_set(&ia->hello_timer, PROF(if_hello_timer), ia);
 	if_start_hello_timer(ia);
 	return (0);
 }
@@ -379,6 +381,7 @@ if_hello_timer(int fd, short event, void *arg)
 {
 	struct iface_af		*ia = arg;
 
+	trace(TRACE_TIMER, TRACE_TIMER_LINK_HELLO, ia->iface->ifindex, 0, 0);
 	send_hello(HELLO_LINK, ia, NULL);
 	if_start_hello_timer(ia);
 }
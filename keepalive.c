@@ -37,7 +37,7 @@ send_keepalive(struct nbr *nbr)
 	size -= LDP_HDR_SIZE;
 	gen_msg_hdr(buf, MSG_TYPE_KEEPALIVE, size);
 
-	evbuf_enqueue(&nbr->tcp->wbuf, buf);
+	session_enqueue(nbr->tcp, buf, MSG_TYPE_KEEPALIVE, 1);
 }
 
 int
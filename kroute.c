@@ -23,6 +23,7 @@
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <sys/sysctl.h>
+#include <sys/time.h>
 #include <arpa/inet.h>
 #include <net/if_dl.h>
 #include <net/route.h>
@@ -32,10 +33,19 @@
 #include <string.h>
 #include <unistd.h>
 #include <limits.h>
+#include <time.h>
 
 #include "ldpd.h"
 #include "log.h"
 
+#define KR_RESYNC_HOLDTIME	60	/* secs to learn labels after startup */
+#define KRT_SYNC_CHUNK		512	/* routes per event loop iteration */
+#define KR_FLUSH_MAX		256	/* route ops per event loop iteration */
+#define KR_FLUSH_BUDGET		20	/* msecs per event loop iteration */
+#define KR_LATENCY_BUCKETS	32	/* log2 of usecs */
+#define KR_REDIST_BATCH		\
+	((MAX_IMSGSIZE - IMSG_HEADER_SIZE) / sizeof(struct kroute))
+
 struct {
 	uint32_t		rtseq;
 	pid_t			pid;
@@ -43,11 +53,15 @@ struct {
 	int			fd;
 	int			ioctl_fd;
 	struct event		ev;
+	struct kr_backend	*be;
 } kr_state;
 
 struct kroute_node {
 	TAILQ_ENTRY(kroute_node)	 entry;
 	struct kroute_priority		*kprio;		/* back pointer */
+	uint32_t			 gen;		/* last seen in krt_gen */
+	struct kr_nh			*nh;		/* shared nexthop */
+	TAILQ_ENTRY(kroute_node)	 nh_entry;
 	struct kroute			 r;
 };
 
@@ -60,6 +74,7 @@ struct kroute_priority {
 
 struct kroute_prefix {
 	RB_ENTRY(kroute_prefix)		 entry;
+	struct ptrie_node		*tn;		/* lpm trie node */
 	int				 af;
 	union ldpd_addr			 prefix;
 	uint8_t				 prefixlen;
@@ -82,10 +97,74 @@ struct kif_node {
 RB_HEAD(kif_tree, kif_node);
 RB_PROTOTYPE(kif_tree, kif_node, entry, kif_compare)
 
+/*
+ * Route operations are not written to the FIB right away. They are queued,
+ * keyed by what they program in the kernel, and flushed once per event loop
+ * iteration so that a later operation on the same key supersedes an earlier
+ * one that was not written yet.
+ */
+struct kr_op {
+	RB_ENTRY(kr_op)		 entry;
+	TAILQ_ENTRY(kr_op)	 order;
+	struct timespec		 queued;
+	int			 action;
+	int			 family;
+	struct kroute		 kr;
+};
+RB_HEAD(kr_op_tree, kr_op);
+RB_PROTOTYPE(kr_op_tree, kr_op, entry, kr_op_compare)
+
+/*
+ * Labelled entries found in the kernel FIB, indexed like the queued route
+ * operations. The index lives only while the FIB is being resynchronized so
+ * that just the missing, stale or wrong entries get programmed.
+ */
+struct kr_fib_entry {
+	RB_ENTRY(kr_fib_entry)	 entry;
+	int			 family;
+	int			 seen;
+	struct kroute		 kr;
+};
+RB_HEAD(kr_fib_tree, kr_fib_entry);
+RB_PROTOTYPE(kr_fib_tree, kr_fib_entry, entry, kr_fib_compare)
+
+/*
+ * Routes changed by routing messages while a table dump is replayed. The
+ * dump is older than these messages, so its entries for them are skipped.
+ */
+struct krt_touched {
+	RB_ENTRY(krt_touched)	 entry;
+	struct kroute		 kr;
+};
+RB_HEAD(krt_touched_tree, krt_touched);
+RB_PROTOTYPE(krt_touched_tree, krt_touched, entry, krt_touched_compare)
+
+/*
+ * Nexthops shared by the labelled routes and LSPs going through them. With
+ * a backend that supports nexthop objects the FIB entries reference them by
+ * id, so a failed nexthop takes a single write however many FECs are behind
+ * it. Every labelled entry is tracked by its nexthop whatever the backend,
+ * so that a failed one can be withdrawn in one pass. A failed object leaves
+ * the index at once and is only uninstalled once nothing references it and
+ * the queued operations were written.
+ */
+struct kr_nh {
+	RB_ENTRY(kr_nh)		 entry;
+	TAILQ_ENTRY(kr_nh)	 unused;
+	TAILQ_HEAD(, kroute_node) nodes;
+	struct knexthop		 k;
+};
+RB_HEAD(kr_nh_tree, kr_nh);
+RB_PROTOTYPE(kr_nh_tree, kr_nh, entry, kr_nh_compare)
+
 static void		 kr_dispatch_msg(int, short, void *);
 static void		 kr_redist_remove(struct kroute *);
 static int		 kr_redist_eval(struct kroute *);
+static int		 kr_redist_policy(struct kroute_prefix *);
 static void		 kr_redistribute(struct kroute_prefix *);
+static void		 kr_redist_queue(int, struct kroute *);
+static void		 kr_redist_flush(void);
+static uint32_t		 kr_startup_msecs(void);
 static __inline int	 kroute_compare(struct kroute_prefix *,
 			    struct kroute_prefix *);
 static struct kroute_prefix	*kroute_find_prefix(int, union ldpd_addr *,
@@ -97,6 +176,7 @@ static struct kroute_node	*kroute_find_gw(struct kroute_priority *,
 static int		 kroute_insert(struct kroute *);
 static int		 kroute_uninstall(struct kroute_node *);
 static int		 kroute_remove(struct kroute *);
+static int		 kroute_sweep(struct kroute_prefix *);
 static void		 kroute_clear(void);
 static __inline int	 kif_compare(struct kif_node *, struct kif_node *);
 static struct kif_node	*kif_find(unsigned short);
@@ -104,6 +184,7 @@ static struct kif_node	*kif_insert(unsigned short);
 static int		 kif_remove(struct kif_node *);
 static struct kif_node	*kif_update(unsigned short, int, struct if_data *,
 			    struct sockaddr_dl *, int *);
+static struct ptrie_node	**kroute_trie_root(int);
 static struct kroute_priority	*kroute_match(int, union ldpd_addr *);
 static uint8_t		 prefixlen_classful(in_addr_t);
 static void		 get_rtaddrs(int, struct sockaddr *,
@@ -115,11 +196,50 @@ static void		 if_newaddr(unsigned short, struct sockaddr *,
 static void		 if_deladdr(unsigned short, struct sockaddr *,
 			    struct sockaddr *, struct sockaddr *);
 static void		 if_announce(void *);
-static int		 send_rtmsg(int, int, struct kroute *, int);
+static int		 kr_send(int, struct kroute *, int);
+static int		 kr_key_compare(int, struct kroute *, int,
+			    struct kroute *);
+static __inline int	 kr_op_compare(struct kr_op *, struct kr_op *);
+static void		 kr_op_del(struct kr_op *);
+static void		 kr_op_async(struct kr_op *);
+static void		 kr_flush_timer(int, short, void *);
+static void		 kr_flush(int);
+static void		 kr_op_done(struct kr_op *, int, struct timespec *);
+static uint32_t		 kr_latency_pct(int);
+static __inline int	 kr_fib_compare(struct kr_fib_entry *,
+			    struct kr_fib_entry *);
+static void		 kr_fib_index_add(int, struct kroute *);
+static void		 kr_fib_index_update(int, int, struct kroute *);
+static void		 kr_fib_index_clear(void);
+static void		 kr_resync_start(void);
+static int		 kr_resync_filter(int *, struct kroute *, int);
+static void		 kr_resync_set(int, struct kroute *);
+static void		 kr_resync_timer(int, short, void *);
+static void		 kr_resync_finish(void);
+static __inline int	 kr_nh_compare(struct kr_nh *, struct kr_nh *);
+static void		 kr_nh_bind(struct kroute_node *);
+static void		 kr_nh_unbind(struct kroute_node *);
+static void		 kr_nh_install(struct kr_nh *);
+static void		 kr_nh_gc(void);
+static __inline int	 krt_touched_compare(struct krt_touched *,
+			    struct krt_touched *);
+static void		 krt_touch(struct kroute *);
+static int		 krt_replay_skip(struct kroute *);
+static void		 krt_touched_clear(void);
+static void		 krt_desync(void);
+static int		 krt_dump_start(void);
+static void		 krt_resync_start(void);
+static void		 krt_resync_step(int, short, void *);
+static int		 rtsock_init(void);
+static int		 send_rtmsg(int, struct kroute *, int);
 static int		 send_rtmsg_v4(int fd, int, struct kroute *, int);
 static int		 send_rtmsg_v6(int fd, int, struct kroute *, int);
+static char		*rtsock_dump(int, size_t *);
 static int		 fetchtable(void);
 static int		 fetchifs(void);
+static int		 fetchlabels(void);
+static int		 rtmsg_process_label(struct rt_msghdr *,
+			    struct sockaddr *[RTAX_MAX]);
 static int		 dispatch_rtmsg(void);
 static int		 rtmsg_process(char *, size_t);
 static int		 rtmsg_process_route(struct rt_msghdr *,
@@ -127,16 +247,156 @@ static int		 rtmsg_process_route(struct rt_msghdr *,
 static int		 kmpw_install(const char *, struct kpw *);
 static int		 kmpw_uninstall(const char *);
 
+PROF_CALLBACK(kr_dispatch_msg)
+PROF_CALLBACK(kr_flush_timer)
+PROF_CALLBACK(kr_resync_timer)
+PROF_CALLBACK(krt_resync_step)
+
 RB_GENERATE(kroute_tree, kroute_prefix, entry, kroute_compare)
 RB_GENERATE(kif_tree, kif_node, entry, kif_compare)
+RB_GENERATE(kr_op_tree, kr_op, entry, kr_op_compare)
+RB_GENERATE(kr_fib_tree, kr_fib_entry, entry, kr_fib_compare)
+RB_GENERATE(kr_nh_tree, kr_nh, entry, kr_nh_compare)
+RB_GENERATE(krt_touched_tree, krt_touched, entry, krt_touched_compare)
 
 static struct kroute_tree	 krt = RB_INITIALIZER(&krt);
+static struct ptrie_node	*krt_trie_v4;
+static struct ptrie_node	*krt_trie_v6;
+static uint32_t			 krt_gen;
 static struct kif_tree		 kit = RB_INITIALIZER(&kit);
 
+static struct {
+	struct kr_op_tree	 ops;
+	TAILQ_HEAD(, kr_op)	 order;
+	TAILQ_HEAD(, kr_op)	 inflight;	/* written, not completed */
+	struct event		 ev;
+	uint32_t		 pending;
+	uint32_t		 pending_max;
+	uint64_t		 queued;
+	uint64_t		 written;
+	uint64_t		 saved;
+	uint64_t		 errors;
+	uint64_t		 flushes;
+	uint64_t		 latency_total;
+	uint32_t		 latency_max;
+	uint64_t		 latency[KR_LATENCY_BUCKETS];
+} kr_queue = {
+	RB_INITIALIZER(&kr_queue.ops),
+	TAILQ_HEAD_INITIALIZER(kr_queue.order),
+	TAILQ_HEAD_INITIALIZER(kr_queue.inflight)
+};
+
+static struct {
+	struct kr_fib_tree	 fib;
+	struct event		 ev;
+	int			 active;
+	uint32_t		 resyncs;
+	uint32_t		 add;
+	uint32_t		 change;
+	uint32_t		 delete;
+	uint32_t		 noop;
+} kr_resync = {
+	RB_INITIALIZER(&kr_resync.fib)
+};
+
+static struct {
+	struct kr_nh_tree	 tree;		/* nexthops not failed */
+	TAILQ_HEAD(, kr_nh)	 unused;	/* waiting to be uninstalled */
+	uint32_t		 next_id;
+	uint32_t		 count;
+	uint64_t		 failures;
+	uint64_t		 elided;	/* writes the failures saved */
+} kr_nhs = {
+	RB_INITIALIZER(&kr_nhs.tree),
+	TAILQ_HEAD_INITIALIZER(kr_nhs.unused)
+};
+
+/*
+ * Recovery from lost routing messages: the table dump is replayed against
+ * krt and the routes not seen in it are swept, a chunk at a time. The
+ * initial routing table is loaded the same way.
+ */
+enum krt_sync_state {
+	KRT_SYNC_IDLE,
+	KRT_SYNC_REPLAY,
+	KRT_SYNC_SWEEP
+};
+
+static struct {
+	enum krt_sync_state	 state;
+	char			*buf;
+	size_t			 len;
+	size_t			 offset;
+	int			 replaying;	/* processing the dump */
+	struct krt_touched_tree	 touched;	/* updated since the dump */
+	struct kroute_prefix	 cursor;	/* next prefix to sweep */
+	int			 again;		/* overflow while resyncing */
+	struct event		 ev;
+	struct timespec		 start;
+	uint64_t		 overflows;
+	uint64_t		 resyncs;
+	uint32_t		 msecs;		/* duration of the last one */
+} krt_sync;
+
+/* redistributed routes are sent to the lde in batches */
+static struct {
+	int			 type;
+	unsigned int		 count;
+	struct kroute		 kr[KR_REDIST_BATCH];
+} kr_redist_batch;
+
+/* when the routing message being processed was read, see stats.c */
+static uint64_t			 kr_event_ts;
+
+static struct {
+	struct timespec		 start;
+	int			 loading;	/* initial table dump */
+	uint32_t		 redist;	/* routes sent while loading */
+	uint32_t		 labelled;	/* of those, with a local label */
+	uint32_t		 table_msecs;
+	uint32_t		 first_label_msecs;
+	uint32_t		 full_lib_msecs;
+} kr_startup;
+
+/* OpenBSD routing socket, the default backend */
+static struct kr_backend	 kr_rtsock_backend = {
+	"routing socket",
+	rtsock_init,
+	fetchifs,
+	fetchtable,
+	fetchlabels,
+	send_rtmsg,
+	kmpw_install,
+	kmpw_uninstall,
+	NULL,
+	NULL
+};
+
+/* must be called before kif_init() */
+void
+kr_set_backend(struct kr_backend *be)
+{
+	kr_state.be = be;
+}
+
+/* learn a route from a backend that has no routing socket to parse */
+int
+kr_table_add(struct kroute *kr)
+{
+	kr->local_label = NO_LABEL;
+	kr->remote_label = NO_LABEL;
+	return (kroute_insert(kr));
+}
+
 int
 kif_init(void)
 {
-	if (fetchifs() == -1)
+	clock_gettime(CLOCK_MONOTONIC, &kr_startup.start);
+	if (kr_state.be == NULL)
+		kr_state.be = &kr_rtsock_backend;
+	log_debug("%s: using %s backend", __func__, kr_state.be->name);
+
+	if (kr_state.be->fetchifs() == -1)
 		return (-1);
 
 	return (0);
@@ -144,13 +404,72 @@ kif_init(void)
 
 int
 kr_init(int fs)
+{
+	int		 rv;
+
+	kr_state.fib_sync = fs;
+	kr_state.pid = getpid();
+	kr_state.rtseq = 1;
+	evtimer_set(&kr_queue.ev, PROF(kr_flush_timer), NULL);
+	evtimer_set(&kr_resync.ev, PROF(kr_resync_timer), NULL);
+	evtimer_set(&krt_sync.ev, PROF(krt_resync_step), NULL);
+
+	/* only the routing socket backend opens these */
+	kr_state.fd = -1;
+	kr_state.ioctl_fd = -1;
+	if (kr_state.be->init() == -1)
+		return (-1);
+
+	/*
+	 * Keep what a previous instance left in the FIB and only fix it up
+	 * once the LIB had time to converge. The index has to be there
+	 * before the first labels come in, which may be before the routing
+	 * table is fully loaded.
+	 */
+	if (kr_state.fib_sync)
+		kr_resync_start();
+
+	kr_startup.loading = 1;
+	if ((rv = kr_state.be->fetchtable()) == -1)
+		return (-1);
+	if (rv != KR_ASYNC)
+		kr_table_loaded();
+
+	return (0);
+}
+
+/* the initial routing table is in krt */
+void
+kr_table_loaded(void)
+{
+	struct timeval	 tv;
+
+	kr_startup.loading = 0;
+	kr_startup.table_msecs = kr_startup_msecs();
+	log_info("kernel routing table loaded in %u ms, %u routes "
+	    "redistributed", kr_startup.table_msecs, kr_startup.redist);
+	if (kr_startup.full_lib_msecs == 0 && kr_startup.redist > 0 &&
+	    kr_startup.labelled >= kr_startup.redist) {
+		kr_startup.full_lib_msecs = kr_startup.table_msecs;
+		log_info("all initial routes labelled after %u ms",
+		    kr_startup.full_lib_msecs);
+	}
+
+	if (kr_resync.active) {
+		timerclear(&tv);
+		tv.tv_sec = KR_RESYNC_HOLDTIME;
+		if (evtimer_add(&kr_resync.ev, &tv) == -1)
+			fatal(__func__);
+	}
+}
+
+static int
+rtsock_init(void)
 {
 	int		opt = 0, rcvbuf, default_rcvbuf;
 	socklen_t	optlen;
 	unsigned int	rtfilter;
 
-	kr_state.fib_sync = fs;
-
 	if ((kr_state.fd = socket(AF_ROUTE,
 	    SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) == -1) {
 		log_warn("%s: socket", __func__);
@@ -166,7 +485,8 @@ kr_init(int fs)
 	rtfilter = ROUTE_FILTER(RTM_ADD) | ROUTE_FILTER(RTM_GET) |
 	    ROUTE_FILTER(RTM_CHANGE) | ROUTE_FILTER(RTM_DELETE) |
 	    ROUTE_FILTER(RTM_IFINFO) | ROUTE_FILTER(RTM_NEWADDR) |
-	    ROUTE_FILTER(RTM_DELADDR) | ROUTE_FILTER(RTM_IFANNOUNCE);
+	    ROUTE_FILTER(RTM_DELADDR) | ROUTE_FILTER(RTM_IFANNOUNCE) |
+	    ROUTE_FILTER(RTM_DESYNC);
 
 	if (setsockopt(kr_state.fd, PF_ROUTE, ROUTE_MSGFILTER,
 	    &rtfilter, sizeof(rtfilter)) == -1)
@@ -185,14 +505,8 @@ kr_init(int fs)
 		    rcvbuf /= 2)
 			;	/* nothing */
 
-	kr_state.pid = getpid();
-	kr_state.rtseq = 1;
-
-	if (fetchtable() == -1)
-		return (-1);
-
 	event_set(&kr_state.ev, kr_state.fd, EV_READ | EV_PERSIST,
-	    kr_dispatch_msg, NULL);
+	    PROF(kr_dispatch_msg), NULL);
 	event_add(&kr_state.ev, NULL);
 
 	if ((kr_state.ioctl_fd = socket(AF_INET,
@@ -220,6 +534,11 @@ kif_redistribute(const char *ifname)
 	}
 }
 
+/*
+ * The writes are only queued here, so -1 means the FEC is unknown. Failed
+ * writes are logged by the backend and undone by kr_op_done() when the
+ * queue is flushed.
+ */
 int
 kr_change(struct kroute *kr)
 {
@@ -227,6 +546,7 @@ kr_change(struct kroute *kr)
 	struct kroute_priority	*kprio;
 	struct kroute_node	*kn;
 	int			 action = RTM_ADD;
+	int			 bound, error;
 
 	kp = kroute_find_prefix(kr->af, &kr->prefix, kr->prefixlen);
 	if (kp == NULL)
@@ -242,22 +562,40 @@ kr_change(struct kroute *kr)
 
 	if (kn->r.flags & F_LDPD_INSERTED)
 		action = RTM_CHANGE;
+	else if (kr_startup.full_lib_msecs == 0) {
+		if (kr_startup.first_label_msecs == 0) {
+			kr_startup.first_label_msecs = kr_startup_msecs();
+			log_info("first label after %u ms",
+			    kr_startup.first_label_msecs);
+		}
+		if (++kr_startup.labelled >= kr_startup.redist &&
+		    !kr_startup.loading) {
+			kr_startup.full_lib_msecs = kr_startup_msecs();
+			log_info("all initial routes labelled after %u ms",
+			    kr_startup.full_lib_msecs);
+		}
+	}
 
+	bound = kn->nh != NULL;
 	kn->r.local_label = kr->local_label;
 	kn->r.remote_label = kr->remote_label;
 	kn->r.flags = kn->r.flags | F_LDPD_INSERTED;
-
-	/* send update */
-	if (send_rtmsg(kr_state.fd, action, &kn->r, AF_MPLS) == -1)
-		return (-1);
+	kn->r.ts = kr->ts;
 
 	if (ldp_addrisset(kn->r.af, &kn->r.nexthop) &&
-	    kn->r.remote_label != NO_LABEL) {
-		if (send_rtmsg(kr_state.fd, RTM_CHANGE, &kn->r, AF_INET) == -1)
-			return (-1);
-	}
+	    kn->r.remote_label != NO_LABEL)
+		kr_nh_bind(kn);
+	else
+		kr_nh_unbind(kn);
 
-	return (0);
+	/* send update, the route also stops pushing a label it lost */
+	error = kr_send(action, &kn->r, AF_MPLS);
+	if (error == 0 && (kn->nh != NULL || bound))
+		error = kr_send(RTM_CHANGE, &kn->r, AF_INET);
+	/* later writes of the entry aren't caused by this mapping */
+	kn->r.ts = 0;
+
+	return (error);
 
 miss:
 	log_warnx("%s: lost FEC %s/%d nexthop %s", __func__,
@@ -291,15 +629,16 @@ kr_delete(struct kroute *kr)
 		update = 1;
 
 	/* kill MPLS LSP */
-	if (send_rtmsg(kr_state.fd, RTM_DELETE, &kn->r, AF_MPLS) == -1)
+	if (kr_send(RTM_DELETE, &kn->r, AF_MPLS) == -1)
 		return (-1);
 
 	kn->r.flags &= ~F_LDPD_INSERTED;
 	kn->r.local_label = NO_LABEL;
 	kn->r.remote_label = NO_LABEL;
+	kr_nh_unbind(kn);
 
 	if (update &&
-	    send_rtmsg(kr_state.fd, RTM_CHANGE, &kn->r, AF_INET) == -1)
+	    kr_send(RTM_CHANGE, &kn->r, AF_INET) == -1)
 		return (-1);
 
 	return (0);
@@ -309,6 +648,7 @@ void
 kr_shutdown(void)
 {
 	kr_fib_decouple();
+	kr_flush(1);
 	kroute_clear();
 	kif_clear();
 }
@@ -320,11 +660,16 @@ kr_fib_couple(void)
 	struct kroute_priority	*kprio;
 	struct kroute_node	*kn;
 	struct kif_node		*kif;
+	struct kr_nh		*nh;
 
 	if (kr_state.fib_sync == 1)	/* already coupled */
 		return;
 
 	kr_state.fib_sync = 1;
+	kr_resync_start();
+
+	RB_FOREACH(nh, kr_nh_tree, &kr_nhs.tree)
+		kr_nh_install(nh);
 
 	RB_FOREACH(kp, kroute_tree, &krt) {
 		kprio = TAILQ_FIRST(&kp->priorities);
@@ -335,11 +680,11 @@ kr_fib_couple(void)
 			if (!(kn->r.flags & F_LDPD_INSERTED))
 				continue;
 
-			send_rtmsg(kr_state.fd, RTM_ADD, &kn->r, AF_MPLS);
+			kr_send(RTM_ADD, &kn->r, AF_MPLS);
 
 			if (ldp_addrisset(kn->r.af, &kn->r.nexthop) &&
 			    kn->r.remote_label != NO_LABEL) {
-				send_rtmsg(kr_state.fd, RTM_CHANGE,
+				kr_send(RTM_CHANGE,
 				    &kn->r, AF_INET);
 			}
 		}
@@ -347,8 +692,9 @@ kr_fib_couple(void)
 
 	RB_FOREACH(kif, kif_tree, &kit)
 		if (kif->kpw)
-			kmpw_install(kif->k.ifname, kif->kpw);
+			kr_state.be->pw_install(kif->k.ifname, kif->kpw);
 
+	kr_resync_finish();
 	log_info("kernel routing table coupled");
 }
 
@@ -364,6 +710,12 @@ kr_fib_decouple(void)
 	if (kr_state.fib_sync == 0)	/* already decoupled */
 		return;
 
+	/* a pending startup resync has nothing left to fix */
+	if (kr_resync.active) {
+		evtimer_del(&kr_resync.ev);
+		kr_fib_index_clear();
+	}
+
 	RB_FOREACH(kp, kroute_tree, &krt) {
 		kprio = TAILQ_FIRST(&kp->priorities);
 		if (kprio == NULL)
@@ -373,14 +725,14 @@ kr_fib_decouple(void)
 			if (!(kn->r.flags & F_LDPD_INSERTED))
 				continue;
 
-			send_rtmsg(kr_state.fd, RTM_DELETE,
+			kr_send(RTM_DELETE,
 			    &kn->r, AF_MPLS);
 
 			if (ldp_addrisset(kn->r.af, &kn->r.nexthop) &&
 			    kn->r.remote_label != NO_LABEL) {
 				rl = kn->r.remote_label;
 				kn->r.remote_label = NO_LABEL;
-				send_rtmsg(kr_state.fd, RTM_CHANGE,
+				kr_send(RTM_CHANGE,
 				    &kn->r, AF_INET);
 				kn->r.remote_label = rl;
 			}
@@ -389,7 +741,7 @@ kr_fib_decouple(void)
 
 	RB_FOREACH(kif, kif_tree, &kit)
 		if (kif->kpw)
-			kmpw_uninstall(kif->k.ifname);
+			kr_state.be->pw_uninstall(kif->k.ifname);
 
 	kr_state.fib_sync = 0;
 	log_info("kernel routing table decoupled");
@@ -439,6 +791,186 @@ kr_dispatch_msg(int fd, short event, void *bula)
 		event_loopexit(NULL);
 }
 
+static __inline int
+krt_touched_compare(struct krt_touched *a, struct krt_touched *b)
+{
+	return (kr_key_compare(a->kr.af, &a->kr, b->kr.af, &b->kr));
+}
+
+/* a routing message changed this route while the dump is replayed */
+static void
+krt_touch(struct kroute *kr)
+{
+	struct krt_touched	*kt;
+
+	if ((kt = calloc(1, sizeof(*kt))) == NULL)
+		fatal(__func__);
+	kt->kr = *kr;
+	if (RB_INSERT(krt_touched_tree, &krt_sync.touched, kt) != NULL)
+		free(kt);
+}
+
+static int
+krt_replay_skip(struct kroute *kr)
+{
+	struct krt_touched	 key;
+
+	key.kr = *kr;
+	return (RB_FIND(krt_touched_tree, &krt_sync.touched, &key) != NULL);
+}
+
+static void
+krt_touched_clear(void)
+{
+	struct krt_touched	*kt;
+
+	while ((kt = RB_ROOT(&krt_sync.touched)) != NULL) {
+		RB_REMOVE(krt_touched_tree, &krt_sync.touched, kt);
+		free(kt);
+	}
+}
+
+/* the kernel dropped routing messages, krt can't be trusted anymore */
+static void
+krt_desync(void)
+{
+	krt_sync.overflows++;
+	log_warnx("routing socket overflow, resynchronizing routes");
+
+	if (krt_sync.state != KRT_SYNC_IDLE) {
+		/* the dump being replayed may already be stale */
+		krt_sync.again = 1;
+		return;
+	}
+	krt_resync_start();
+}
+
+/* take a table dump, krt_resync_step() replays it a chunk at a time */
+static int
+krt_dump_start(void)
+{
+	struct timeval	 tv;
+
+	if ((krt_sync.buf = rtsock_dump(0, &krt_sync.len)) == NULL)
+		return (-1);
+
+	/* routes not refreshed by the dump or by updates are gone */
+	krt_gen++;
+	krt_sync.offset = 0;
+	krt_touched_clear();
+	krt_sync.state = KRT_SYNC_REPLAY;
+	krt_sync.again = 0;
+	clock_gettime(CLOCK_MONOTONIC, &krt_sync.start);
+
+	timerclear(&tv);
+	if (evtimer_add(&krt_sync.ev, &tv) == -1)
+		fatal(__func__);
+	return (0);
+}
+
+static void
+krt_resync_start(void)
+{
+	struct timeval	 tv;
+
+	if (krt_dump_start() == 0)
+		return;
+
+	/* try again later */
+	krt_sync.again = 1;
+	timerclear(&tv);
+	tv.tv_sec = 1;
+	if (evtimer_add(&krt_sync.ev, &tv) == -1)
+		fatal(__func__);
+}
+
+/* ARGSUSED */
+static void
+krt_resync_step(int fd, short event, void *arg)
+{
+	struct rt_msghdr	*rtm;
+	struct kroute_prefix	*kp, *next;
+	struct timespec		 now, diff;
+	struct timeval		 tv;
+	size_t			 end;
+	int			 n;
+
+	switch (krt_sync.state) {
+	case KRT_SYNC_IDLE:
+		/* the table dump failed earlier */
+		if (krt_sync.again)
+			krt_resync_start();
+		return;
+	case KRT_SYNC_REPLAY:
+		end = krt_sync.offset;
+		for (n = 0; n < KRT_SYNC_CHUNK && end < krt_sync.len; n++) {
+			rtm = (struct rt_msghdr *)(krt_sync.buf + end);
+			if (krt_sync.len < end + sizeof(unsigned short) ||
+			    krt_sync.len < end + rtm->rtm_msglen ||
+			    rtm->rtm_msglen == 0)
+				fatalx("krt_resync_step: partial rtm in buffer");
+			end += rtm->rtm_msglen;
+		}
+		krt_sync.replaying = 1;
+		if (rtmsg_process(krt_sync.buf + krt_sync.offset,
+		    end - krt_sync.offset) == -1)
+			log_warnx("%s: failed to process the route dump",
+			    __func__);
+		krt_sync.replaying = 0;
+		krt_sync.offset = end;
+
+		if (krt_sync.offset == krt_sync.len) {
+			free(krt_sync.buf);
+			krt_sync.buf = NULL;
+			krt_touched_clear();
+			krt_sync.state = KRT_SYNC_SWEEP;
+			kp = RB_MIN(kroute_tree, &krt);
+			if (kp == NULL)
+				break;
+			krt_sync.cursor.af = kp->af;
+			krt_sync.cursor.prefix = kp->prefix;
+			krt_sync.cursor.prefixlen = kp->prefixlen;
+		}
+		timerclear(&tv);
+		if (evtimer_add(&krt_sync.ev, &tv) == -1)
+			fatal(__func__);
+		return;
+	case KRT_SYNC_SWEEP:
+		kp = RB_NFIND(kroute_tree, &krt, &krt_sync.cursor);
+		for (n = 0; n < KRT_SYNC_CHUNK && kp != NULL; n++) {
+			next = RB_NEXT(kroute_tree, &krt, kp);
+			kroute_sweep(kp);
+			kp = next;
+		}
+		kr_redist_flush();
+		if (kp != NULL) {
+			krt_sync.cursor.af = kp->af;
+			krt_sync.cursor.prefix = kp->prefix;
+			krt_sync.cursor.prefixlen = kp->prefixlen;
+			timerclear(&tv);
+			if (evtimer_add(&krt_sync.ev, &tv) == -1)
+				fatal(__func__);
+			return;
+		}
+		break;
+	}
+
+	/* done */
+	krt_sync.state = KRT_SYNC_IDLE;
+	if (kr_startup.loading)
+		kr_table_loaded();
+	else {
+		krt_sync.resyncs++;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		timespecsub(&now, &krt_sync.start, &diff);
+		krt_sync.msecs = diff.tv_sec * 1000 + diff.tv_nsec / 1000000;
+		log_info("routes resynchronized in %u ms", krt_sync.msecs);
+	}
+
+	if (krt_sync.again)
+		krt_resync_start();
+}
+
 void
 kr_show_route(struct imsg *imsg)
 {
@@ -503,6 +1035,272 @@ kr_ifinfo(char *ifname, pid_t pid)
 	main_imsg_compose_ldpe(IMSG_CTL_END, pid, NULL, 0);
 }
 
+static __inline int
+kr_fib_compare(struct kr_fib_entry *a, struct kr_fib_entry *b)
+{
+	return (kr_key_compare(a->family, &a->kr, b->family, &b->kr));
+}
+
+/* called by the backend for every labelled entry found in the kernel */
+static void
+kr_fib_index_add(int family, struct kroute *kr)
+{
+	struct kr_fib_entry	*fe;
+
+	if ((fe = calloc(1, sizeof(*fe))) == NULL)
+		fatal(__func__);
+	fe->family = family;
+	fe->kr = *kr;
+	if (RB_INSERT(kr_fib_tree, &kr_resync.fib, fe) != NULL)
+		/* multipath duplicate, keep the first one */
+		free(fe);
+}
+
+/*
+ * Follow the changes others make to labelled entries during the window.
+ * Otherwise an LSP removed behind our back would still be in the index and
+ * a later write restoring it would be skipped as a noop.
+ */
+static void
+kr_fib_index_update(int type, int family, struct kroute *kr)
+{
+	struct kr_fib_entry	 s, *fe;
+
+	s.family = family;
+	s.kr = *kr;
+	fe = RB_FIND(kr_fib_tree, &kr_resync.fib, &s);
+
+	if (type == RTM_DELETE ||
+	    (family != AF_MPLS && kr->remote_label == NO_LABEL)) {
+		if (fe != NULL) {
+			RB_REMOVE(kr_fib_tree, &kr_resync.fib, fe);
+			free(fe);
+		}
+		return;
+	}
+	if (fe == NULL)
+		kr_fib_index_add(family, kr);
+	else if (type == RTM_CHANGE)
+		fe->kr.remote_label = kr->remote_label;
+}
+
+static void
+kr_fib_index_clear(void)
+{
+	struct kr_fib_entry	*fe;
+
+	while ((fe = RB_ROOT(&kr_resync.fib)) != NULL) {
+		RB_REMOVE(kr_fib_tree, &kr_resync.fib, fe);
+		free(fe);
+	}
+	kr_resync.active = 0;
+}
+
+/*
+ * Load the labelled entries the kernel has into the index. Backends that
+ * can't enumerate them get everything programmed unconditionally.
+ */
+static void
+kr_resync_start(void)
+{
+	if (kr_state.be->fetchlabels == NULL)
+		return;
+
+	kr_fib_index_clear();
+	kr_resync.add = 0;
+	kr_resync.change = 0;
+	kr_resync.delete = 0;
+	kr_resync.noop = 0;
+	if (kr_state.be->fetchlabels() == -1) {
+		log_warnx("%s: failed to read the kernel FIB, reprogramming "
+		    "everything", __func__);
+		kr_fib_index_clear();
+		return;
+	}
+	kr_resync.active = 1;
+}
+
+/*
+ * Check a route operation against what the kernel already has. Returns 0 if
+ * the operation can be skipped, otherwise the action and the kroute are
+ * adjusted to fix up the kernel entry. The index follows every write let
+ * through, so that it always holds what the kernel will have once the
+ * queue is flushed.
+ */
+static int
+kr_resync_filter(int *action, struct kroute *kr, int family)
+{
+	struct kr_fib_entry	 s, *fe;
+	int			 labelled;
+
+	s.family = family;
+	s.kr = *kr;
+	fe = RB_FIND(kr_fib_tree, &kr_resync.fib, &s);
+
+	if (family == AF_MPLS) {
+		if (*action == RTM_DELETE) {
+			if (fe == NULL)
+				return (0);
+			RB_REMOVE(kr_fib_tree, &kr_resync.fib, fe);
+			free(fe);
+			return (1);
+		}
+		if (fe == NULL) {
+			kr_resync.add++;
+			*action = RTM_ADD;
+			kr_resync_set(family, kr);
+			return (1);
+		}
+		fe->seen = 1;
+		if (fe->kr.remote_label == kr->remote_label) {
+			kr_resync.noop++;
+			return (0);
+		}
+		kr_resync.change++;
+		*action = RTM_CHANGE;
+		fe->kr = *kr;
+		return (1);
+	}
+
+	/* labelled routes are only ever changed */
+	labelled = (*action != RTM_DELETE && kr->remote_label != NO_LABEL &&
+	    kr->remote_label != MPLS_LABEL_IMPLNULL);
+	if (fe == NULL) {
+		if (!labelled)
+			return (0);
+		kr_resync.add++;
+		kr_resync_set(family, kr);
+		return (1);
+	}
+	if (!labelled) {
+		/* strip the push label, stale or queued during the window */
+		RB_REMOVE(kr_fib_tree, &kr_resync.fib, fe);
+		free(fe);
+		kr->remote_label = NO_LABEL;
+		kr_resync.delete++;
+		return (1);
+	}
+	fe->seen = 1;
+	if (fe->kr.remote_label == kr->remote_label) {
+		kr_resync.noop++;
+		return (0);
+	}
+	kr_resync.change++;
+	fe->kr = *kr;
+	return (1);
+}
+
+/* record a write made during the window, kr_resync_finish() keeps it */
+static void
+kr_resync_set(int family, struct kroute *kr)
+{
+	struct kr_fib_entry	*fe;
+
+	if ((fe = calloc(1, sizeof(*fe))) == NULL)
+		fatal(__func__);
+	fe->family = family;
+	fe->seen = 1;
+	fe->kr = *kr;
+	if (RB_INSERT(kr_fib_tree, &kr_resync.fib, fe) != NULL)
+		fatalx("kr_resync_set: RB_INSERT failed");
+}
+
+/* ARGSUSED */
+static void
+kr_resync_timer(int fd, short event, void *arg)
+{
+	kr_resync_finish();
+}
+
+/* remove what the kernel has and ldpd doesn't want anymore */
+static void
+kr_resync_finish(void)
+{
+	struct kr_fib_entry	*fe;
+	struct kroute_prefix	*kp;
+	struct kroute_priority	*kprio;
+	struct kroute_node	*kn;
+	struct kroute		 kr;
+
+	if (!kr_resync.active)
+		return;
+	kr_resync.active = 0;
+	evtimer_del(&kr_resync.ev);
+
+	RB_FOREACH(fe, kr_fib_tree, &kr_resync.fib) {
+		if (fe->seen)
+			continue;
+
+		if (fe->family == AF_MPLS) {
+			/* LDP follows the IGP, leave BGP LSPs alone */
+			if (fe->kr.priority == RTP_BGP)
+				continue;
+			kr_send(RTM_DELETE, &fe->kr, AF_MPLS);
+			kr_resync.delete++;
+			continue;
+		}
+
+		/* only touch routes ldpd knows about */
+		kn = NULL;
+		kp = kroute_find_prefix(fe->kr.af, &fe->kr.prefix,
+		    fe->kr.prefixlen);
+		if (kp && (kprio = kroute_find_prio(kp,
+		    fe->kr.priority)) != NULL)
+			kn = kroute_find_gw(kprio, &fe->kr.nexthop);
+		if (kn == NULL)
+			continue;
+
+		kr = kn->r;
+		kr.remote_label = NO_LABEL;
+		kr_send(RTM_CHANGE, &kr, fe->family);
+		kr_resync.delete++;
+	}
+	kr_fib_index_clear();
+
+	kr_resync.resyncs++;
+	log_info("kernel FIB resync: %u added, %u changed, %u deleted, "
+	    "%u unchanged", kr_resync.add, kr_resync.change, kr_resync.delete,
+	    kr_resync.noop);
+}
+
+void
+kr_show_fib(pid_t pid)
+{
+	struct ctl_fib	 fctl;
+
+	memset(&fctl, 0, sizeof(fctl));
+	fctl.pending = kr_queue.pending;
+	fctl.pending_max = kr_queue.pending_max;
+	fctl.queued = kr_queue.queued;
+	fctl.written = kr_queue.written;
+	fctl.saved = kr_queue.saved;
+	fctl.errors = kr_queue.errors;
+	fctl.flushes = kr_queue.flushes;
+	if (kr_queue.written > 0)
+		fctl.latency_avg = kr_queue.latency_total / kr_queue.written;
+	fctl.latency_p50 = kr_latency_pct(50);
+	fctl.latency_p99 = kr_latency_pct(99);
+	fctl.latency_max = kr_queue.latency_max;
+	fctl.resyncs = kr_resync.resyncs;
+	fctl.resync_add = kr_resync.add;
+	fctl.resync_change = kr_resync.change;
+	fctl.resync_delete = kr_resync.delete;
+	fctl.resync_noop = kr_resync.noop;
+	fctl.rt_overflows = krt_sync.overflows;
+	fctl.rt_resyncs = krt_sync.resyncs;
+	fctl.rt_resync_msecs = krt_sync.msecs;
+	fctl.rt_resyncing = (krt_sync.state != KRT_SYNC_IDLE);
+	fctl.startup_table_msecs = kr_startup.table_msecs;
+	fctl.startup_first_label_msecs = kr_startup.first_label_msecs;
+	fctl.startup_full_lib_msecs = kr_startup.full_lib_msecs;
+	fctl.nh_count = kr_nhs.count;
+	fctl.nh_failures = kr_nhs.failures;
+	fctl.nh_elided = kr_nhs.elided;
+
+	main_imsg_compose_ldpe(IMSG_CTL_SHOW_FIB, pid, &fctl, sizeof(fctl));
+	main_imsg_compose_ldpe(IMSG_CTL_END, pid, NULL, 0);
+}
+
 static void
 kr_redist_remove(struct kroute *kr)
 {
@@ -512,7 +1310,7 @@ kr_redist_remove(struct kroute *kr)
 
 	/* remove redistributed flag */
 	kr->flags &= ~F_REDISTRIBUTED;
-	main_imsg_compose_lde(IMSG_NETWORK_DEL, 0, kr, sizeof(*kr));
+	kr_redist_queue(IMSG_NETWORK_DEL, kr);
 }
 
 static int
@@ -557,21 +1355,63 @@ kr_redist_eval(struct kroute *kr)
 
 	/* prefix should be redistributed */
 	kr->flags |= F_REDISTRIBUTED;
-	main_imsg_compose_lde(IMSG_NETWORK_ADD, 0, kr, sizeof(*kr));
+	kr_redist_queue(IMSG_NETWORK_ADD, kr);
+	if (kr_startup.loading)
+		kr_startup.redist++;
 	return (1);
 
 dont_redistribute:
 	return (0);
 }
 
-static void
-kr_redistribute(struct kroute_prefix *kp)
-{
-	struct kroute_priority	*kprio;
+/*
+ * Check the configured allocation policy of the address-family. Prefixes
+ * filtered here never reach the lde, so no label is allocated for them.
+ */
+static int
+kr_redist_policy(struct kroute_prefix *kp)
+{
+	struct ldpd_af_conf	*af_conf;
+	struct prefix_list	*plist;
+
+	af_conf = ldp_af_conf_get(ldpd_conf, kp->af);
+
+	if (af_conf->flags & F_LDPD_AF_HOST_ROUTES) {
+		switch (kp->af) {
+		case AF_INET:
+			if (kp->prefixlen != 32)
+				return (0);
+			break;
+		case AF_INET6:
+			if (kp->prefixlen != 128)
+				return (0);
+			break;
+		default:
+			return (0);
+		}
+	}
+
+	if (af_conf->alloc_plist[0] != '\0') {
+		plist = prefix_list_find(ldpd_conf, af_conf->alloc_plist);
+		if (plist == NULL || !prefix_list_match(plist, kp->af,
+		    &kp->prefix, kp->prefixlen))
+			return (0);
+	}
+
+	return (1);
+}
+
+static void
+kr_redistribute(struct kroute_prefix *kp)
+{
+	struct kroute_priority	*kprio;
 	struct kroute_node	*kn;
+	int			 allowed;
+
+	allowed = kr_redist_policy(kp);
 
 	TAILQ_FOREACH_REVERSE(kprio, &kp->priorities, plist, entry) {
-		if (kprio == TAILQ_FIRST(&kp->priorities)) {
+		if (allowed && kprio == TAILQ_FIRST(&kp->priorities)) {
 			TAILQ_FOREACH(kn, &kprio->nexthops, entry)
 				kr_redist_eval(&kn->r);
 		} else {
@@ -581,6 +1421,57 @@ kr_redistribute(struct kroute_prefix *kp)
 	}
 }
 
+/* re-evaluate the redistribution policy after a config reload */
+void
+kr_redist_update(void)
+{
+	struct kroute_prefix	*kp;
+
+	RB_FOREACH(kp, kroute_tree, &krt)
+		kr_redistribute(kp);
+	kr_redist_flush();
+}
+
+/*
+ * Consecutive routes of the same kind share an imsg. Callers that change
+ * krt flush the batch once they are done with a set of routing messages.
+ */
+static void
+kr_redist_queue(int type, struct kroute *kr)
+{
+	if (kr_redist_batch.count > 0 && kr_redist_batch.type != type)
+		kr_redist_flush();
+
+	kr_redist_batch.type = type;
+	kr_redist_batch.kr[kr_redist_batch.count] = *kr;
+	kr_redist_batch.kr[kr_redist_batch.count++].ts = kr_event_ts;
+	if (kr_redist_batch.count == KR_REDIST_BATCH)
+		kr_redist_flush();
+}
+
+static void
+kr_redist_flush(void)
+{
+	if (kr_redist_batch.count == 0)
+		return;
+
+	main_imsg_compose_lde(kr_redist_batch.type, 0, kr_redist_batch.kr,
+	    kr_redist_batch.count * sizeof(struct kroute));
+	kr_redist_batch.count = 0;
+}
+
+/* milliseconds since ldpd started to learn the kernel state */
+static uint32_t
+kr_startup_msecs(void)
+{
+	struct timespec	 now, diff;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	timespecsub(&now, &kr_startup.start, &diff);
+
+	return (diff.tv_sec * 1000 + diff.tv_nsec / 1000000);
+}
+
 /* rb-tree compare */
 static __inline int
 kroute_compare(struct kroute_prefix *a, struct kroute_prefix *b)
@@ -657,11 +1548,15 @@ kroute_insert(struct kroute *kr)
 		kp = calloc(1, sizeof((*kp)));
 		if (kp == NULL)
 			fatal(__func__);
+		mem_add(MEM_KROUTE_PREFIX, sizeof(*kp));
 		kp->af = kr->af;
 		kp->prefix = kr->prefix;
 		kp->prefixlen = kr->prefixlen;
 		TAILQ_INIT(&kp->priorities);
 		RB_INSERT(kroute_tree, &krt, kp);
+		kp->tn = ptrie_insert(kroute_trie_root(kp->af), kp->af,
+		    &kp->prefix, kp->prefixlen);
+		kp->tn->data = kp;
 	}
 
 	kprio = kroute_find_prio(kp, kr->priority);
@@ -669,6 +1564,7 @@ kroute_insert(struct kroute *kr)
 		kprio = calloc(1, sizeof(*kprio));
 		if (kprio == NULL)
 			fatal(__func__);
+		mem_add(MEM_KROUTE_PRIO, sizeof(*kprio));
 		kprio->kp = kp;
 		kprio->priority = kr->priority;
 		TAILQ_INIT(&kprio->nexthops);
@@ -688,10 +1584,12 @@ kroute_insert(struct kroute *kr)
 		kn = calloc(1, sizeof(*kn));
 		if (kn == NULL)
 			fatal(__func__);
+		mem_add(MEM_KROUTE_NODE, sizeof(*kn));
 		kn->kprio = kprio;
 		kn->r = *kr;
 		TAILQ_INSERT_TAIL(&kprio->nexthops, kn, entry);
 	}
+	kn->gen = krt_gen;
 
 	kr_redistribute(kp);
 	return (0);
@@ -702,7 +1600,7 @@ kroute_uninstall(struct kroute_node *kn)
 {
 	/* kill MPLS LSP if one was installed */
 	if (kn->r.flags & F_LDPD_INSERTED)
-		if (send_rtmsg(kr_state.fd, RTM_DELETE, &kn->r, AF_MPLS) ==
+		if (kr_send(RTM_DELETE, &kn->r, AF_MPLS) ==
 		    -1)
 			return (-1);
 
@@ -728,12 +1626,15 @@ kroute_remove(struct kroute *kr)
 
 	kr_redist_remove(&kn->r);
 	kroute_uninstall(kn);
+	kr_nh_unbind(kn);
 
 	TAILQ_REMOVE(&kprio->nexthops, kn, entry);
+	mem_del(MEM_KROUTE_NODE, sizeof(*kn));
 	free(kn);
 
 	if (TAILQ_EMPTY(&kprio->nexthops)) {
 		TAILQ_REMOVE(&kp->priorities, kprio, entry);
+		mem_del(MEM_KROUTE_PRIO, sizeof(*kprio));
 		free(kprio);
 	}
 
@@ -743,6 +1644,8 @@ kroute_remove(struct kroute *kr)
 			    log_addr(kr->af, &kr->prefix), kp->prefixlen);
 			return (-1);
 		}
+		ptrie_remove(kroute_trie_root(kp->af), kp->tn);
+		mem_del(MEM_KROUTE_PREFIX, sizeof(*kp));
 		free(kp);
 	} else
 		kr_redistribute(kp);
@@ -755,6 +1658,41 @@ notfound:
 	return (-1);
 }
 
+/*
+ * Remove the nexthops of a prefix that were not seen in the current
+ * generation. Returns 1 if the prefix itself is gone.
+ */
+static int
+kroute_sweep(struct kroute_prefix *kp)
+{
+	struct kroute_priority	*kprio;
+	struct kroute_node	*kn;
+	struct kroute		 kr;
+	int			 last;
+
+	for (;;) {
+		kn = NULL;
+		TAILQ_FOREACH(kprio, &kp->priorities, entry) {
+			TAILQ_FOREACH(kn, &kprio->nexthops, entry)
+				if (kn->gen != krt_gen)
+					break;
+			if (kn)
+				break;
+		}
+		if (kn == NULL)
+			return (0);
+
+		last = (TAILQ_NEXT(kn, entry) == NULL &&
+		    TAILQ_FIRST(&kprio->nexthops) == kn &&
+		    TAILQ_NEXT(kprio, entry) == NULL &&
+		    TAILQ_FIRST(&kp->priorities) == kprio);
+		kr = kn->r;
+		kroute_remove(&kr);
+		if (last)
+			return (1);
+	}
+}
+
 static void
 kroute_clear(void)
 {
@@ -767,15 +1705,21 @@ kroute_clear(void)
 			while ((kn = TAILQ_FIRST(&kprio->nexthops)) != NULL) {
 				kr_redist_remove(&kn->r);
 				kroute_uninstall(kn);
+				kr_nh_unbind(kn);
 				TAILQ_REMOVE(&kprio->nexthops, kn, entry);
+				mem_del(MEM_KROUTE_NODE, sizeof(*kn));
 				free(kn);
 			}
 			TAILQ_REMOVE(&kp->priorities, kprio, entry);
+			mem_del(MEM_KROUTE_PRIO, sizeof(*kprio));
 			free(kprio);
 		}
 		RB_REMOVE(kroute_tree, &krt, kp);
+		ptrie_remove(kroute_trie_root(kp->af), kp->tn);
+		mem_del(MEM_KROUTE_PREFIX, sizeof(*kp));
 		free(kp);
 	}
+	kr_redist_flush();
 }
 
 static __inline int
@@ -815,6 +1759,7 @@ kif_insert(unsigned short ifindex)
 
 	if ((kif = calloc(1, sizeof(struct kif_node))) == NULL)
 		return (NULL);
+	mem_add(MEM_KIF, sizeof(*kif));
 
 	kif->k.ifindex = ifindex;
 	TAILQ_INIT(&kif->addrs);
@@ -840,6 +1785,7 @@ kif_remove(struct kif_node *kif)
 		TAILQ_REMOVE(&kif->addrs, ka, entry);
 		free(ka);
 	}
+	mem_del(MEM_KIF, sizeof(*kif));
 	free(kif);
 	return (0);
 }
@@ -885,13 +1831,25 @@ kif_update(unsigned short ifindex, int flags, struct if_data *ifd,
 	return (kif);
 }
 
+/* lpm trie */
+static struct ptrie_node **
+kroute_trie_root(int af)
+{
+	switch (af) {
+	case AF_INET:
+		return (&krt_trie_v4);
+	case AF_INET6:
+		return (&krt_trie_v6);
+	default:
+		fatalx("kroute_trie_root: unknown af");
+	}
+}
+
 static struct kroute_priority *
 kroute_match(int af, union ldpd_addr *key)
 {
-	int			 i, maxprefixlen;
-	struct kroute_prefix	*kp;
-	struct kroute_priority	*kprio;
-	union ldpd_addr		 addr;
+	struct ptrie_node	*n;
+	int			 maxprefixlen;
 
 	switch (af) {
 	case AF_INET:
@@ -905,19 +1863,12 @@ kroute_match(int af, union ldpd_addr *key)
 		return (NULL);
 	}
 
-	for (i = maxprefixlen; i >= 0; i--) {
-		ldp_applymask(af, &addr, key, i);
-
-		kp = kroute_find_prefix(af, &addr, i);
-		if (kp == NULL)
-			continue;
-
-		kprio = kroute_find_prio(kp, RTP_ANY);
-		if (kprio != NULL)
-			return (kprio);
-	}
+	/* single descent of the trie */
+	n = ptrie_match(*kroute_trie_root(af), af, key, maxprefixlen);
+	if (n == NULL)
+		return (NULL);
 
-	return (NULL);
+	return (kroute_find_prio(n->data, RTP_ANY));
 }
 
 /* misc */
@@ -1151,14 +2102,433 @@ if_announce(void *msg)
 }
 
 /* rtsock */
+/* queue a route or an LSP to be programmed through the FIB backend */
 static int
-send_rtmsg(int fd, int action, struct kroute *kr, int family)
+kr_send(int action, struct kroute *kr, int family)
+{
+	struct kr_op		 s, *op;
+	struct timeval		 tv;
+
+	if (kr_state.fib_sync == 0)
+		return (0);
+
+	/*
+	 * Reserved labels (implicit and explicit NULL) should not be added
+	 * to the FIB.
+	 */
+	if (family == AF_MPLS && kr->local_label < MPLS_LABEL_RESERVED_MAX)
+		return (0);
+
+	s.family = family;
+	s.kr = *kr;
+	if (kr_resync.active && kr_resync_filter(&action, &s.kr, family) == 0)
+		return (0);
+
+	kr_queue.queued++;
+	op = RB_FIND(kr_op_tree, &kr_queue.ops, &s);
+	if (op == NULL) {
+		if ((op = calloc(1, sizeof(*op))) == NULL)
+			fatal(__func__);
+		mem_add(MEM_KR_OP, sizeof(*op));
+		op->action = action;
+		op->family = family;
+		op->kr = s.kr;
+		clock_gettime(CLOCK_MONOTONIC, &op->queued);
+		if (RB_INSERT(kr_op_tree, &kr_queue.ops, op) != NULL)
+			fatalx("kr_send: RB_INSERT failed");
+		TAILQ_INSERT_TAIL(&kr_queue.order, op, order);
+
+		if (kr_queue.pending > kr_queue.pending_max)
+			kr_queue.pending_max = kr_queue.pending;
+		if (kr_queue.pending++ == 0) {
+			timerclear(&tv);
+			if (evtimer_add(&kr_queue.ev, &tv) == -1)
+				fatal(__func__);
+		}
+		return (0);
+	}
+
+	/* the queued operation never reached the kernel */
+	kr_queue.saved++;
+	if (op->action == RTM_ADD && action == RTM_DELETE) {
+		/* and neither will the delete of what it would have added */
+		kr_op_del(op);
+		return (0);
+	}
+
+	/*
+	 * Anything other than a pair of adds or a final delete turns into a
+	 * change, which also covers an entry the kernel does not have yet.
+	 */
+	if (action != RTM_DELETE &&
+	    (op->action != RTM_ADD || action != RTM_ADD))
+		action = RTM_CHANGE;
+	op->action = action;
+	op->kr = s.kr;
+
+	return (0);
+}
+
+/*
+ * FIB entries are identified by the local label for LSPs and by the prefix,
+ * length and priority for labelled routes, plus the nexthop.
+ */
+static int
+kr_key_compare(int fa, struct kroute *a, int fb, struct kroute *b)
+{
+	int		 addrcmp;
+
+	if (fa < fb)
+		return (-1);
+	if (fa > fb)
+		return (1);
+
+	if (fa == AF_MPLS) {
+		if (a->local_label < b->local_label)
+			return (-1);
+		if (a->local_label > b->local_label)
+			return (1);
+	}
+
+	if (a->af < b->af)
+		return (-1);
+	if (a->af > b->af)
+		return (1);
+
+	if (fa != AF_MPLS) {
+		addrcmp = ldp_addrcmp(a->af, &a->prefix, &b->prefix);
+		if (addrcmp != 0)
+			return (addrcmp);
+		if (a->prefixlen < b->prefixlen)
+			return (-1);
+		if (a->prefixlen > b->prefixlen)
+			return (1);
+		if (a->priority < b->priority)
+			return (-1);
+		if (a->priority > b->priority)
+			return (1);
+	}
+
+	return (ldp_addrcmp(a->af, &a->nexthop, &b->nexthop));
+}
+
+static __inline int
+kr_op_compare(struct kr_op *a, struct kr_op *b)
+{
+	return (kr_key_compare(a->family, &a->kr, b->family, &b->kr));
+}
+
+static void
+kr_op_del(struct kr_op *op)
+{
+	RB_REMOVE(kr_op_tree, &kr_queue.ops, op);
+	TAILQ_REMOVE(&kr_queue.order, op, order);
+	kr_queue.pending--;
+	mem_del(MEM_KR_OP, sizeof(*op));
+	free(op);
+}
+
+/* the backend completes the write later, see kr_route_done() */
+static void
+kr_op_async(struct kr_op *op)
+{
+	RB_REMOVE(kr_op_tree, &kr_queue.ops, op);
+	TAILQ_REMOVE(&kr_queue.order, op, order);
+	kr_queue.pending--;
+	TAILQ_INSERT_TAIL(&kr_queue.inflight, op, order);
+}
+
+/* an asynchronous backend completed the oldest write in flight */
+void
+kr_route_done(int error)
+{
+	struct kr_op		*op;
+	struct timespec		 now;
+
+	if ((op = TAILQ_FIRST(&kr_queue.inflight)) == NULL)
+		fatalx("kr_route_done: no write in flight");
+	TAILQ_REMOVE(&kr_queue.inflight, op, order);
+
+	trace(TRACE_FIB_OP, op->action, op->kr.local_label, op->family,
+	    error == -1);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	kr_op_done(op, error, &now);
+	mem_del(MEM_KR_OP, sizeof(*op));
+	free(op);
+
+	if (kr_queue.pending == 0 && TAILQ_EMPTY(&kr_queue.inflight))
+		kr_nh_gc();
+}
+
+/* ARGSUSED */
+static void
+kr_flush_timer(int fd, short event, void *arg)
+{
+	kr_flush(0);
+}
+
+/*
+ * Write out the queued operations in the order their keys were first queued.
+ * Unless all of them are asked for, only a bounded batch is written so the
+ * parent keeps servicing its imsg pipes and the routing socket in between.
+ * The routing socket takes a single message per write, so the savings come
+ * from the operations that were superseded while queued.
+ */
+static void
+kr_flush(int all)
+{
+	struct kr_op		*op;
+	struct timespec		 start, now, diff;
+	struct timeval		 tv;
+	int			 n, error;
+
+	if (kr_queue.pending == 0)
+		return;
+
+	evtimer_del(&kr_queue.ev);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (n = 0; (op = TAILQ_FIRST(&kr_queue.order)) != NULL; n++) {
+		error = kr_state.be->send_route(op->action, &op->kr,
+		    op->family);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (error == KR_ASYNC)
+			kr_op_async(op);
+		else {
+			trace(TRACE_FIB_OP, op->action, op->kr.local_label,
+			    op->family, error == -1);
+			kr_op_done(op, error, &now);
+			kr_op_del(op);
+		}
+
+		if (all)
+			continue;
+		timespecsub(&now, &start, &diff);
+		if (n + 1 >= KR_FLUSH_MAX || diff.tv_sec > 0 ||
+		    diff.tv_nsec >= KR_FLUSH_BUDGET * 1000000)
+			break;
+	}
+	kr_queue.flushes++;
+
+	if (kr_queue.pending > 0) {
+		timerclear(&tv);
+		if (evtimer_add(&kr_queue.ev, &tv) == -1)
+			fatal(__func__);
+	} else if (TAILQ_EMPTY(&kr_queue.inflight))
+		kr_nh_gc();
+}
+
+/* account for a written operation and undo what a failed one promised */
+static void
+kr_op_done(struct kr_op *op, int error, struct timespec *now)
+{
+	struct kroute_prefix	*kp;
+	struct kroute_priority	*kprio;
+	struct kroute_node	*kn;
+	struct timespec		 diff;
+	uint32_t		 latency;
+	int			 i;
+
+	/* microseconds from the first queued change to the write */
+	timespecsub(now, &op->queued, &diff);
+	latency = diff.tv_sec * 1000000 + diff.tv_nsec / 1000;
+	for (i = 0; i < KR_LATENCY_BUCKETS - 1 && (latency >> i) > 1; i++)
+		;	/* nothing */
+	kr_queue.latency[i]++;
+	kr_queue.latency_total += latency;
+	if (latency > kr_queue.latency_max)
+		kr_queue.latency_max = latency;
+	kr_queue.written++;
+
+	if (error != -1) {
+		/* every mapping results in exactly one LSP write */
+		if (op->family == AF_MPLS)
+			stats_record(STATS_MAPPING_FIB, op->kr.ts);
+		return;
+	}
+	kr_queue.errors++;
+
+	/* the LSP isn't there, let a later change add it again */
+	if (op->family != AF_MPLS || op->action == RTM_DELETE)
+		return;
+	kp = kroute_find_prefix(op->kr.af, &op->kr.prefix, op->kr.prefixlen);
+	if (kp == NULL || (kprio = kroute_find_prio(kp,
+	    op->kr.priority)) == NULL)
+		return;
+	kn = kroute_find_gw(kprio, &op->kr.nexthop);
+	if (kn && kn->r.local_label == op->kr.local_label) {
+		kn->r.flags &= ~F_LDPD_INSERTED;
+		kr_nh_unbind(kn);
+		main_imsg_compose_lde(IMSG_KLABEL_FAILED, 0, &op->kr,
+		    sizeof(op->kr));
+	}
+}
+
+static __inline int
+kr_nh_compare(struct kr_nh *a, struct kr_nh *b)
+{
+	if (a->k.af < b->k.af)
+		return (-1);
+	if (a->k.af > b->k.af)
+		return (1);
+
+	return (ldp_addrcmp(a->k.af, &a->k.nexthop, &b->k.nexthop));
+}
+
+/* make the node reference the shared object of its nexthop */
+static void
+kr_nh_bind(struct kroute_node *kn)
 {
+	struct kr_nh		 s, *nh;
+
+	if (kn->nh)
+		return;
+
+	s.k.af = kn->r.af;
+	s.k.nexthop = kn->r.nexthop;
+	nh = RB_FIND(kr_nh_tree, &kr_nhs.tree, &s);
+	if (nh == NULL) {
+		if ((nh = calloc(1, sizeof(*nh))) == NULL)
+			fatal(__func__);
+		mem_add(MEM_KR_NH, sizeof(*nh));
+		TAILQ_INIT(&nh->nodes);
+		if (++kr_nhs.next_id == 0)
+			kr_nhs.next_id++;
+		nh->k.id = kr_nhs.next_id;
+		nh->k.af = kn->r.af;
+		nh->k.nexthop = kn->r.nexthop;
+		nh->k.ifindex = kn->r.ifindex;
+		if (RB_INSERT(kr_nh_tree, &kr_nhs.tree, nh) != NULL)
+			fatalx("kr_nh_bind: RB_INSERT failed");
+		kr_nhs.count++;
+		kr_nh_install(nh);
+	} else if (TAILQ_EMPTY(&nh->nodes))
+		TAILQ_REMOVE(&kr_nhs.unused, nh, unused);
+
+	TAILQ_INSERT_TAIL(&nh->nodes, kn, nh_entry);
+	kn->nh = nh;
+	kn->r.nhid = nh->k.id;
+}
+
+static void
+kr_nh_unbind(struct kroute_node *kn)
+{
+	struct kr_nh		*nh = kn->nh;
+
+	if (nh == NULL)
+		return;
+
+	TAILQ_REMOVE(&nh->nodes, kn, nh_entry);
+	kn->nh = NULL;
+	kn->r.nhid = 0;
+	if (TAILQ_EMPTY(&nh->nodes))
+		TAILQ_INSERT_TAIL(&kr_nhs.unused, nh, unused);
+}
+
+static void
+kr_nh_install(struct kr_nh *nh)
+{
+	if (kr_state.fib_sync == 0 || kr_state.be->nh_install == NULL)
+		return;
+
+	if (kr_state.be->nh_install(&nh->k) == -1)
+		log_warnx("%s: failed to install nexthop %u (%s)", __func__,
+		    nh->k.id, log_addr(nh->k.af, &nh->k.nexthop));
+}
+
+/* uninstall the objects unused once the queued writes are out */
+static void
+kr_nh_gc(void)
+{
+	struct kr_nh		*nh;
+
+	while ((nh = TAILQ_FIRST(&kr_nhs.unused)) != NULL) {
+		TAILQ_REMOVE(&kr_nhs.unused, nh, unused);
+		if (!(nh->k.flags & F_KNH_DOWN))
+			RB_REMOVE(kr_nh_tree, &kr_nhs.tree, nh);
+		if (kr_state.fib_sync && kr_state.be->nh_uninstall != NULL &&
+		    kr_state.be->nh_uninstall(&nh->k) == -1)
+			log_warnx("%s: failed to uninstall nexthop %u",
+			    __func__, nh->k.id);
+		kr_nhs.count--;
+		mem_del(MEM_KR_NH, sizeof(*nh));
+		free(nh);
+	}
+}
+
+/*
+ * The lde lost the neighbor owning this address. Everything labelled
+ * through it is withdrawn from krt right away, so that the per-FEC deletes
+ * that follow find nothing left to do. With nexthop objects this takes a
+ * single write; the routing socket has none, so there the LSPs and the
+ * labels are queued for removal one by one.
+ */
+void
+kr_nexthop_down(struct knexthop *knh)
+{
+	struct kr_nh		 s, *nh;
+	struct kroute_node	*kn;
+	int			 objects;
+
+	s.k.af = knh->af;
+	s.k.nexthop = knh->nexthop;
+	if ((nh = RB_FIND(kr_nh_tree, &kr_nhs.tree, &s)) == NULL)
+		return;
+
+	RB_REMOVE(kr_nh_tree, &kr_nhs.tree, nh);
+	nh->k.flags |= F_KNH_DOWN;
+	kr_nhs.failures++;
+	kr_nh_install(nh);
+
+	objects = kr_state.be->nh_install != NULL;
+	while ((kn = TAILQ_FIRST(&nh->nodes)) != NULL) {
+		if (!objects)
+			kr_send(RTM_DELETE, &kn->r, AF_MPLS);
+		else if (kr_state.fib_sync)
+			kr_nhs.elided += 2;
+		kn->r.flags &= ~F_LDPD_INSERTED;
+		kn->r.local_label = NO_LABEL;
+		kn->r.remote_label = NO_LABEL;
+		kr_nh_unbind(kn);
+		if (!objects)
+			kr_send(RTM_CHANGE, &kn->r, AF_INET);
+	}
+
+	/* with nothing left to write, the object can go now */
+	if (kr_queue.pending == 0 && TAILQ_EMPTY(&kr_queue.inflight))
+		kr_nh_gc();
+}
+
+/* upper bound in usecs of the given latency percentile */
+static uint32_t
+kr_latency_pct(int pct)
+{
+	uint64_t	 target, sum = 0;
+	int		 i;
+
+	if (kr_queue.written == 0)
+		return (0);
+
+	target = (kr_queue.written * pct + 99) / 100;
+	for (i = 0; i < KR_LATENCY_BUCKETS - 1; i++) {
+		sum += kr_queue.latency[i];
+		if (sum >= target)
+			break;
+	}
+
+	return (i >= 31 ? UINT32_MAX : (2U << i) - 1);
+}
+
+static int
+send_rtmsg(int action, struct kroute *kr, int family)
+{
+	if (kr_state.fd == -1)
+		fatalx("send_rtmsg: routing socket not open");
+
 	switch (kr->af) {
 	case AF_INET:
-		return (send_rtmsg_v4(fd, action, kr, family));
+		return (send_rtmsg_v4(kr_state.fd, action, kr, family));
 	case AF_INET6:
-		return (send_rtmsg_v6(fd, action, kr, family));
+		return (send_rtmsg_v6(kr_state.fd, action, kr, family));
 	default:
 		fatalx("send_rtmsg: unknown af");
 	}
@@ -1173,16 +2543,6 @@ send_rtmsg_v4(int fd, int action, struct kroute *kr, int family)
 	struct sockaddr_in	dst, mask, nexthop;
 	int			iovcnt = 0;
 
-	if (kr_state.fib_sync == 0)
-		return (0);
-
-	/*
-	 * Reserved labels (implicit and explicit NULL) should not be added
-	 * to the FIB.
-	 */
-	if (family == AF_MPLS && kr->local_label < MPLS_LABEL_RESERVED_MAX)
-		return (0);
-
 	/* initialize header */
 	memset(&hdr, 0, sizeof(hdr));
 	hdr.rtm_version = RTM_VERSION;
@@ -1304,23 +2664,81 @@ send_rtmsg_v6(int fd, int action, struct kroute *kr, int family)
 	return (0);
 }
 
+/* dump the kernel routing table, one address family or all of them */
+static char *
+rtsock_dump(int af, size_t *lenp)
+{
+	size_t			 len;
+	int			 mib[7];
+	char			*buf = NULL, *nbuf;
+
+	mib[0] = CTL_NET;
+	mib[1] = PF_ROUTE;
+	mib[2] = 0;
+	mib[3] = af;
+	mib[4] = NET_RT_DUMP;
+	mib[5] = 0;
+	mib[6] = 0;	/* rtableid */
+
+	for (;;) {
+		if (sysctl(mib, 7, NULL, &len, NULL, 0) == -1) {
+			log_warn("sysctl");
+			free(buf);
+			return (NULL);
+		}
+		/* leave room for routes added in the meantime */
+		len += len / 16;
+		if ((nbuf = realloc(buf, len)) == NULL) {
+			log_warn(__func__);
+			free(buf);
+			return (NULL);
+		}
+		buf = nbuf;
+		if (sysctl(mib, 7, buf, &len, NULL, 0) == -1) {
+			if (errno == ENOMEM)
+				continue;
+			log_warn("sysctl");
+			free(buf);
+			return (NULL);
+		}
+		break;
+	}
+
+	*lenp = len;
+	return (buf);
+}
+
+/*
+ * The routing table is loaded like a resync after an overflow, by
+ * krt_resync_step() a chunk per event loop iteration, so the parent keeps
+ * servicing its imsg pipes and the routing socket meanwhile. Redistributed
+ * routes reach the lde in batches, one per chunk at most.
+ */
 static int
 fetchtable(void)
+{
+	if (krt_dump_start() == -1)
+		return (-1);
+
+	return (KR_ASYNC);
+}
+
+static int
+fetchifs(void)
 {
 	size_t			 len;
-	int			 mib[7];
+	int			 mib[6];
 	char			*buf;
 	int			 rv;
 
 	mib[0] = CTL_NET;
 	mib[1] = PF_ROUTE;
 	mib[2] = 0;
-	mib[3] = 0;
-	mib[4] = NET_RT_DUMP;
+	mib[3] = 0;	/* wildcard */
+	mib[4] = NET_RT_IFLIST;
 	mib[5] = 0;
-	mib[6] = 0;	/* rtableid */
 
-	if (sysctl(mib, 7, NULL, &len, NULL, 0) == -1) {
+	if (sysctl(mib, 6, NULL, &len, NULL, 0) == -1) {
 		log_warn("sysctl");
 		return (-1);
 	}
@@ -1328,7 +2746,7 @@ fetchtable(void)
 		log_warn(__func__);
 		return (-1);
 	}
-	if (sysctl(mib, 7, buf, &len, NULL, 0) == -1) {
+	if (sysctl(mib, 6, buf, &len, NULL, 0) == -1) {
 		log_warn("sysctl");
 		free(buf);
 		return (-1);
@@ -1340,22 +2758,25 @@ fetchtable(void)
 	return (rv);
 }
 
+/* dump the labelled entries of the kernel FIB into the resync index */
 static int
-fetchifs(void)
+fetchlabels(void)
 {
-	size_t			 len;
-	int			 mib[6];
-	char			*buf;
-	int			 rv;
+	size_t			 len, offset;
+	int			 mib[7];
+	char			*buf, *next;
+	struct rt_msghdr	*rtm;
+	struct sockaddr		*sa, *rti_info[RTAX_MAX];
 
 	mib[0] = CTL_NET;
 	mib[1] = PF_ROUTE;
 	mib[2] = 0;
 	mib[3] = 0;	/* wildcard */
-	mib[4] = NET_RT_IFLIST;
-	mib[5] = 0;
+	mib[4] = NET_RT_FLAGS;
+	mib[5] = RTF_MPLS;
+	mib[6] = 0;	/* rtableid */
 
-	if (sysctl(mib, 6, NULL, &len, NULL, 0) == -1) {
+	if (sysctl(mib, 7, NULL, &len, NULL, 0) == -1) {
 		log_warn("sysctl");
 		return (-1);
 	}
@@ -1363,16 +2784,117 @@ fetchifs(void)
 		log_warn(__func__);
 		return (-1);
 	}
-	if (sysctl(mib, 6, buf, &len, NULL, 0) == -1) {
+	if (sysctl(mib, 7, buf, &len, NULL, 0) == -1) {
 		log_warn("sysctl");
 		free(buf);
 		return (-1);
 	}
 
-	rv = rtmsg_process(buf, len);
+	for (offset = 0; offset < len; offset += rtm->rtm_msglen) {
+		next = buf + offset;
+		rtm = (struct rt_msghdr *)next;
+		if (len < offset + sizeof(unsigned short) ||
+		    len < offset + rtm->rtm_msglen)
+			fatalx("fetchlabels: partial rtm in buffer");
+		if (rtm->rtm_version != RTM_VERSION ||
+		    rtm->rtm_type != RTM_GET || rtm->rtm_tableid != 0)
+			continue;
+
+		sa = (struct sockaddr *)(next + rtm->rtm_hdrlen);
+		get_rtaddrs(rtm->rtm_addrs, sa, rti_info);
+		rtmsg_process_label(rtm, rti_info);
+	}
 	free(buf);
 
-	return (rv);
+	return (0);
+}
+
+static int
+rtmsg_process_label(struct rt_msghdr *rtm, struct sockaddr *rti_info[RTAX_MAX])
+{
+	struct sockaddr		*sa;
+	struct sockaddr_in	*sa_in;
+	struct sockaddr_in6	*sa_in6;
+	struct kroute		 kr;
+	int			 family;
+
+	if ((sa = rti_info[RTAX_DST]) == NULL)
+		return (-1);
+
+	memset(&kr, 0, sizeof(kr));
+	kr.local_label = NO_LABEL;
+	kr.remote_label = NO_LABEL;
+	kr.priority = rtm->rtm_priority;
+	family = sa->sa_family;
+	switch (family) {
+	case AF_MPLS:
+		kr.local_label = ntohl(((struct sockaddr_mpls *)sa)->
+		    smpls_label) >> MPLS_LABEL_OFFSET;
+		break;
+	case AF_INET:
+		kr.prefix.v4 = ((struct sockaddr_in *)sa)->sin_addr;
+		sa_in = (struct sockaddr_in *)rti_info[RTAX_NETMASK];
+		if (sa_in != NULL && sa_in->sin_len != 0)
+			kr.prefixlen = mask2prefixlen(sa_in->sin_addr.s_addr);
+		else if (rtm->rtm_flags & RTF_HOST)
+			kr.prefixlen = 32;
+		else
+			return (0);
+		break;
+	case AF_INET6:
+		kr.prefix.v6 = ((struct sockaddr_in6 *)sa)->sin6_addr;
+		sa_in6 = (struct sockaddr_in6 *)rti_info[RTAX_NETMASK];
+		if (sa_in6 != NULL && sa_in6->sin6_len != 0)
+			kr.prefixlen = mask2prefixlen6(sa_in6);
+		else if (rtm->rtm_flags & RTF_HOST)
+			kr.prefixlen = 128;
+		else
+			return (0);
+		break;
+	default:
+		return (0);
+	}
+
+	/* entries without an IP nexthop (e.g. pseudowires) aren't ours */
+	if ((sa = rti_info[RTAX_GATEWAY]) == NULL)
+		return (0);
+	kr.af = sa->sa_family;
+	switch (kr.af) {
+	case AF_INET:
+		kr.nexthop.v4 = ((struct sockaddr_in *)sa)->sin_addr;
+		break;
+	case AF_INET6:
+		sa_in6 = (struct sockaddr_in6 *)sa;
+		recoverscope(sa_in6);
+		kr.nexthop.v6 = sa_in6->sin6_addr;
+		break;
+	default:
+		return (0);
+	}
+	if (family != AF_MPLS && family != kr.af)
+		return (0);
+
+	switch (rtm->rtm_mpls) {
+	case MPLS_OP_POP:
+		kr.remote_label = MPLS_LABEL_IMPLNULL;
+		break;
+	case MPLS_OP_SWAP:
+	case MPLS_OP_PUSH:
+		if ((sa = rti_info[RTAX_SRC]) == NULL ||
+		    sa->sa_family != AF_MPLS)
+			return (0);
+		kr.remote_label = ntohl(((struct sockaddr_mpls *)sa)->
+		    smpls_label) >> MPLS_LABEL_OFFSET;
+		break;
+	default:
+		/* labelled routes without a push are not interesting */
+		if (family != AF_MPLS && rtm->rtm_type == RTM_GET)
+			return (0);
+		break;
+	}
+
+	kr_fib_index_update(rtm->rtm_type, family, &kr);
+	return (0);
 }
 
 static int
@@ -1380,10 +2902,15 @@ dispatch_rtmsg(void)
 {
 	char			 buf[RT_BUF_SIZE];
 	ssize_t			 n;
+	int			 rv;
 
 	if ((n = read(kr_state.fd, &buf, sizeof(buf))) == -1) {
 		if (errno == EAGAIN || errno == EINTR)
 			return (0);
+		if (errno == ENOBUFS) {
+			krt_desync();
+			return (0);
+		}
 		log_warn("%s: read error", __func__);
 		return (-1);
 	}
@@ -1393,7 +2920,11 @@ dispatch_rtmsg(void)
 		return (-1);
 	}
 
-	return (rtmsg_process(buf, n));
+	kr_event_ts = stats_now();
+	rv = rtmsg_process(buf, n);
+	kr_event_ts = 0;
+
+	return (rv);
 }
 
 static int
@@ -1430,6 +2961,9 @@ rtmsg_process(char *buf, size_t len)
 			if (rtm->rtm_tableid != 0)
 				continue;
 
+			if (kr_resync.active && rtm->rtm_type != RTM_GET)
+				rtmsg_process_label(rtm, rti_info);
+
 			if (rtm->rtm_type == RTM_GET &&
 			    rtm->rtm_pid != kr_state.pid)
 				continue;
@@ -1442,8 +2976,10 @@ rtmsg_process(char *buf, size_t len)
 			if (rtm->rtm_priority == RTP_BGP)
 				continue;
 
-			if (rtmsg_process_route(rtm, rti_info) == -1)
+			if (rtmsg_process_route(rtm, rti_info) == -1) {
+				kr_redist_flush();
 				return (-1);
+			}
 		}
 
 		switch (rtm->rtm_type) {
@@ -1477,11 +3013,15 @@ rtmsg_process(char *buf, size_t len)
 		case RTM_IFANNOUNCE:
 			if_announce(next);
 			break;
+		case RTM_DESYNC:
+			krt_desync();
+			break;
 		default:
 			/* ignore for now */
 			break;
 		}
 	}
+	kr_redist_flush();
 
 	return (offset);
 }
@@ -1563,6 +3103,13 @@ rtmsg_process_route(struct rt_msghdr *rtm, struct sockaddr *rti_info[RTAX_MAX])
 		kr.flags |= F_CONNECTED;
 	kr.priority = rtm->rtm_priority;
 
+	if (krt_sync.state == KRT_SYNC_REPLAY) {
+		if (!krt_sync.replaying)
+			krt_touch(&kr);
+		else if (krt_replay_skip(&kr))
+			return (0);
+	}
+
 	if (rtm->rtm_type == RTM_CHANGE) {
 		/*
 		 * The kernel doesn't allow RTM_CHANGE for multipath routes.
@@ -1575,6 +3122,8 @@ rtmsg_process_route(struct rt_msghdr *rtm, struct sockaddr *rti_info[RTAX_MAX])
 			kprio = kroute_find_prio(kp, kr.priority);
 			if (kprio) {
 				kn = TAILQ_FIRST(&kprio->nexthops);
+				if (kn && krt_sync.state == KRT_SYNC_REPLAY)
+					krt_touch(&kn->r);
 				if (kn)
 					kroute_remove(&kn->r);
 			}
@@ -1602,8 +3151,13 @@ rtmsg_process_route(struct rt_msghdr *rtm, struct sockaddr *rti_info[RTAX_MAX])
 	}
 
 	if (kn != NULL) {
-		/* update route */
+		/* update route, keeping what ldpd put on top of it */
+		kr.local_label = kn->r.local_label;
+		kr.remote_label = kn->r.remote_label;
+		kr.flags |= kn->r.flags & (F_LDPD_INSERTED | F_REDISTRIBUTED);
+		kr.nhid = kn->r.nhid;
 		kn->r = kr;
+		kn->gen = krt_gen;
 		kr_redistribute(kp);
 	} else {
 		kr.local_label = NO_LABEL;
@@ -1630,7 +3184,7 @@ kmpw_set(struct kpw *kpw)
 		kif->kpw = malloc(sizeof(*kif->kpw));
 	*kif->kpw = *kpw;
 
-	return (kmpw_install(kif->k.ifname, kpw));
+	return (kr_state.be->pw_install(kif->k.ifname, kpw));
 }
 
 int
@@ -1652,7 +3206,7 @@ kmpw_unset(struct kpw *kpw)
 
 	free(kif->kpw);
 	kif->kpw = NULL;
-	return (kmpw_uninstall(kif->k.ifname));
+	return (kr_state.be->pw_uninstall(kif->k.ifname));
 }
 
 static int
@@ -1687,6 +3241,8 @@ kmpw_install(const char *ifname, struct kpw *kpw)
 	memset(&ifr, 0, sizeof(ifr));
 	strlcpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name));
 	ifr.ifr_data = (caddr_t) &imr;
+	if (kr_state.ioctl_fd == -1)
+		fatalx("kmpw_install: ioctl socket not open");
 	if (ioctl(kr_state.ioctl_fd, SIOCSETMPWCFG, &ifr)) {
 		log_warn("ioctl SIOCSETMPWCFG");
 		return (-1);
@@ -1705,6 +3261,8 @@ kmpw_uninstall(const char *ifname)
 	memset(&imr, 0, sizeof(imr));
 	strlcpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name));
 	ifr.ifr_data = (caddr_t) &imr;
+	if (kr_state.ioctl_fd == -1)
+		fatalx("kmpw_uninstall: ioctl socket not open");
 	if (ioctl(kr_state.ioctl_fd, SIOCSETMPWCFG, &ifr)) {
 		log_warn("ioctl SIOCSETMPWCFG");
 		return (-1);
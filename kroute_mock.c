@@ -0,0 +1,334 @@
+/*	$OpenBSD$ */
+
+/*
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * In-memory FIB backend. Nothing is pushed to the kernel; every operation
+ * is logged at debug level and optionally failed, so that the label
+ * programming pipeline can be exercised and timed without MPLS support in
+ * the kernel. With a latency configured, route writes are completed from
+ * a timer once it has elapsed, in the order they were issued, so the
+ * parent keeps running its event loop in the meantime.
+ *
+ * Shared nexthops are emulated the same way: installing or failing one is
+ * a single operation, whatever the number of entries behind it.
+ *
+ * The routing table can be preloaded with the FECs of the load generator
+ * (see loadgen/loadgen.c), spread evenly over the addresses of its peers.
+ */
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <net/route.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ldpd.h"
+#include "log.h"
+
+/* keep in sync with loadgen/loadgen.c */
+#define KR_MOCK_PEER_BASE	0x7f000101	/* 127.0.1.1 */
+#define KR_MOCK_FEC_BASE	0x0a000000	/* 10.0.0.0 */
+#define KR_MOCK_MAX_PEERS	1000
+#define KR_MOCK_MAX_FECS	(1 << 24)
+
+struct kr_mock_op {
+	TAILQ_ENTRY(kr_mock_op)	 entry;
+	struct timespec		 due;
+	int			 error;
+	int			 action;
+	int			 family;
+	struct kroute		 kr;
+};
+
+static int	kr_mock_config_routes(char *);
+static int	kr_mock_init(void);
+static int	kr_mock_fetchifs(void);
+static int	kr_mock_fetchtable(void);
+static int	kr_mock_send_route(int, struct kroute *, int);
+static int	kr_mock_pw_install(const char *, struct kpw *);
+static int	kr_mock_pw_uninstall(const char *);
+static int	kr_mock_nh_install(struct knexthop *);
+static int	kr_mock_nh_uninstall(struct knexthop *);
+static int	kr_mock_fail(void);
+static void	kr_mock_route_log(int, struct kroute *, int, int);
+static void	kr_mock_complete(int, short, void *);
+
+PROF_CALLBACK(kr_mock_complete)
+
+static struct kr_backend	 kr_mock_backend = {
+	"in-memory",
+	kr_mock_init,
+	kr_mock_fetchifs,
+	kr_mock_fetchtable,
+	NULL,
+	kr_mock_send_route,
+	kr_mock_pw_install,
+	kr_mock_pw_uninstall,
+	kr_mock_nh_install,
+	kr_mock_nh_uninstall
+};
+
+static struct {
+	TAILQ_HEAD(, kr_mock_op) ops;		/* writes in flight */
+	struct event		 ev;
+	unsigned int		 latency;	/* msecs */
+	unsigned int		 errors;	/* percent */
+	unsigned int		 fecs;		/* preloaded routes */
+	unsigned int		 peers;
+} kr_mock = {
+	TAILQ_HEAD_INITIALIZER(kr_mock.ops)
+};
+
+/* parse "latency[,errors[,fecs:peers]]" and switch to the in-memory backend */
+int
+kr_mock_config(const char *spec)
+{
+	char		*s, *p, *r;
+	const char	*errstr;
+
+	if ((s = strdup(spec)) == NULL)
+		fatal(__func__);
+
+	if ((p = strchr(s, ',')) != NULL) {
+		*p++ = '\0';
+		if ((r = strchr(p, ',')) != NULL) {
+			*r++ = '\0';
+			if (kr_mock_config_routes(r) == -1) {
+				free(s);
+				return (-1);
+			}
+		}
+		kr_mock.errors = strtonum(p, 0, 100, &errstr);
+		if (errstr) {
+			log_warnx("error rate is %s: %s", errstr, p);
+			free(s);
+			return (-1);
+		}
+	}
+	kr_mock.latency = strtonum(s, 0, INT_MAX / 1000, &errstr);
+	if (errstr) {
+		log_warnx("latency is %s: %s", errstr, s);
+		free(s);
+		return (-1);
+	}
+	free(s);
+
+	kr_set_backend(&kr_mock_backend);
+	return (0);
+}
+
+static int
+kr_mock_config_routes(char *s)
+{
+	char		*p;
+	const char	*errstr;
+
+	if ((p = strchr(s, ':')) == NULL) {
+		log_warnx("routes must be given as fecs:peers: %s", s);
+		return (-1);
+	}
+	*p++ = '\0';
+	kr_mock.fecs = strtonum(s, 1, KR_MOCK_MAX_FECS, &errstr);
+	if (errstr) {
+		log_warnx("number of fecs is %s: %s", errstr, s);
+		return (-1);
+	}
+	kr_mock.peers = strtonum(p, 1, KR_MOCK_MAX_PEERS, &errstr);
+	if (errstr) {
+		log_warnx("number of peers is %s: %s", errstr, p);
+		return (-1);
+	}
+
+	return (0);
+}
+
+static int
+kr_mock_init(void)
+{
+	evtimer_set(&kr_mock.ev, PROF(kr_mock_complete), NULL);
+	log_info("kernel FIB replaced by in-memory backend (latency %ums, "
+	    "errors %u%%, %u routes)", kr_mock.latency, kr_mock.errors,
+	    kr_mock.fecs);
+	return (0);
+}
+
+static int
+kr_mock_fetchifs(void)
+{
+	return (0);
+}
+
+static int
+kr_mock_fetchtable(void)
+{
+	struct kroute	 kr;
+	unsigned int	 i;
+
+	for (i = 0; i < kr_mock.fecs; i++) {
+		memset(&kr, 0, sizeof(kr));
+		kr.af = AF_INET;
+		kr.prefix.v4.s_addr = htonl(KR_MOCK_FEC_BASE + i);
+		kr.prefixlen = 32;
+		kr.nexthop.v4.s_addr = htonl(KR_MOCK_PEER_BASE +
+		    i % kr_mock.peers);
+		kr.priority = RTP_STATIC;
+		kr_table_add(&kr);
+	}
+
+	return (0);
+}
+
+/* decide whether the operation fails */
+static int
+kr_mock_fail(void)
+{
+	if (kr_mock.errors && arc4random_uniform(100) < kr_mock.errors) {
+		errno = EIO;
+		return (-1);
+	}
+
+	return (0);
+}
+
+static void
+kr_mock_route_log(int action, struct kroute *kr, int family, int error)
+{
+	if (error == -1) {
+		log_warnx("%s: action %d, af %s, prefix %s/%u failed",
+		    __func__, action, af_name(family),
+		    log_addr(kr->af, &kr->prefix), kr->prefixlen);
+		return;
+	}
+
+	log_debug("%s: action %d af %s prefix %s/%u nexthop %s labels %s/%s",
+	    __func__, action, af_name(family), log_addr(kr->af, &kr->prefix),
+	    kr->prefixlen, log_addr(kr->af, &kr->nexthop),
+	    log_label(kr->local_label), log_label(kr->remote_label));
+}
+
+static int
+kr_mock_send_route(int action, struct kroute *kr, int family)
+{
+	struct kr_mock_op	*op;
+	struct timespec		 ts;
+	struct timeval		 tv;
+	int			 error;
+
+	error = kr_mock_fail();
+	if (kr_mock.latency == 0) {
+		kr_mock_route_log(action, kr, family, error);
+		return (error);
+	}
+
+	if ((op = calloc(1, sizeof(*op))) == NULL)
+		fatal(__func__);
+	ts.tv_sec = kr_mock.latency / 1000;
+	ts.tv_nsec = (kr_mock.latency % 1000) * 1000000;
+	clock_gettime(CLOCK_MONOTONIC, &op->due);
+	timespecadd(&op->due, &ts, &op->due);
+	op->error = error;
+	op->action = action;
+	op->family = family;
+	op->kr = *kr;
+	TAILQ_INSERT_TAIL(&kr_mock.ops, op, entry);
+
+	if (!evtimer_pending(&kr_mock.ev, NULL)) {
+		TIMESPEC_TO_TIMEVAL(&tv, &ts);
+		if (evtimer_add(&kr_mock.ev, &tv) == -1)
+			fatal(__func__);
+	}
+
+	return (KR_ASYNC);
+}
+
+/* ARGSUSED */
+static void
+kr_mock_complete(int fd, short event, void *arg)
+{
+	struct kr_mock_op	*op;
+	struct timespec		 now, ts;
+	struct timeval		 tv;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	while ((op = TAILQ_FIRST(&kr_mock.ops)) != NULL) {
+		if (timespeccmp(&op->due, &now, >)) {
+			timespecsub(&op->due, &now, &ts);
+			TIMESPEC_TO_TIMEVAL(&tv, &ts);
+			if (evtimer_add(&kr_mock.ev, &tv) == -1)
+				fatal(__func__);
+			return;
+		}
+		TAILQ_REMOVE(&kr_mock.ops, op, entry);
+		kr_mock_route_log(op->action, &op->kr, op->family, op->error);
+		kr_route_done(op->error);
+		free(op);
+	}
+}
+
+static int
+kr_mock_pw_install(const char *ifname, struct kpw *kpw)
+{
+	if (kr_mock_fail() == -1) {
+		log_warn("%s: %s", __func__, ifname);
+		return (-1);
+	}
+
+	log_debug("%s: %s", __func__, ifname);
+	return (0);
+}
+
+static int
+kr_mock_pw_uninstall(const char *ifname)
+{
+	if (kr_mock_fail() == -1) {
+		log_warn("%s: %s", __func__, ifname);
+		return (-1);
+	}
+
+	log_debug("%s: %s", __func__, ifname);
+	return (0);
+}
+
+static int
+kr_mock_nh_install(struct knexthop *knh)
+{
+	if (kr_mock_fail() == -1) {
+		log_warn("%s: nexthop %u", __func__, knh->id);
+		return (-1);
+	}
+
+	log_debug("%s: nexthop %u %s %s", __func__, knh->id,
+	    log_addr(knh->af, &knh->nexthop),
+	    (knh->flags & F_KNH_DOWN) ? "down" : "up");
+	return (0);
+}
+
+static int
+kr_mock_nh_uninstall(struct knexthop *knh)
+{
+	if (kr_mock_fail() == -1) {
+		log_warn("%s: nexthop %u", __func__, knh->id);
+		return (-1);
+	}
+
+	log_debug("%s: nexthop %u", __func__, knh->id);
+	return (0);
+}
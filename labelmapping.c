@@ -29,20 +29,20 @@
 #include "ldpe.h"
 #include "log.h"
 
-static void	 enqueue_pdu(struct nbr *, struct ibuf *, uint16_t);
-static int	 gen_label_tlv(struct ibuf *, uint32_t);
+static void	 enqueue_pdu(struct nbr *, uint16_t, struct ibuf *, uint16_t,
+		    unsigned int);
 static int	 tlv_decode_label(struct nbr *, struct ldp_msg *, char *,
 		    uint16_t, uint32_t *);
-static int	 gen_reqid_tlv(struct ibuf *, uint32_t);
 
 static void
-enqueue_pdu(struct nbr *nbr, struct ibuf *buf, uint16_t size)
+enqueue_pdu(struct nbr *nbr, uint16_t type, struct ibuf *buf, uint16_t size,
+    unsigned int count)
 {
 	struct ldp_hdr		*ldp_hdr;
 
 	ldp_hdr = ibuf_seek(buf, 0, sizeof(struct ldp_hdr));
 	ldp_hdr->length = htons(size);
-	evbuf_enqueue(&nbr->tcp->wbuf, buf);
+	session_enqueue(nbr->tcp, buf, type, count);
 }
 
 /* Generic function that handles all Label Message types */
@@ -52,6 +52,7 @@ send_labelmessage(struct nbr *nbr, uint16_t type, struct mapping_head *mh)
 	struct ibuf		*buf = NULL;
 	struct mapping_entry	*me;
 	uint16_t		 msg_size, size = 0;
+	unsigned int		 count = 0;
 	int			 first = 1;
 	int			 err = 0;
 
@@ -102,7 +103,8 @@ send_labelmessage(struct nbr *nbr, uint16_t type, struct mapping_head *mh)
 
 		/* maximum pdu length exceeded, we need a new ldp pdu */
 		if (size + msg_size > nbr->max_pdu_len) {
-			enqueue_pdu(nbr, buf, size);
+			enqueue_pdu(nbr, type, buf, size, count);
+			count = 0;
 			first = 1;
 			continue;
 		}
@@ -130,12 +132,16 @@ send_labelmessage(struct nbr *nbr, uint16_t type, struct mapping_head *mh)
 		log_debug("msg-out: %s: lsr-id %s, fec %s, label %s",
 		    msg_name(type), inet_ntoa(nbr->id), log_map(&me->map),
 		    log_label(me->map.label));
+		if (type == MSG_TYPE_LABELMAPPING)
+			stats_record(STATS_ROUTE_MAPPING, me->map.ts);
+		count++;
 
 		TAILQ_REMOVE(mh, me, entry);
+		mem_del(MEM_MAPPING_ENTRY, sizeof(*me));
 		free(me);
 	}
 
-	enqueue_pdu(nbr, buf, size);
+	enqueue_pdu(nbr, type, buf, size, count);
 
 	nbr_fsm(nbr, NBR_EVT_PDU_SENT);
 }
@@ -153,7 +159,9 @@ recv_labelmessage(struct nbr *nbr, char *buf, uint16_t len, uint16_t type)
 	struct mapping_entry	*me;
 	struct mapping_head	 mh;
 	struct map		 map;
+	uint64_t		 ts;
 
+	ts = stats_now();
 	memcpy(&msg, buf, sizeof(msg));
 	buf += LDP_MSG_SIZE;
 	len -= LDP_MSG_SIZE;
@@ -182,6 +190,7 @@ recv_labelmessage(struct nbr *nbr, char *buf, uint16_t len, uint16_t type)
 	do {
 		memset(&map, 0, sizeof(map));
 		map.msg_id = msg.id;
+		map.ts = ts;
 
 		if ((tlen = tlv_decode_fec_elm(nbr, &msg, buf, feclen,
 		    &map)) == -1)
@@ -428,6 +437,7 @@ recv_labelmessage(struct nbr *nbr, char *buf, uint16_t len, uint16_t type)
 
 next:
 		TAILQ_REMOVE(&mh, me, entry);
+		mem_del(MEM_MAPPING_ENTRY, sizeof(*me));
 		free(me);
 	}
 
@@ -440,18 +450,6 @@ err:
 }
 
 /* Other TLV related functions */
-static int
-gen_label_tlv(struct ibuf *buf, uint32_t label)
-{
-	struct label_tlv	lt;
-
-	lt.type = htons(TLV_TYPE_GENERICLABEL);
-	lt.length = htons(LABEL_TLV_LEN);
-	lt.label = htonl(label);
-
-	return (ibuf_add(buf, &lt, sizeof(lt)));
-}
-
 static int
 tlv_decode_label(struct nbr *nbr, struct ldp_msg *msg, char *buf,
     uint16_t len, uint32_t *label)
@@ -499,112 +497,6 @@ tlv_decode_label(struct nbr *nbr, struct ldp_msg *msg, char *buf,
 	return (sizeof(lt));
 }
 
-static int
-gen_reqid_tlv(struct ibuf *buf, uint32_t reqid)
-{
-	struct reqid_tlv	rt;
-
-	rt.type = htons(TLV_TYPE_LABELREQUEST);
-	rt.length = htons(REQID_TLV_LEN);
-	rt.reqid = htonl(reqid);
-
-	return (ibuf_add(buf, &rt, sizeof(rt)));
-}
-
-int
-gen_pw_status_tlv(struct ibuf *buf, uint32_t status)
-{
-	struct pw_status_tlv	st;
-
-	st.type = htons(TLV_TYPE_PW_STATUS);
-	st.length = htons(PW_STATUS_TLV_LEN);
-	st.value = htonl(status);
-
-	return (ibuf_add(buf, &st, sizeof(st)));
-}
-
-int
-gen_fec_tlv(struct ibuf *buf, struct map *map)
-{
-	struct tlv	ft;
-	uint16_t	family, len, pw_type, ifmtu;
-	uint8_t		pw_len = 0;
-	uint32_t	group_id, pwid;
-	int		err = 0;
-
-	ft.type = htons(TLV_TYPE_FEC);
-
-	switch (map->type) {
-	case MAP_TYPE_WILDCARD:
-		ft.length = htons(sizeof(uint8_t));
-		err |= ibuf_add(buf, &ft, sizeof(ft));
-		err |= ibuf_add(buf, &map->type, sizeof(map->type));
-		break;
-	case MAP_TYPE_PREFIX:
-		len = PREFIX_SIZE(map->fec.prefix.prefixlen);
-		ft.length = htons(sizeof(map->type) + sizeof(family) +
-		    sizeof(map->fec.prefix.prefixlen) + len);
-		err |= ibuf_add(buf, &ft, sizeof(ft));
-		err |= ibuf_add(buf, &map->type, sizeof(map->type));
-		switch (map->fec.prefix.af) {
-		case AF_INET:
-			family = htons(AF_IPV4);
-			break;
-		case AF_INET6:
-			family = htons(AF_IPV6);
-			break;
-		default:
-			fatalx("gen_fec_tlv: unknown af");
-			break;
-		}
-		err |= ibuf_add(buf, &family, sizeof(family));
-		err |= ibuf_add(buf, &map->fec.prefix.prefixlen,
-		    sizeof(map->fec.prefix.prefixlen));
-		if (len)
-			err |= ibuf_add(buf, &map->fec.prefix.prefix, len);
-		break;
-	case MAP_TYPE_PWID:
-		if (map->flags & F_MAP_PW_ID)
-			pw_len += PW_STATUS_TLV_LEN;
-		if (map->flags & F_MAP_PW_IFMTU)
-			pw_len += FEC_SUBTLV_IFMTU_SIZE;
-
-		len = FEC_PWID_ELM_MIN_LEN + pw_len;
-
-		ft.length = htons(len);
-		err |= ibuf_add(buf, &ft, sizeof(ft));
-
-		err |= ibuf_add(buf, &map->type, sizeof(uint8_t));
-		pw_type = map->fec.pwid.type;
-		if (map->flags & F_MAP_PW_CWORD)
-			pw_type |= CONTROL_WORD_FLAG;
-		pw_type = htons(pw_type);
-		err |= ibuf_add(buf, &pw_type, sizeof(uint16_t));
-		err |= ibuf_add(buf, &pw_len, sizeof(uint8_t));
-		group_id = htonl(map->fec.pwid.group_id);
-		err |= ibuf_add(buf, &group_id, sizeof(uint32_t));
-		if (map->flags & F_MAP_PW_ID) {
-			pwid = htonl(map->fec.pwid.pwid);
-			err |= ibuf_add(buf, &pwid, sizeof(uint32_t));
-		}
-		if (map->flags & F_MAP_PW_IFMTU) {
-			struct subtlv 	stlv;
-
-			stlv.type = SUBTLV_IFMTU;
-			stlv.length = FEC_SUBTLV_IFMTU_SIZE;
-			err |= ibuf_add(buf, &stlv, sizeof(uint16_t));
-
-			ifmtu = htons(map->fec.pwid.ifmtu);
-			err |= ibuf_add(buf, &ifmtu, sizeof(uint16_t));
-		}
-		break;
-	default:
-		break;
-	}
-
-	return (err);
-}
-
 int
 tlv_decode_fec_elm(struct nbr *nbr, struct ldp_msg *msg, char *buf,
     uint16_t len, struct map *map)
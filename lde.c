@@ -41,21 +41,27 @@
 
 static void		 lde_sig_handler(int sig, short, void *);
 static __dead void	 lde_shutdown(void);
-static int		 lde_imsg_compose_parent(int, pid_t, void *, uint16_t);
 static void		 lde_dispatch_imsg(int, short, void *);
 static void		 lde_dispatch_parent(int, short, void *);
 static __inline		 int lde_nbr_compare(struct lde_nbr *,
 			    struct lde_nbr *);
-static struct lde_nbr	*lde_nbr_new(uint32_t, struct lde_nbr *);
-static void		 lde_nbr_del(struct lde_nbr *);
 static struct lde_nbr	*lde_nbr_find(uint32_t);
 static void		 lde_nbr_clear(void);
 static void		 lde_nbr_addr_update(struct lde_nbr *,
 			    struct lde_addr *, int);
 static void		 lde_map_free(void *);
-static int		 lde_address_add(struct lde_nbr *, struct lde_addr *);
+static void		 lde_req_free(void *);
+static void		 lde_wdraw_free(void *);
 static int		 lde_address_del(struct lde_nbr *, struct lde_addr *);
 static void		 lde_address_list_free(struct lde_nbr *);
+static void		 lde_send_nexthop_down(struct lde_addr *);
+static void		 lde_ctl_compose(int, pid_t, void *, uint16_t);
+static int		 lde_lib_req_check(struct ctl_lib_req *);
+
+PROF_CALLBACK(lde_sig_handler)
+PROF_CALLBACK(lde_dispatch_imsg)
+PROF_CALLBACK(lde_dispatch_parent)
+PROF_CALLBACK(lde_gc_timer)
 
 RB_GENERATE(nbr_tree, lde_nbr, entry, lde_nbr_compare)
 
@@ -65,6 +71,14 @@ struct nbr_tree		 lde_nbrs = RB_INITIALIZER(&lde_nbrs);
 static struct imsgev	*iev_ldpe;
 static struct imsgev	*iev_main;
 
+/* lde_nbrs indexed by peerid slot, see PEERID_MAKE() */
+static struct lde_nbr	**lde_nbr_slots;
+static uint32_t		 lde_nbr_nslots;
+
+/* origin of the mapping or route being processed, see stats.c */
+static uint64_t		 lde_mapping_ts;
+static uint64_t		 lde_route_ts;
+
 /* ARGSUSED */
 static void
 lde_sig_handler(int sig, short event, void *arg)
@@ -118,8 +132,8 @@ lde(int debug, int verbose)
 	event_init();
 
 	/* setup signal handler */
-	signal_set(&ev_sigint, SIGINT, lde_sig_handler, NULL);
-	signal_set(&ev_sigterm, SIGTERM, lde_sig_handler, NULL);
+	signal_set(&ev_sigint, SIGINT, PROF(lde_sig_handler), NULL);
+	signal_set(&ev_sigterm, SIGTERM, PROF(lde_sig_handler), NULL);
 	signal_add(&ev_sigint, NULL);
 	signal_add(&ev_sigterm, NULL);
 	signal(SIGPIPE, SIG_IGN);
@@ -129,14 +143,14 @@ lde(int debug, int verbose)
 	if ((iev_main = malloc(sizeof(struct imsgev))) == NULL)
 		fatal(NULL);
 	imsg_init(&iev_main->ibuf, 3);
-	iev_main->handler = lde_dispatch_parent;
+	iev_main->handler = PROF(lde_dispatch_parent);
 	iev_main->events = EV_READ;
 	event_set(&iev_main->ev, iev_main->ibuf.fd, iev_main->events,
 	    iev_main->handler, iev_main);
 	event_add(&iev_main->ev, NULL);
 
 	/* setup and start the LIB garbage collector */
-	evtimer_set(&gc_timer, lde_gc_timer, NULL);
+	evtimer_set(&gc_timer, PROF(lde_gc_timer), NULL);
 	lde_gc_start_timer();
 
 	gettimeofday(&now, NULL);
@@ -170,7 +184,7 @@ lde_shutdown(void)
 }
 
 /* imesg */
-static int
+int
 lde_imsg_compose_parent(int type, pid_t pid, void *data, uint16_t datalen)
 {
 	return (imsg_compose_event(iev_main, type, 0, pid, -1, data, datalen));
@@ -184,6 +198,49 @@ lde_imsg_compose_ldpe(int type, uint32_t peerid, pid_t pid, void *data,
 	     -1, data, datalen));
 }
 
+static void
+lde_ctl_compose(int type, pid_t pid, void *data, uint16_t datalen)
+{
+	lde_imsg_compose_ldpe(type, 0, pid, data, datalen);
+}
+
+/* the filter comes from the control socket, don't trust it */
+static int
+lde_lib_req_check(struct ctl_lib_req *req)
+{
+	if (req->flags & ~(F_CTL_LIB_SUBTREE | F_CTL_LIB_IN_USE |
+	    F_CTL_LIB_CURSOR))
+		return (-1);
+
+	switch (req->af) {
+	case AF_UNSPEC:
+		break;
+	case AF_INET:
+		if (req->prefixlen > 32)
+			return (-1);
+		break;
+	case AF_INET6:
+		if (req->prefixlen > 128)
+			return (-1);
+		break;
+	default:
+		return (-1);
+	}
+
+	/* only used as a search key, see rt_dump_start() */
+	if (req->flags & F_CTL_LIB_CURSOR) {
+		switch (req->cursor_af) {
+		case AF_INET:
+		case AF_INET6:
+			break;
+		default:
+			return (-1);
+		}
+	}
+
+	return (0);
+}
+
 /* ARGSUSED */
 static void
 lde_dispatch_imsg(int fd, short event, void *bula)
@@ -195,6 +252,8 @@ lde_dispatch_imsg(int fd, short event, void *bula)
 	struct map		 map;
 	struct lde_addr		 lde_addr;
 	struct notify_msg	 nm;
+	struct ctl_lib_req	 libreq;
+	struct ctl_prof_req	 profreq;
 	ssize_t			 n;
 	int			 shut = 0, verbose;
 
@@ -217,6 +276,9 @@ lde_dispatch_imsg(int fd, short event, void *bula)
 		if (n == 0)
 			break;
 
+		trace(TRACE_IMSG_IN, imsg.hdr.type, imsg.hdr.peerid,
+		    imsg.hdr.len - IMSG_HEADER_SIZE, 0);
+
 		switch (imsg.hdr.type) {
 		case IMSG_LABEL_MAPPING_FULL:
 			ln = lde_nbr_find(imsg.hdr.peerid);
@@ -246,7 +308,10 @@ lde_dispatch_imsg(int fd, short event, void *bula)
 
 			switch (imsg.hdr.type) {
 			case IMSG_LABEL_MAPPING:
+				stats_record(STATS_MAPPING_LDE, map.ts);
+				lde_mapping_ts = map.ts;
 				lde_check_mapping(&map, ln);
+				lde_mapping_ts = 0;
 				break;
 			case IMSG_LABEL_REQUEST:
 				lde_check_request(&map, ln);
@@ -335,11 +400,52 @@ lde_dispatch_imsg(int fd, short event, void *bula)
 		case IMSG_NEIGHBOR_DOWN:
 			lde_nbr_del(lde_nbr_find(imsg.hdr.peerid));
 			break;
+		case IMSG_CTL_SHOW_TRACE:
+			trace_ctl(imsg.hdr.pid, lde_ctl_compose);
+			break;
+		case IMSG_CTL_SHOW_STATS:
+			stats_ctl(imsg.hdr.pid, lde_ctl_compose);
+			break;
+		case IMSG_CTL_SHOW_PROF:
+			prof_ctl(imsg.hdr.pid, lde_ctl_compose);
+			break;
+		case IMSG_CTL_PROF:
+			if (imsg.hdr.len != IMSG_HEADER_SIZE + sizeof(profreq))
+				fatalx("invalid size of IMSG_CTL_PROF");
+			memcpy(&profreq, imsg.data, sizeof(profreq));
+			prof_cmd(profreq.cmd);
+			break;
+		case IMSG_CTL_SHOW_MEMORY:
+			mem_msgbuf(MEM_IMSG_WBUF, &iev_ldpe->ibuf.w);
+			mem_msgbuf(MEM_IMSG_WBUF, &iev_main->ibuf.w);
+			mem_ctl(imsg.hdr.pid, IMSG_CTL_END, lde_ctl_compose);
+			break;
 		case IMSG_CTL_SHOW_LIB:
-			rt_dump(imsg.hdr.pid);
+			/* an empty request dumps everything */
+			memset(&libreq, 0, sizeof(libreq));
+			libreq.af = AF_UNSPEC;
+			libreq.label = NO_LABEL;
+			if (imsg.hdr.len == IMSG_HEADER_SIZE + sizeof(libreq))
+				memcpy(&libreq, imsg.data, sizeof(libreq));
+			else if (imsg.hdr.len != IMSG_HEADER_SIZE) {
+				log_warnx("%s: wrong imsg len", __func__);
+				lde_imsg_compose_ldpe(IMSG_CTL_END, 0,
+				    imsg.hdr.pid, NULL, 0);
+				break;
+			}
+			if (lde_lib_req_check(&libreq) == -1) {
+				log_warnx("%s: invalid LIB filter", __func__);
+				lde_imsg_compose_ldpe(IMSG_CTL_END, 0,
+				    imsg.hdr.pid, NULL, 0);
+				break;
+			}
 
-			lde_imsg_compose_ldpe(IMSG_CTL_END, 0,
-			    imsg.hdr.pid, NULL, 0);
+			/* answered over several event loop iterations */
+			rt_dump(imsg.hdr.pid, &libreq,
+			    imsg.hdr.len != IMSG_HEADER_SIZE);
+			break;
+		case IMSG_CTL_CLIENT_GONE:
+			rt_dump_cancel(imsg.hdr.pid);
 			break;
 		case IMSG_CTL_SHOW_L2VPN_PW:
 			l2vpn_pw_ctl(imsg.hdr.pid);
@@ -390,6 +496,7 @@ lde_dispatch_parent(int fd, short event, void *bula)
 	struct imsgev		*iev = bula;
 	struct imsgbuf		*ibuf = &iev->ibuf;
 	ssize_t			 n;
+	size_t			 len, off;
 	int			 shut = 0;
 	struct fec		 fec;
 
@@ -412,40 +519,65 @@ lde_dispatch_parent(int fd, short event, void *bula)
 		if (n == 0)
 			break;
 
+		trace(TRACE_IMSG_IN, imsg.hdr.type, imsg.hdr.peerid,
+		    imsg.hdr.len - IMSG_HEADER_SIZE, 0);
+
 		switch (imsg.hdr.type) {
 		case IMSG_NETWORK_ADD:
 		case IMSG_NETWORK_DEL:
-			if (imsg.hdr.len != IMSG_HEADER_SIZE + sizeof(kr)) {
+			/* the parent batches routes */
+			len = imsg.hdr.len - IMSG_HEADER_SIZE;
+			if (len == 0 || len % sizeof(kr) != 0) {
 				log_warnx("%s: wrong imsg len", __func__);
 				break;
 			}
-			memcpy(&kr, imsg.data, sizeof(kr));
 
-			switch (kr.af) {
-			case AF_INET:
-				fec.type = FEC_TYPE_IPV4;
-				fec.u.ipv4.prefix = kr.prefix.v4;
-				fec.u.ipv4.prefixlen = kr.prefixlen;
-				break;
-			case AF_INET6:
-				fec.type = FEC_TYPE_IPV6;
-				fec.u.ipv6.prefix = kr.prefix.v6;
-				fec.u.ipv6.prefixlen = kr.prefixlen;
-				break;
-			default:
-				fatalx("lde_dispatch_parent: unknown af");
+			for (off = 0; off < len; off += sizeof(kr)) {
+				memcpy(&kr, (char *)imsg.data + off,
+				    sizeof(kr));
+
+				switch (kr.af) {
+				case AF_INET:
+					fec.type = FEC_TYPE_IPV4;
+					fec.u.ipv4.prefix = kr.prefix.v4;
+					fec.u.ipv4.prefixlen = kr.prefixlen;
+					break;
+				case AF_INET6:
+					fec.type = FEC_TYPE_IPV6;
+					fec.u.ipv6.prefix = kr.prefix.v6;
+					fec.u.ipv6.prefixlen = kr.prefixlen;
+					break;
+				default:
+					fatalx("lde_dispatch_parent: unknown "
+					    "af");
+				}
+
+				switch (imsg.hdr.type) {
+				case IMSG_NETWORK_ADD:
+					stats_record(STATS_ROUTE_LDE, kr.ts);
+					lde_route_ts = kr.ts;
+					lde_kernel_insert(&fec, kr.af,
+					    &kr.nexthop, kr.priority,
+					    kr.flags & F_CONNECTED, NULL);
+					lde_route_ts = 0;
+					break;
+				case IMSG_NETWORK_DEL:
+					lde_kernel_remove(&fec, kr.af,
+					    &kr.nexthop, kr.priority);
+					break;
+				}
 			}
-
-			switch (imsg.hdr.type) {
-			case IMSG_NETWORK_ADD:
-				lde_kernel_insert(&fec, kr.af, &kr.nexthop,
-				    kr.priority, kr.flags & F_CONNECTED, NULL);
-				break;
-			case IMSG_NETWORK_DEL:
-				lde_kernel_remove(&fec, kr.af, &kr.nexthop,
-				    kr.priority);
+			break;
+		case IMSG_KLABEL_FAILED:
+			if (imsg.hdr.len - IMSG_HEADER_SIZE != sizeof(kr)) {
+				log_warnx("%s: wrong imsg len", __func__);
 				break;
 			}
+			memcpy(&kr, imsg.data, sizeof(kr));
+			lde_kernel_failed(&kr);
+			break;
+		case IMSG_LIB_SNAPSHOT:
+			lib_snapshot(imsg.hdr.pid, imsg.fd);
 			break;
 		case IMSG_SOCKET_IPC:
 			if (iev_ldpe) {
@@ -462,7 +594,7 @@ lde_dispatch_parent(int fd, short event, void *bula)
 			if ((iev_ldpe = malloc(sizeof(struct imsgev))) == NULL)
 				fatal(NULL);
 			imsg_init(&iev_ldpe->ibuf, fd);
-			iev_ldpe->handler = lde_dispatch_imsg;
+			iev_ldpe->handler = PROF(lde_dispatch_imsg);
 			iev_ldpe->events = EV_READ;
 			event_set(&iev_ldpe->ev, iev_ldpe->ibuf.fd,
 			    iev_ldpe->events, iev_ldpe->handler, iev_ldpe);
@@ -478,6 +610,7 @@ lde_dispatch_parent(int fd, short event, void *bula)
 			LIST_INIT(&nconf->tnbr_list);
 			LIST_INIT(&nconf->nbrp_list);
 			LIST_INIT(&nconf->l2vpn_list);
+			LIST_INIT(&nconf->plist_list);
 			break;
 		case IMSG_RECONF_IFACE:
 			if ((niface = malloc(sizeof(struct iface))) == NULL)
@@ -579,6 +712,7 @@ lde_send_change_klabel(struct fec_node *fn, struct fec_nh *fnh)
 		kr.local_label = fn->local_label;
 		kr.remote_label = fnh->remote_label;
 		kr.priority = fnh->priority;
+		kr.ts = lde_mapping_ts;
 
 		lde_imsg_compose_parent(IMSG_KLABEL_CHANGE, 0, &kr,
 		    sizeof(kr));
@@ -596,6 +730,7 @@ lde_send_change_klabel(struct fec_node *fn, struct fec_nh *fnh)
 		kr.local_label = fn->local_label;
 		kr.remote_label = fnh->remote_label;
 		kr.priority = fnh->priority;
+		kr.ts = lde_mapping_ts;
 
 		lde_imsg_compose_parent(IMSG_KLABEL_CHANGE, 0, &kr,
 		    sizeof(kr));
@@ -627,6 +762,18 @@ lde_send_change_klabel(struct fec_node *fn, struct fec_nh *fnh)
 	}
 }
 
+static void
+lde_send_nexthop_down(struct lde_addr *lde_addr)
+{
+	struct knexthop	 knh;
+
+	memset(&knh, 0, sizeof(knh));
+	knh.af = lde_addr->af;
+	knh.nexthop = lde_addr->addr;
+
+	lde_imsg_compose_parent(IMSG_KNEXTHOP_DOWN, 0, &knh, sizeof(knh));
+}
+
 void
 lde_send_delete_klabel(struct fec_node *fn, struct fec_nh *fnh)
 {
@@ -792,6 +939,7 @@ lde_send_labelmapping(struct lde_nbr *ln, struct fec_node *fn, int single)
 		break;
 	}
 	map.label = fn->local_label;
+	map.ts = lde_route_ts;
 
 	/* SL.6: is there a pending request for this mapping? */
 	lre = (struct lde_req *)fec_find(&ln->recv_req, &fn->fec);
@@ -952,16 +1100,22 @@ lde_send_notification(uint32_t peerid, uint32_t status_code, uint32_t msg_id,
 static __inline int
 lde_nbr_compare(struct lde_nbr *a, struct lde_nbr *b)
 {
-	return (a->peerid - b->peerid);
+	if (a->peerid < b->peerid)
+		return (-1);
+	if (a->peerid > b->peerid)
+		return (1);
+	return (0);
 }
 
-static struct lde_nbr *
+struct lde_nbr *
 lde_nbr_new(uint32_t peerid, struct lde_nbr *new)
 {
-	struct lde_nbr	*ln;
+	struct lde_nbr	*ln, **slots;
+	uint32_t	 slot, nslots;
 
 	if ((ln = calloc(1, sizeof(*ln))) == NULL)
 		fatal(__func__);
+	mem_add(MEM_LDE_NBR, sizeof(*ln));
 
 	ln->id = new->id;
 	ln->v4_enabled = new->v4_enabled;
@@ -978,20 +1132,40 @@ lde_nbr_new(uint32_t peerid, struct lde_nbr *new)
 	if (RB_INSERT(nbr_tree, &lde_nbrs, ln) != NULL)
 		fatalx("lde_nbr_new: RB_INSERT failed");
 
+	slot = PEERID_SLOT(peerid);
+	if (slot >= lde_nbr_nslots) {
+		nslots = lde_nbr_nslots ? lde_nbr_nslots : 64;
+		while (nslots <= slot)
+			nslots *= 2;
+		slots = reallocarray(lde_nbr_slots, nslots, sizeof(*slots));
+		if (slots == NULL)
+			fatal(__func__);
+		memset(slots + lde_nbr_nslots, 0,
+		    (nslots - lde_nbr_nslots) * sizeof(*slots));
+		lde_nbr_slots = slots;
+		lde_nbr_nslots = nslots;
+	}
+	lde_nbr_slots[slot] = ln;
+
 	return (ln);
 }
 
-static void
+void
 lde_nbr_del(struct lde_nbr *ln)
 {
 	struct fec		*f;
 	struct fec_node		*fn;
 	struct fec_nh		*fnh;
 	struct l2vpn_pw		*pw;
+	struct lde_addr		*lde_addr;
 
 	if (ln == NULL)
 		return;
 
+	/* fail the shared nexthops first, the deletes below then come cheap */
+	TAILQ_FOREACH(lde_addr, &ln->addr_list, entry)
+		lde_send_nexthop_down(lde_addr);
+
 	/* uninstall received mappings */
 	RB_FOREACH(f, fec_tree, &ft) {
 		fn = (struct fec_node *)f;
@@ -1020,27 +1194,39 @@ lde_nbr_del(struct lde_nbr *ln)
 		}
 	}
 
+	lib_snapshot_touch_nbr(ln);
 	lde_address_list_free(ln);
 
 	fec_clear(&ln->recv_map, lde_map_free);
 	fec_clear(&ln->sent_map, lde_map_free);
-	fec_clear(&ln->recv_req, free);
-	fec_clear(&ln->sent_req, free);
-	fec_clear(&ln->sent_wdraw, free);
+	fec_clear(&ln->recv_req, lde_req_free);
+	fec_clear(&ln->sent_req, lde_req_free);
+	fec_clear(&ln->sent_wdraw, lde_wdraw_free);
 
 	RB_REMOVE(nbr_tree, &lde_nbrs, ln);
+	if (lde_nbr_slots[PEERID_SLOT(ln->peerid)] == ln)
+		lde_nbr_slots[PEERID_SLOT(ln->peerid)] = NULL;
 
+	mem_del(MEM_LDE_NBR, sizeof(*ln));
 	free(ln);
 }
 
 static struct lde_nbr *
 lde_nbr_find(uint32_t peerid)
 {
-	struct lde_nbr		 ln;
+	struct lde_nbr		*ln;
+	uint32_t		 slot;
+
+	slot = PEERID_SLOT(peerid);
+	if (slot >= lde_nbr_nslots)
+		return (NULL);
 
-	ln.peerid = peerid;
+	/* a stale peerid from a previous generation doesn't match */
+	ln = lde_nbr_slots[slot];
+	if (ln == NULL || ln->peerid != peerid)
+		return (NULL);
 
-	return (RB_FIND(nbr_tree, &lde_nbrs, &ln));
+	return (ln);
 }
 
 struct lde_nbr *
@@ -1125,6 +1311,7 @@ lde_map_add(struct lde_nbr *ln, struct fec_node *fn, int sent)
 	me = calloc(1, sizeof(*me));
 	if (me == NULL)
 		fatal(__func__);
+	mem_add(MEM_LDE_MAP, sizeof(*me));
 
 	me->fec = fn->fec;
 	me->nexthop = ln;
@@ -1150,8 +1337,10 @@ lde_map_del(struct lde_nbr *ln, struct lde_map *me, int sent)
 {
 	if (sent)
 		fec_remove(&ln->sent_map, &me->fec);
-	else
+	else {
+		lib_snapshot_touch(&me->fec);
 		fec_remove(&ln->recv_map, &me->fec);
+	}
 
 	lde_map_free(me);
 }
@@ -1162,6 +1351,7 @@ lde_map_free(void *ptr)
 	struct lde_map	*map = ptr;
 
 	LIST_REMOVE(map, entry);
+	mem_del(MEM_LDE_MAP, sizeof(*map));
 	free(map);
 }
 
@@ -1183,6 +1373,7 @@ lde_req_add(struct lde_nbr *ln, struct fec *fec, int sent)
 			free(lre);
 			return (NULL);
 		}
+		mem_add(MEM_LDE_REQ, sizeof(*lre));
 	}
 
 	return (lre);
@@ -1196,7 +1387,14 @@ lde_req_del(struct lde_nbr *ln, struct lde_req *lre, int sent)
 	else
 		fec_remove(&ln->recv_req, &lre->fec);
 
-	free(lre);
+	lde_req_free(lre);
+}
+
+static void
+lde_req_free(void *ptr)
+{
+	mem_del(MEM_LDE_REQ, sizeof(struct lde_req));
+	free(ptr);
 }
 
 struct lde_wdraw *
@@ -1207,6 +1405,7 @@ lde_wdraw_add(struct lde_nbr *ln, struct fec_node *fn)
 	lw = calloc(1, sizeof(*lw));
 	if (lw == NULL)
 		fatal(__func__);
+	mem_add(MEM_LDE_WDRAW, sizeof(*lw));
 
 	lw->fec = fn->fec;
 
@@ -1221,7 +1420,14 @@ void
 lde_wdraw_del(struct lde_nbr *ln, struct lde_wdraw *lw)
 {
 	fec_remove(&ln->sent_wdraw, &lw->fec);
-	free(lw);
+	lde_wdraw_free(lw);
+}
+
+static void
+lde_wdraw_free(void *ptr)
+{
+	mem_del(MEM_LDE_WDRAW, sizeof(struct lde_wdraw));
+	free(ptr);
 }
 
 void
@@ -1264,6 +1470,7 @@ lde_change_egress_label(int af, int was_implicit)
 				fatalx("lde_change_egress_label: unknown af");
 			}
 
+			lib_snapshot_touch(&fn->fec);
 			fn->local_label = egress_label(fn->fec.type);
 			lde_send_labelmapping(ln, fn, 0);
 		}
@@ -1273,7 +1480,7 @@ lde_change_egress_label(int af, int was_implicit)
 	}
 }
 
-static int
+int
 lde_address_add(struct lde_nbr *ln, struct lde_addr *lde_addr)
 {
 	struct lde_addr		*new;
@@ -1286,6 +1493,7 @@ lde_address_add(struct lde_nbr *ln, struct lde_addr *lde_addr)
 
 	new->af = lde_addr->af;
 	new->addr = lde_addr->addr;
+	lib_snapshot_touch_nbr(ln);
 	TAILQ_INSERT_TAIL(&ln->addr_list, new, entry);
 
 	/* reevaluate the previously received mappings from this neighbor */
@@ -1301,7 +1509,10 @@ lde_address_del(struct lde_nbr *ln, struct lde_addr *lde_addr)
 	if (lde_addr == NULL)
 		return (-1);
 
+	lib_snapshot_touch_nbr(ln);
+
 	/* reevaluate the previously received mappings from this neighbor */
+	lde_send_nexthop_down(lde_addr);
 	lde_nbr_addr_update(ln, lde_addr, 1);
 
 	TAILQ_REMOVE(&ln->addr_list, lde_addr, entry);
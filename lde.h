@@ -117,6 +117,7 @@ struct fec_node {
 };
 
 #define LDE_GC_INTERVAL 300
+#define LDE_FIB_RETRY_INTERVAL 5
 
 extern struct ldpd_conf	*ldeconf;
 extern struct fec_tree	 ft;
@@ -125,6 +126,7 @@ extern struct event	 gc_timer;
 
 /* lde.c */
 void		 lde(int, int);
+int		 lde_imsg_compose_parent(int, pid_t, void *, uint16_t);
 int		 lde_imsg_compose_ldpe(int, uint32_t, pid_t, void *, uint16_t);
 uint32_t	 lde_assign_label(void);
 void		 lde_send_change_klabel(struct fec_node *, struct fec_nh *);
@@ -139,6 +141,8 @@ void		 lde_send_labelwithdraw_all(struct fec_node *, uint32_t);
 void		 lde_send_labelrelease(struct lde_nbr *, struct fec_node *,
 		    uint32_t);
 void		 lde_send_notification(uint32_t, uint32_t, uint32_t, uint16_t);
+struct lde_nbr	*lde_nbr_new(uint32_t, struct lde_nbr *);
+void		 lde_nbr_del(struct lde_nbr *);
 struct lde_nbr	*lde_nbr_find_by_lsrid(struct in_addr);
 struct lde_nbr	*lde_nbr_find_by_addr(int, union ldpd_addr *);
 struct lde_map	*lde_map_add(struct lde_nbr *, struct fec_node *, int);
@@ -148,6 +152,7 @@ void		 lde_req_del(struct lde_nbr *, struct lde_req *, int);
 struct lde_wdraw *lde_wdraw_add(struct lde_nbr *, struct fec_node *);
 void		 lde_wdraw_del(struct lde_nbr *, struct lde_wdraw *);
 void		 lde_change_egress_label(int, int);
+int		 lde_address_add(struct lde_nbr *, struct lde_addr *);
 struct lde_addr	*lde_address_find(struct lde_nbr *, int,
 		    union ldpd_addr *);
 
@@ -157,7 +162,11 @@ struct fec	*fec_find(struct fec_tree *, struct fec *);
 int		 fec_insert(struct fec_tree *, struct fec *);
 int		 fec_remove(struct fec_tree *, struct fec *);
 void		 fec_clear(struct fec_tree *, void (*)(void *));
-void		 rt_dump(pid_t);
+void		 rt_dump(pid_t, struct ctl_lib_req *, int);
+void		 rt_dump_cancel(pid_t);
+void		 lib_snapshot(pid_t, int);
+void		 lib_snapshot_touch(struct fec *);
+void		 lib_snapshot_touch_nbr(struct lde_nbr *);
 void		 fec_snap(struct lde_nbr *);
 void		 fec_tree_clear(void);
 struct fec_nh	*fec_nh_find(struct fec_node *, int, union ldpd_addr *,
@@ -167,6 +176,7 @@ void		 lde_kernel_insert(struct fec *, int, union ldpd_addr *,
 		    uint8_t, int, void *);
 void		 lde_kernel_remove(struct fec *, int, union ldpd_addr *,
 		    uint8_t);
+void		 lde_kernel_failed(struct kroute *);
 void		 lde_check_mapping(struct map *, struct lde_nbr *);
 void		 lde_check_request(struct map *, struct lde_nbr *);
 void		 lde_check_release(struct map *, struct lde_nbr *);
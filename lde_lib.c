@@ -20,14 +20,38 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netmpls/mpls.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "ldpd.h"
 #include "lde.h"
 #include "log.h"
 
+#define RT_DUMP_CHUNK	1024	/* FECs visited per event loop iteration */
+#define RT_DUMP_PACK	((MAX_IMSGSIZE - IMSG_HEADER_SIZE) / \
+			    sizeof(struct ctl_rt))
+
+struct rt_dump {
+	TAILQ_ENTRY(rt_dump)	 entry;
+	pid_t			 pid;
+	struct ctl_lib_req	 req;		/* the cursor moves along */
+	uint32_t		 count;		/* entries sent in this page */
+	unsigned int		 pack;		/* entries per imsg */
+};
+
+/* a FEC as it was when the snapshot was requested */
+struct lib_snapshot_kept {
+	RB_ENTRY(lib_snapshot_kept)	 entry;
+	struct fec			 fec;
+	uint32_t			 n;	/* 0 if not in the snapshot */
+	struct lib_snapshot_rec		*recs;
+};
+RB_HEAD(lib_snapshot_kept_tree, lib_snapshot_kept);
+
 static __inline int	 fec_compare(struct fec *, struct fec *);
 static int		 lde_nbr_is_nexthop(struct fec_node *,
 			    struct lde_nbr *);
@@ -36,12 +60,73 @@ static struct fec_node	*fec_add(struct fec *fec);
 static struct fec_nh	*fec_nh_add(struct fec_node *, int, union ldpd_addr *,
 			    uint8_t priority);
 static void		 fec_nh_del(struct fec_nh *);
+static void		 lde_fib_retry(int, short, void *);
+static void		 rt_dump_schedule(void);
+static void		 rt_dump_run(int, short, void *);
+static struct fec	*rt_dump_start(struct ctl_lib_req *);
+static int		 rt_dump_range(struct ctl_lib_req *, struct fec *);
+static void		 rt_dump_fec(struct rt_dump *, struct fec_node *);
+static void		 rt_dump_add(struct rt_dump *, struct ctl_rt *);
+static void		 rt_dump_flush(struct rt_dump *);
+static int		 rt_dump_fec2prefix(struct fec *, int *,
+			    union ldpd_addr *, uint8_t *);
+static int		 rt_dump_req2key(struct fec *, int, union ldpd_addr *,
+			    uint8_t);
+static void		 rt_dump_key2req(struct ctl_lib_req *, struct fec *);
+static uint32_t		 lib_snapshot_fec(struct fec_node *,
+			    struct lib_snapshot_rec *);
+static int		 lib_snapshot_cmp(const void *, const void *);
+static int		 lib_snapshot_kept_cmp(struct lib_snapshot_kept *,
+			    struct lib_snapshot_kept *);
+static int		 lib_snapshot_grow(uint32_t, uint32_t);
+static void		 lib_snapshot_schedule(void);
+static void		 lib_snapshot_run(int, short, void *);
+static int		 lib_snapshot_write(void *, size_t);
+static void		 lib_snapshot_done(int);
+
+PROF_CALLBACK(lde_fib_retry)
+PROF_CALLBACK(rt_dump_run)
+PROF_CALLBACK(lib_snapshot_run)
 
 RB_GENERATE(fec_tree, fec, entry, fec_compare)
+RB_GENERATE_STATIC(lib_snapshot_kept_tree, lib_snapshot_kept, entry,
+    lib_snapshot_kept_cmp)
 
 struct fec_tree		 ft = RB_INITIALIZER(&ft);
 struct event		 gc_timer;
 
+/* LSPs the parent failed to write, sent again after a while */
+struct lde_fib_retry {
+	TAILQ_ENTRY(lde_fib_retry)	 entry;
+	struct kroute			 kr;
+};
+static TAILQ_HEAD(, lde_fib_retry) lde_fib_retries =
+				    TAILQ_HEAD_INITIALIZER(lde_fib_retries);
+static struct event		 lde_fib_retry_ev;
+
+static TAILQ_HEAD(, rt_dump)	 rt_dumps = TAILQ_HEAD_INITIALIZER(rt_dumps);
+static struct event		 rt_dump_ev;
+static struct ctl_rt		 rt_dump_buf[RT_DUMP_PACK];
+static unsigned int		 rt_dump_nbuf;
+
+#define LIB_SNAPSHOT_CHUNK	16384	/* records written per iteration */
+
+struct lib_snapshot {
+	pid_t			 pid;
+	int			 fd;
+	struct lib_snapshot_hdr	 hdr;
+	struct fec		 cursor;	/* last FEC written */
+	int			 started;
+	struct lib_snapshot_kept_tree kept;	/* changed, not written yet */
+	struct lib_snapshot_rec	*buf;
+	uint32_t		 size;		/* records buf has room for */
+	size_t			 len;		/* bytes written */
+	uint64_t		 start;
+};
+
+static struct lib_snapshot	*lib_snap;
+static struct event		 lib_snap_ev;
+
 /* FEC tree functions */
 void
 fec_init(struct fec_tree *fh)
@@ -151,53 +236,625 @@ lde_nbr_is_nexthop(struct fec_node *fn, struct lde_nbr *ln)
 	return (0);
 }
 
+/*
+ * LIB dumps are answered a chunk of FECs at a time, one request per event
+ * loop iteration, so that a large LIB doesn't hold up label processing.
+ * The position is kept as the key of the last FEC visited, which stays
+ * valid if FECs come and go between two iterations.
+ */
+void
+rt_dump(pid_t pid, struct ctl_lib_req *req, int packed)
+{
+	struct rt_dump	*d;
+
+	if ((d = calloc(1, sizeof(*d))) == NULL)
+		fatal(__func__);
+	d->pid = pid;
+	d->req = *req;
+	d->pack = packed ? RT_DUMP_PACK : 1;
+	if (d->req.af != AF_UNSPEC)
+		ldp_applymask(d->req.af, &d->req.prefix, &req->prefix,
+		    d->req.prefixlen);
+
+	if (TAILQ_EMPTY(&rt_dumps)) {
+		evtimer_set(&rt_dump_ev, PROF(rt_dump_run), NULL);
+		rt_dump_schedule();
+	}
+	TAILQ_INSERT_TAIL(&rt_dumps, d, entry);
+}
+
+/* the client went away, drop what is left of its dumps */
+void
+rt_dump_cancel(pid_t pid)
+{
+	struct rt_dump	*d, *safe;
+	int		 found = 0;
+
+	TAILQ_FOREACH_SAFE(d, &rt_dumps, entry, safe) {
+		if (d->pid != pid)
+			continue;
+		TAILQ_REMOVE(&rt_dumps, d, entry);
+		free(d);
+		found = 1;
+	}
+
+	if (found && TAILQ_EMPTY(&rt_dumps))
+		evtimer_del(&rt_dump_ev);
+}
+
+static void
+rt_dump_schedule(void)
+{
+	struct timeval	 tv;
+
+	timerclear(&tv);
+	if (evtimer_add(&rt_dump_ev, &tv) == -1)
+		fatal(__func__);
+}
+
+/* ARGSUSED */
+static void
+rt_dump_run(int fd, short event, void *arg)
+{
+	struct rt_dump	*d;
+	struct fec	*f;
+	int		 i, range;
+
+	if ((d = TAILQ_FIRST(&rt_dumps)) == NULL)
+		return;
+
+	f = rt_dump_start(&d->req);
+	for (i = 0; f != NULL && i < RT_DUMP_CHUNK;
+	    i++, f = RB_NEXT(fec_tree, &ft, f)) {
+		if (d->req.page_size && d->count >= d->req.page_size)
+			break;
+
+		range = rt_dump_range(&d->req, f);
+		if (range == -1) {
+			f = NULL;
+			break;
+		}
+		if (range == 1)
+			rt_dump_fec(d, (struct fec_node *)f);
+
+		rt_dump_key2req(&d->req, f);
+		d->req.flags |= F_CTL_LIB_CURSOR;
+	}
+	rt_dump_flush(d);
+
+	TAILQ_REMOVE(&rt_dumps, d, entry);
+	if (f == NULL || (d->req.page_size && d->count >= d->req.page_size)) {
+		if (f != NULL)
+			lde_imsg_compose_ldpe(IMSG_CTL_LIB_CURSOR, 0, d->pid,
+			    &d->req, sizeof(d->req));
+		lde_imsg_compose_ldpe(IMSG_CTL_END, 0, d->pid, NULL, 0);
+		free(d);
+	} else
+		/* let the other requests and the imsgs in */
+		TAILQ_INSERT_TAIL(&rt_dumps, d, entry);
+
+	if (!TAILQ_EMPTY(&rt_dumps))
+		rt_dump_schedule();
+}
+
+/* first FEC to visit, after the cursor if there is one */
+static struct fec *
+rt_dump_start(struct ctl_lib_req *req)
+{
+	struct fec	 key, *f;
+
+	if (req->flags & F_CTL_LIB_CURSOR) {
+		if (rt_dump_req2key(&key, req->cursor_af, &req->cursor_prefix,
+		    req->cursor_prefixlen) == -1)
+			return (NULL);
+		f = RB_NFIND(fec_tree, &ft, &key);
+		if (f && fec_compare(f, &key) == 0)
+			f = RB_NEXT(fec_tree, &ft, f);
+		return (f);
+	}
+
+	if (req->af == AF_UNSPEC)
+		return (RB_MIN(fec_tree, &ft));
+	if (rt_dump_req2key(&key, req->af, &req->prefix, req->prefixlen) == -1)
+		return (NULL);
+	return (RB_NFIND(fec_tree, &ft, &key));
+}
+
+/* 1 if the FEC matches the prefix filter, 0 if not, -1 past the last one */
+static int
+rt_dump_range(struct ctl_lib_req *req, struct fec *f)
+{
+	union ldpd_addr	 prefix;
+	int		 af, cmp;
+	uint8_t		 prefixlen;
+
+	/* pseudowires sort last */
+	if (rt_dump_fec2prefix(f, &af, &prefix, &prefixlen) == -1)
+		return (-1);
+	if (req->af == AF_UNSPEC)
+		return (1);
+	if (af != req->af)
+		return (-1);
+
+	if (!(req->flags & F_CTL_LIB_SUBTREE)) {
+		if (prefixlen == req->prefixlen &&
+		    ldp_addrcmp(af, &prefix, &req->prefix) == 0)
+			return (1);
+		return (-1);
+	}
+
+	if (prefixlen < req->prefixlen)
+		return (0);
+	ldp_applymask(af, &prefix, &prefix, req->prefixlen);
+	cmp = ldp_addrcmp(af, &prefix, &req->prefix);
+	if (cmp > 0)
+		return (-1);
+
+	return (cmp == 0);
+}
+
+static void
+rt_dump_fec(struct rt_dump *d, struct fec_node *fn)
+{
+	struct lde_map		*me;
+	struct ctl_rt		 rtctl;
+
+	if (fn->local_label == NO_LABEL &&
+	    LIST_EMPTY(&fn->downstream))
+		return;
+
+	memset(&rtctl, 0, sizeof(rtctl));
+	rt_dump_fec2prefix(&fn->fec, &rtctl.af, &rtctl.prefix,
+	    &rtctl.prefixlen);
+	rtctl.local_label = fn->local_label;
+
+	LIST_FOREACH(me, &fn->downstream, entry) {
+		rtctl.in_use = lde_nbr_is_nexthop(fn, me->nexthop);
+		rtctl.nexthop = me->nexthop->id;
+		rtctl.remote_label = me->map.label;
+		rt_dump_add(d, &rtctl);
+	}
+	if (LIST_EMPTY(&fn->downstream)) {
+		rtctl.in_use = 0;
+		rtctl.nexthop.s_addr = INADDR_ANY;
+		rtctl.remote_label = NO_LABEL;
+		rt_dump_add(d, &rtctl);
+	}
+}
+
+/* apply the remaining filters and pack the entry */
+static void
+rt_dump_add(struct rt_dump *d, struct ctl_rt *rtctl)
+{
+	struct ctl_lib_req	*req = &d->req;
+
+	if (req->nbr_id.s_addr != INADDR_ANY &&
+	    rtctl->nexthop.s_addr != req->nbr_id.s_addr)
+		return;
+	if ((req->flags & F_CTL_LIB_IN_USE) && !rtctl->in_use)
+		return;
+	if (req->label != NO_LABEL && rtctl->local_label != req->label &&
+	    rtctl->remote_label != req->label)
+		return;
+
+	rt_dump_buf[rt_dump_nbuf++] = *rtctl;
+	d->count++;
+	if (rt_dump_nbuf == d->pack)
+		rt_dump_flush(d);
+}
+
+static void
+rt_dump_flush(struct rt_dump *d)
+{
+	if (rt_dump_nbuf == 0)
+		return;
+
+	lde_imsg_compose_ldpe(IMSG_CTL_SHOW_LIB, 0, d->pid, rt_dump_buf,
+	    rt_dump_nbuf * sizeof(struct ctl_rt));
+	rt_dump_nbuf = 0;
+}
+
+static int
+rt_dump_fec2prefix(struct fec *f, int *af, union ldpd_addr *prefix,
+    uint8_t *prefixlen)
+{
+	memset(prefix, 0, sizeof(*prefix));
+	switch (f->type) {
+	case FEC_TYPE_IPV4:
+		*af = AF_INET;
+		prefix->v4 = f->u.ipv4.prefix;
+		*prefixlen = f->u.ipv4.prefixlen;
+		return (0);
+	case FEC_TYPE_IPV6:
+		*af = AF_INET6;
+		prefix->v6 = f->u.ipv6.prefix;
+		*prefixlen = f->u.ipv6.prefixlen;
+		return (0);
+	default:
+		return (-1);
+	}
+}
+
+static int
+rt_dump_req2key(struct fec *f, int af, union ldpd_addr *prefix,
+    uint8_t prefixlen)
+{
+	memset(f, 0, sizeof(*f));
+	switch (af) {
+	case AF_INET:
+		f->type = FEC_TYPE_IPV4;
+		f->u.ipv4.prefix = prefix->v4;
+		f->u.ipv4.prefixlen = prefixlen;
+		return (0);
+	case AF_INET6:
+		f->type = FEC_TYPE_IPV6;
+		f->u.ipv6.prefix = prefix->v6;
+		f->u.ipv6.prefixlen = prefixlen;
+		return (0);
+	default:
+		return (-1);
+	}
+}
+
+static void
+rt_dump_key2req(struct ctl_lib_req *req, struct fec *f)
+{
+	rt_dump_fec2prefix(f, &req->cursor_af, &req->cursor_prefix,
+	    &req->cursor_prefixlen);
+}
+
+/*
+ * LIB snapshots are built and written a range of FECs at a time, so that
+ * a large LIB is neither copied whole in memory nor holds up label
+ * processing. As with LIB dumps, the position is kept as the key of the
+ * last FEC written. The snapshot is still that of the LIB when it was
+ * requested: before a FEC not yet written changes, lib_snapshot_touch()
+ * keeps its records as they were, and those are written in its place.
+ * The header is written again with the final count once the last record
+ * is out.
+ */
+void
+lib_snapshot(pid_t pid, int fd)
+{
+	struct lib_snapshot	*s;
+	struct ctl_lib_snapshot	 sctl;
+	int			 error = 0;
+
+	if (fd == -1)
+		error = EBADF;
+	else if (lib_snap != NULL)
+		error = EBUSY;
+	else if ((s = calloc(1, sizeof(*s))) == NULL)
+		error = ENOMEM;
+	else if ((s->buf = calloc(LIB_SNAPSHOT_CHUNK,
+	    sizeof(*s->buf))) == NULL) {
+		free(s);
+		error = ENOMEM;
+	}
+	if (error) {
+		log_warnx("%s: %s", __func__, strerror(error));
+		if (fd != -1)
+			close(fd);
+		memset(&sctl, 0, sizeof(sctl));
+		sctl.error = error;
+		lde_imsg_compose_parent(IMSG_LIB_SNAPSHOT_DONE, pid, &sctl,
+		    sizeof(sctl));
+		return;
+	}
+
+	s->pid = pid;
+	s->fd = fd;
+	s->size = LIB_SNAPSHOT_CHUNK;
+	s->start = stats_now();
+	s->hdr.magic = LIB_SNAPSHOT_MAGIC;
+	s->hdr.version = LIB_SNAPSHOT_VERSION;
+	s->hdr.rec_size = sizeof(struct lib_snapshot_rec);
+	s->hdr.time = time(NULL);
+	RB_INIT(&s->kept);
+
+	lib_snap = s;
+	evtimer_set(&lib_snap_ev, PROF(lib_snapshot_run), NULL);
+	if ((error = lib_snapshot_write(&s->hdr, sizeof(s->hdr))) != 0) {
+		lib_snapshot_done(error);
+		return;
+	}
+
+	lib_snapshot_schedule();
+}
+
+/* fill in the records of a FEC, recs must have room for all of them */
+static uint32_t
+lib_snapshot_fec(struct fec_node *fn, struct lib_snapshot_rec *recs)
+{
+	struct lib_snapshot_rec	 rec;
+	struct lde_map		*me;
+	union ldpd_addr		 prefix;
+	int			 af;
+	uint8_t			 prefixlen;
+	uint32_t		 n = 0;
+
+	memset(&rec, 0, sizeof(rec));
+	rt_dump_fec2prefix(&fn->fec, &af, &prefix, &prefixlen);
+	rec.af = af;
+	rec.prefixlen = prefixlen;
+	rec.local_label = fn->local_label;
+	memcpy(rec.prefix, &prefix, sizeof(rec.prefix));
+
+	LIST_FOREACH(me, &fn->downstream, entry) {
+		rec.in_use = lde_nbr_is_nexthop(fn, me->nexthop);
+		rec.remote_label = me->map.label;
+		rec.nbr_id = me->nexthop->id;
+		recs[n++] = rec;
+	}
+	if (n == 0) {
+		rec.remote_label = NO_LABEL;
+		rec.nbr_id.s_addr = INADDR_ANY;
+		recs[n++] = rec;
+	}
+
+	/* the fec tree is already in order, only the neighbors are not */
+	qsort(recs, n, sizeof(*recs), lib_snapshot_cmp);
+
+	return (n);
+}
+
+static int
+lib_snapshot_cmp(const void *a, const void *b)
+{
+	const struct lib_snapshot_rec	*ra = a, *rb = b;
+
+	if (ntohl(ra->nbr_id.s_addr) < ntohl(rb->nbr_id.s_addr))
+		return (-1);
+	if (ntohl(ra->nbr_id.s_addr) > ntohl(rb->nbr_id.s_addr))
+		return (1);
+	return (0);
+}
+
+static int
+lib_snapshot_kept_cmp(struct lib_snapshot_kept *a, struct lib_snapshot_kept *b)
+{
+	return (fec_compare(&a->fec, &b->fec));
+}
+
+/*
+ * Called before anything a FEC's records are made of changes: its local
+ * label, its nexthops, the mappings received for it or the addresses of
+ * the neighbors that sent them. Keeps the records of a FEC the snapshot in
+ * progress has not reached yet, unless they were kept already.
+ */
+void
+lib_snapshot_touch(struct fec *fec)
+{
+	struct lib_snapshot	*s = lib_snap;
+	struct lib_snapshot_kept *k, key;
+	struct fec_node		*fn;
+	struct lde_map		*me;
+	uint32_t		 n = 0;
+
+	if (s == NULL || fec->type == FEC_TYPE_PWID)
+		return;
+	if (s->started && fec_compare(fec, &s->cursor) <= 0)
+		return;
+	key.fec = *fec;
+	if (RB_FIND(lib_snapshot_kept_tree, &s->kept, &key) != NULL)
+		return;
+
+	if ((k = calloc(1, sizeof(*k))) == NULL)
+		goto fail;
+	k->fec = *fec;
+
+	/* a FEC added after the request is kept as not there */
+	fn = (struct fec_node *)fec_find(&ft, fec);
+	if (fn != NULL && (fn->local_label != NO_LABEL ||
+	    !LIST_EMPTY(&fn->downstream))) {
+		LIST_FOREACH(me, &fn->downstream, entry)
+			n++;
+		if ((k->recs = calloc(n ? n : 1, sizeof(*k->recs))) == NULL) {
+			free(k);
+			goto fail;
+		}
+		k->n = lib_snapshot_fec(fn, k->recs);
+	}
+
+	RB_INSERT(lib_snapshot_kept_tree, &s->kept, k);
+	return;
+
+ fail:
+	log_warn("%s", __func__);
+	lib_snapshot_done(ENOMEM);
+}
+
+/* the records of all FECs a neighbor sent mappings for depend on it */
 void
-rt_dump(pid_t pid)
+lib_snapshot_touch_nbr(struct lde_nbr *ln)
+{
+	struct fec	*f;
+
+	if (lib_snap == NULL)
+		return;
+
+	RB_FOREACH(f, fec_tree, &ln->recv_map)
+		lib_snapshot_touch(f);
+}
+
+/* make room for n more records after the first nrecs, returns 0 or ENOMEM */
+static int
+lib_snapshot_grow(uint32_t nrecs, uint32_t n)
+{
+	struct lib_snapshot	*s = lib_snap;
+	struct lib_snapshot_rec	*recs;
+
+	if (nrecs + n <= s->size)
+		return (0);
+
+	recs = recallocarray(s->buf, s->size, nrecs + n, sizeof(*recs));
+	if (recs == NULL) {
+		log_warn("%s", __func__);
+		return (ENOMEM);
+	}
+	s->buf = recs;
+	s->size = nrecs + n;
+
+	return (0);
+}
+
+static void
+lib_snapshot_schedule(void)
 {
+	struct timeval	 tv;
+
+	timerclear(&tv);
+	if (evtimer_add(&lib_snap_ev, &tv) == -1)
+		fatal(__func__);
+}
+
+/*
+ * Merge the FECs of the tree after the cursor with the ones kept, which
+ * are written instead of their live version.
+ */
+/* ARGSUSED */
+static void
+lib_snapshot_run(int fd, short event, void *arg)
+{
+	struct lib_snapshot	*s = lib_snap;
+	struct lib_snapshot_kept *k;
 	struct fec		*f;
 	struct fec_node		*fn;
 	struct lde_map		*me;
-	static struct ctl_rt	 rtctl;
+	uint32_t		 n, nrecs = 0;
+	int			 i, error;
+
+	if (s->started) {
+		f = RB_NFIND(fec_tree, &ft, &s->cursor);
+		if (f && fec_compare(f, &s->cursor) == 0)
+			f = RB_NEXT(fec_tree, &ft, f);
+	} else
+		f = RB_MIN(fec_tree, &ft);
+
+	for (i = 0; i < RT_DUMP_CHUNK && nrecs < LIB_SNAPSHOT_CHUNK; i++) {
+		/* pseudowires sort last and are not part of the snapshot */
+		if (f && f->type == FEC_TYPE_PWID)
+			f = NULL;
+		k = RB_MIN(lib_snapshot_kept_tree, &s->kept);
+		if (f == NULL && k == NULL)
+			break;
+		s->started = 1;
+
+		if (k && (f == NULL || fec_compare(&k->fec, f) <= 0)) {
+			if (f && fec_compare(&k->fec, f) == 0)
+				f = RB_NEXT(fec_tree, &ft, f);
+			s->cursor = k->fec;
+			RB_REMOVE(lib_snapshot_kept_tree, &s->kept, k);
+			if ((error = lib_snapshot_grow(nrecs, k->n)) != 0) {
+				free(k->recs);
+				free(k);
+				lib_snapshot_done(error);
+				return;
+			}
+			if (k->n > 0)
+				memcpy(s->buf + nrecs, k->recs,
+				    k->n * sizeof(*k->recs));
+			nrecs += k->n;
+			free(k->recs);
+			free(k);
+			continue;
+		}
 
-	RB_FOREACH(f, fec_tree, &ft) {
 		fn = (struct fec_node *)f;
+		s->cursor = *f;
+		f = RB_NEXT(fec_tree, &ft, f);
 		if (fn->local_label == NO_LABEL &&
 		    LIST_EMPTY(&fn->downstream))
 			continue;
 
-		switch (fn->fec.type) {
-		case FEC_TYPE_IPV4:
-			rtctl.af = AF_INET;
-			rtctl.prefix.v4 = fn->fec.u.ipv4.prefix;
-			rtctl.prefixlen = fn->fec.u.ipv4.prefixlen;
-			break;
-		case FEC_TYPE_IPV6:
-			rtctl.af = AF_INET6;
-			rtctl.prefix.v6 = fn->fec.u.ipv6.prefix;
-			rtctl.prefixlen = fn->fec.u.ipv6.prefixlen;
-			break;
-		default:
-			continue;
+		n = 0;
+		LIST_FOREACH(me, &fn->downstream, entry)
+			n++;
+		if ((error = lib_snapshot_grow(nrecs, n ? n : 1)) != 0) {
+			lib_snapshot_done(error);
+			return;
 		}
+		nrecs += lib_snapshot_fec(fn, s->buf + nrecs);
+	}
 
-		rtctl.local_label = fn->local_label;
-		LIST_FOREACH(me, &fn->downstream, entry) {
-			rtctl.in_use = lde_nbr_is_nexthop(fn, me->nexthop);
-			rtctl.nexthop = me->nexthop->id;
-			rtctl.remote_label = me->map.label;
+	error = lib_snapshot_write(s->buf, nrecs * sizeof(*s->buf));
+	if (error) {
+		lib_snapshot_done(error);
+		return;
+	}
+	s->hdr.count += nrecs;
 
-			lde_imsg_compose_ldpe(IMSG_CTL_SHOW_LIB, 0, pid,
-			    &rtctl, sizeof(rtctl));
-		}
-		if (LIST_EMPTY(&fn->downstream)) {
-			rtctl.in_use = 0;
-			rtctl.nexthop.s_addr = INADDR_ANY;
-			rtctl.remote_label = NO_LABEL;
+	if ((f != NULL && f->type != FEC_TYPE_PWID) ||
+	    !RB_EMPTY(&s->kept)) {
+		lib_snapshot_schedule();
+		return;
+	}
+
+	/* now that the count is known */
+	if (pwrite(s->fd, &s->hdr, sizeof(s->hdr), 0) == -1) {
+		error = errno;
+		log_warn("%s: pwrite", __func__);
+		lib_snapshot_done(error);
+		return;
+	}
+	lib_snapshot_done(0);
+}
 
-			lde_imsg_compose_ldpe(IMSG_CTL_SHOW_LIB, 0, pid,
-			    &rtctl, sizeof(rtctl));
+/* returns 0 or an errno */
+static int
+lib_snapshot_write(void *buf, size_t len)
+{
+	struct lib_snapshot	*s = lib_snap;
+	char			*p = buf;
+	ssize_t			 n;
+	int			 error;
+
+	while (len > 0) {
+		if ((n = write(s->fd, p, len)) == -1) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			error = errno;
+			log_warn("%s: write", __func__);
+			return (error);
 		}
+		p += n;
+		len -= n;
+		s->len += n;
 	}
+
+	return (0);
+}
+
+/* the parent renames or removes the file once it hears from us */
+static void
+lib_snapshot_done(int error)
+{
+	struct lib_snapshot	*s = lib_snap;
+	struct lib_snapshot_kept *k;
+	struct ctl_lib_snapshot	 sctl;
+
+	evtimer_del(&lib_snap_ev);
+	if (error == 0 && fsync(s->fd) == -1)
+		error = errno;
+	if (close(s->fd) == -1 && error == 0)
+		error = errno;
+
+	memset(&sctl, 0, sizeof(sctl));
+	sctl.error = error;
+	sctl.count = s->hdr.count;
+	sctl.size = s->len;
+	sctl.msecs = (stats_now() - s->start) / 1000000;
+	lde_imsg_compose_parent(IMSG_LIB_SNAPSHOT_DONE, s->pid, &sctl,
+	    sizeof(sctl));
+
+	while ((k = RB_MIN(lib_snapshot_kept_tree, &s->kept)) != NULL) {
+		RB_REMOVE(lib_snapshot_kept_tree, &s->kept, k);
+		free(k->recs);
+		free(k);
+	}
+	free(s->buf);
+	free(s);
+	lib_snap = NULL;
 }
 
 void
@@ -232,6 +889,7 @@ fec_free(void *arg)
 		log_warnx("%s: fec %s upstream list not empty", __func__,
 		    log_fec(&fn->fec));
 
+	mem_del(MEM_FEC_NODE, sizeof(*fn));
 	free(fn);
 }
 
@@ -246,9 +904,12 @@ fec_add(struct fec *fec)
 {
 	struct fec_node	*fn;
 
+	lib_snapshot_touch(fec);
+
 	fn = calloc(1, sizeof(*fn));
 	if (fn == NULL)
 		fatal(__func__);
+	mem_add(MEM_FEC_NODE, sizeof(*fn));
 
 	fn->fec = *fec;
 	fn->local_label = NO_LABEL;
@@ -287,6 +948,7 @@ fec_nh_add(struct fec_node *fn, int af, union ldpd_addr *nexthop,
 	fnh = calloc(1, sizeof(*fnh));
 	if (fnh == NULL)
 		fatal(__func__);
+	mem_add(MEM_FEC_NH, sizeof(*fnh));
 
 	fnh->af = af;
 	fnh->nexthop = *nexthop;
@@ -301,6 +963,7 @@ static void
 fec_nh_del(struct fec_nh *fnh)
 {
 	LIST_REMOVE(fnh, entry);
+	mem_del(MEM_FEC_NH, sizeof(*fnh));
 	free(fnh);
 }
 
@@ -341,6 +1004,8 @@ lde_kernel_insert(struct fec *fec, int af, union ldpd_addr *nexthop,
 	log_debug("lde add fec %s nexthop %s",
 	    log_fec(&fn->fec), log_addr(af, nexthop));
 
+	lib_snapshot_touch(&fn->fec);
+
 	if (fn->fec.type == FEC_TYPE_PWID)
 		fn->data = data;
 
@@ -399,6 +1064,8 @@ lde_kernel_remove(struct fec *fec, int af, union ldpd_addr *nexthop,
 	log_debug("lde remove fec %s nexthop %s",
 	    log_fec(&fn->fec), log_addr(af, nexthop));
 
+	lib_snapshot_touch(&fn->fec);
+
 	lde_send_delete_klabel(fn, fnh);
 	fec_nh_del(fnh);
 	if (LIST_EMPTY(&fn->nexthops)) {
@@ -409,6 +1076,69 @@ lde_kernel_remove(struct fec *fec, int af, union ldpd_addr *nexthop,
 	}
 }
 
+void
+lde_kernel_failed(struct kroute *kr)
+{
+	struct lde_fib_retry	*r;
+	struct timeval		 tv;
+
+	log_debug("lde fib write failed for %s/%u nexthop %s, retrying",
+	    log_addr(kr->af, &kr->prefix), kr->prefixlen,
+	    log_addr(kr->af, &kr->nexthop));
+
+	if ((r = calloc(1, sizeof(*r))) == NULL)
+		fatal(__func__);
+	r->kr = *kr;
+
+	if (TAILQ_EMPTY(&lde_fib_retries)) {
+		evtimer_set(&lde_fib_retry_ev, PROF(lde_fib_retry), NULL);
+		timerclear(&tv);
+		tv.tv_sec = LDE_FIB_RETRY_INTERVAL;
+		if (evtimer_add(&lde_fib_retry_ev, &tv) == -1)
+			fatal(__func__);
+	}
+	TAILQ_INSERT_TAIL(&lde_fib_retries, r, entry);
+}
+
+/* ARGSUSED */
+static void
+lde_fib_retry(int fd, short event, void *arg)
+{
+	struct lde_fib_retry	*r;
+	struct fec		 fec;
+	struct fec_node		*fn;
+	struct fec_nh		*fnh;
+
+	while ((r = TAILQ_FIRST(&lde_fib_retries)) != NULL) {
+		TAILQ_REMOVE(&lde_fib_retries, r, entry);
+
+		memset(&fec, 0, sizeof(fec));
+		switch (r->kr.af) {
+		case AF_INET:
+			fec.type = FEC_TYPE_IPV4;
+			fec.u.ipv4.prefix = r->kr.prefix.v4;
+			fec.u.ipv4.prefixlen = r->kr.prefixlen;
+			break;
+		case AF_INET6:
+			fec.type = FEC_TYPE_IPV6;
+			fec.u.ipv6.prefix = r->kr.prefix.v6;
+			fec.u.ipv6.prefixlen = r->kr.prefixlen;
+			break;
+		default:
+			fatalx("lde_fib_retry: unknown af");
+		}
+
+		/* unless the LIB moved on since */
+		fn = (struct fec_node *)fec_find(&ft, &fec);
+		if (fn != NULL && fn->local_label == r->kr.local_label &&
+		    (fnh = fec_nh_find(fn, r->kr.af, &r->kr.nexthop,
+		    r->kr.priority)) != NULL &&
+		    fnh->remote_label == r->kr.remote_label)
+			lde_send_change_klabel(fn, fnh);
+		free(r);
+	}
+}
+
 void
 lde_check_mapping(struct map *map, struct lde_nbr *ln)
 {
@@ -499,6 +1229,7 @@ lde_check_mapping(struct map *map, struct lde_nbr *ln)
 		msgsource = 1;
 	}
 	/* LMp.13 & LMp.16: Record the mapping from this peer */
+	lib_snapshot_touch(&fn->fec);
 	if (me == NULL)
 		me = lde_map_add(ln, fn, 0);
 	me->map = *map;
@@ -745,6 +1476,7 @@ lde_gc_timer(int fd, short event, void *arg)
 	struct fec_node	*fn;
 	int		 count = 0;
 
+	trace(TRACE_TIMER, TRACE_TIMER_LDE_GC, 0, 0, 0);
 	RB_FOREACH_SAFE(fec, fec_tree, &ft, safe) {
 		fn = (struct fec_node *) fec;
 
@@ -754,6 +1486,7 @@ lde_gc_timer(int fd, short event, void *arg)
 			continue;
 
 		fec_remove(&ft, &fn->fec);
+		mem_del(MEM_FEC_NODE, sizeof(*fn));
 		free(fn);
 		count++;
 	}
@@ -23,6 +23,7 @@
 #include <sys/wait.h>
 #include <err.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <pwd.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -47,6 +48,11 @@ static int		 main_imsg_send_ipc_sockets(struct imsgbuf *,
 			    struct imsgbuf *);
 static void		 main_imsg_send_net_sockets(int);
 static void		 main_imsg_send_net_socket(int, enum socket_type);
+static void		 main_lib_snapshot(pid_t);
+static void		 main_lib_snapshot_done(pid_t,
+			    struct ctl_lib_snapshot *);
+static void		 main_lib_snapshot_reply(pid_t,
+			    struct ctl_lib_snapshot *);
 static int		 main_imsg_send_config(struct ldpd_conf *);
 static int		 ldp_reload(void);
 static void		 merge_global(struct ldpd_conf *, struct ldpd_conf *);
@@ -59,6 +65,12 @@ static void		 merge_nbrps(struct ldpd_conf *, struct ldpd_conf *);
 static void		 merge_l2vpns(struct ldpd_conf *, struct ldpd_conf *);
 static void		 merge_l2vpn(struct ldpd_conf *, struct l2vpn *,
 			    struct l2vpn *);
+static void		 merge_prefix_lists(struct ldpd_conf *,
+			    struct ldpd_conf *);
+
+PROF_CALLBACK(main_sig_handler)
+PROF_CALLBACK(main_dispatch_ldpe)
+PROF_CALLBACK(main_dispatch_lde)
 
 struct ldpd_global	 global;
 struct ldpd_conf	*ldpd_conf;
@@ -68,6 +80,7 @@ static struct imsgev	*iev_ldpe;
 static struct imsgev	*iev_lde;
 static pid_t		 ldpe_pid;
 static pid_t		 lde_pid;
+static int		 lib_snapshot_busy;
 
 /* ARGSUSED */
 static void
@@ -96,8 +109,8 @@ usage(void)
 {
 	extern char *__progname;
 
-	fprintf(stderr, "usage: %s [-dnv] [-D macro=value] [-f file]\n",
-	    __progname);
+	fprintf(stderr, "usage: %s [-dnv] [-D macro=value] [-f file] "
+	    "[-M latency[,errors[,fecs:peers]]]\n", __progname);
 	exit(1);
 }
 
@@ -121,7 +134,7 @@ main(int argc, char *argv[])
 	if (saved_argv0 == NULL)
 		saved_argv0 = "ldpd";
 
-	while ((ch = getopt(argc, argv, "dD:f:nvLE")) != -1) {
+	while ((ch = getopt(argc, argv, "dD:f:M:nvLE")) != -1) {
 		switch (ch) {
 		case 'd':
 			debug = 1;
@@ -134,6 +147,10 @@ main(int argc, char *argv[])
 		case 'f':
 			conffile = optarg;
 			break;
+		case 'M':
+			if (kr_mock_config(optarg) == -1)
+				usage();
+			break;
 		case 'n':
 			global.cmd_opts |= LDPD_OPT_NOACTION;
 			break;
@@ -214,9 +231,9 @@ main(int argc, char *argv[])
 	event_init();
 
 	/* setup signal handler */
-	signal_set(&ev_sigint, SIGINT, main_sig_handler, NULL);
-	signal_set(&ev_sigterm, SIGTERM, main_sig_handler, NULL);
-	signal_set(&ev_sighup, SIGHUP, main_sig_handler, NULL);
+	signal_set(&ev_sigint, SIGINT, PROF(main_sig_handler), NULL);
+	signal_set(&ev_sigterm, SIGTERM, PROF(main_sig_handler), NULL);
+	signal_set(&ev_sighup, SIGHUP, PROF(main_sig_handler), NULL);
 	signal_add(&ev_sigint, NULL);
 	signal_add(&ev_sigterm, NULL);
 	signal_add(&ev_sighup, NULL);
@@ -227,9 +244,9 @@ main(int argc, char *argv[])
 	    (iev_lde = malloc(sizeof(struct imsgev))) == NULL)
 		fatal(NULL);
 	imsg_init(&iev_ldpe->ibuf, pipe_parent2ldpe[0]);
-	iev_ldpe->handler = main_dispatch_ldpe;
+	iev_ldpe->handler = PROF(main_dispatch_ldpe);
 	imsg_init(&iev_lde->ibuf, pipe_parent2lde[0]);
-	iev_lde->handler = main_dispatch_lde;
+	iev_lde->handler = PROF(main_dispatch_lde);
 
 	/* setup event handler */
 	iev_ldpe->events = EV_READ;
@@ -350,6 +367,7 @@ main_dispatch_ldpe(int fd, short event, void *bula)
 	struct imsgev		*iev = bula;
 	struct imsgbuf		*ibuf = &iev->ibuf;
 	struct imsg		 imsg;
+	struct ctl_prof_req	 profreq;
 	int			 af;
 	ssize_t			 n;
 	int			 shut = 0, verbose;
@@ -374,6 +392,9 @@ main_dispatch_ldpe(int fd, short event, void *bula)
 		if (n == 0)
 			break;
 
+		trace(TRACE_IMSG_IN, imsg.hdr.type, imsg.hdr.peerid,
+		    imsg.hdr.len - IMSG_HEADER_SIZE, 0);
+
 		switch (imsg.hdr.type) {
 		case IMSG_REQUEST_SOCKETS:
 			af = imsg.hdr.pid;
@@ -395,6 +416,33 @@ main_dispatch_ldpe(int fd, short event, void *bula)
 		case IMSG_CTL_KROUTE_ADDR:
 			kr_show_route(&imsg);
 			break;
+		case IMSG_CTL_SHOW_FIB:
+			kr_show_fib(imsg.hdr.pid);
+			break;
+		case IMSG_CTL_SHOW_TRACE:
+			trace_ctl(imsg.hdr.pid, main_imsg_compose_ldpe);
+			break;
+		case IMSG_CTL_SHOW_STATS:
+			stats_ctl(imsg.hdr.pid, main_imsg_compose_ldpe);
+			break;
+		case IMSG_CTL_SHOW_PROF:
+			prof_ctl(imsg.hdr.pid, main_imsg_compose_ldpe);
+			break;
+		case IMSG_CTL_PROF:
+			if (imsg.hdr.len != IMSG_HEADER_SIZE + sizeof(profreq))
+				fatalx("invalid size of IMSG_CTL_PROF");
+			memcpy(&profreq, imsg.data, sizeof(profreq));
+			prof_cmd(profreq.cmd);
+			break;
+		case IMSG_CTL_SHOW_MEMORY:
+			mem_msgbuf(MEM_IMSG_WBUF, &iev_ldpe->ibuf.w);
+			mem_msgbuf(MEM_IMSG_WBUF, &iev_lde->ibuf.w);
+			mem_ctl(imsg.hdr.pid, IMSG_CTL_SHOW_MEMORY,
+			    main_imsg_compose_ldpe);
+			break;
+		case IMSG_CTL_LIB_SNAPSHOT:
+			main_lib_snapshot(imsg.hdr.pid);
+			break;
 		case IMSG_CTL_IFINFO:
 			if (imsg.hdr.len == IMSG_HEADER_SIZE)
 				kr_ifinfo(NULL, imsg.hdr.pid);
@@ -454,6 +502,9 @@ main_dispatch_lde(int fd, short event, void *bula)
 		if (n == 0)
 			break;
 
+		trace(TRACE_IMSG_IN, imsg.hdr.type, imsg.hdr.peerid,
+		    imsg.hdr.len - IMSG_HEADER_SIZE, 0);
+
 		switch (imsg.hdr.type) {
 		case IMSG_KLABEL_CHANGE:
 			if (imsg.hdr.len - IMSG_HEADER_SIZE !=
@@ -485,6 +536,19 @@ main_dispatch_lde(int fd, short event, void *bula)
 				log_warnx("%s: error unsetting pseudowire",
 				    __func__);
 			break;
+		case IMSG_KNEXTHOP_DOWN:
+			if (imsg.hdr.len - IMSG_HEADER_SIZE !=
+			    sizeof(struct knexthop))
+				fatalx("invalid size of IMSG_KNEXTHOP_DOWN");
+			kr_nexthop_down(imsg.data);
+			break;
+		case IMSG_LIB_SNAPSHOT_DONE:
+			if (imsg.hdr.len - IMSG_HEADER_SIZE !=
+			    sizeof(struct ctl_lib_snapshot))
+				fatalx("invalid size of "
+				    "IMSG_LIB_SNAPSHOT_DONE");
+			main_lib_snapshot_done(imsg.hdr.pid, imsg.data);
+			break;
 		default:
 			log_debug("%s: error handling imsg %d", __func__,
 			    imsg.hdr.type);
@@ -515,6 +579,63 @@ main_imsg_compose_lde(int type, pid_t pid, void *data, uint16_t datalen)
 	imsg_compose_event(iev_lde, type, 0, pid, -1, data, datalen);
 }
 
+/*
+ * The lde can't open files, so the snapshot is written through a descriptor
+ * of a temporary file which only replaces the previous snapshot if the lde
+ * managed to write all of it.
+ */
+static void
+main_lib_snapshot(pid_t pid)
+{
+	struct ctl_lib_snapshot	 sctl;
+	int			 fd;
+
+	memset(&sctl, 0, sizeof(sctl));
+	if (lib_snapshot_busy) {
+		sctl.error = EBUSY;
+		main_lib_snapshot_reply(pid, &sctl);
+		return;
+	}
+
+	if ((fd = open(LDPD_LIB_SNAPSHOT_TMP, O_WRONLY | O_CREAT | O_TRUNC,
+	    0644)) == -1) {
+		log_warn("%s: open %s", __func__, LDPD_LIB_SNAPSHOT_TMP);
+		sctl.error = errno;
+		main_lib_snapshot_reply(pid, &sctl);
+		return;
+	}
+
+	lib_snapshot_busy = 1;
+	imsg_compose_event(iev_lde, IMSG_LIB_SNAPSHOT, 0, pid, fd, NULL, 0);
+}
+
+static void
+main_lib_snapshot_done(pid_t pid, struct ctl_lib_snapshot *sctl)
+{
+	if (sctl->error == 0 &&
+	    rename(LDPD_LIB_SNAPSHOT_TMP, LDPD_LIB_SNAPSHOT) == -1) {
+		log_warn("%s: rename %s", __func__, LDPD_LIB_SNAPSHOT);
+		sctl->error = errno;
+	}
+
+	if (sctl->error == 0)
+		log_debug("%s: %u records written to %s in %u ms", __func__,
+		    sctl->count, LDPD_LIB_SNAPSHOT, sctl->msecs);
+	else
+		unlink(LDPD_LIB_SNAPSHOT_TMP);
+
+	lib_snapshot_busy = 0;
+	main_lib_snapshot_reply(pid, sctl);
+}
+
+static void
+main_lib_snapshot_reply(pid_t pid, struct ctl_lib_snapshot *sctl)
+{
+	main_imsg_compose_ldpe(IMSG_CTL_LIB_SNAPSHOT, pid, sctl,
+	    sizeof(*sctl));
+	main_imsg_compose_ldpe(IMSG_CTL_END, pid, NULL, 0);
+}
+
 static int
 main_imsg_compose_both(enum imsg_type type, void *buf, uint16_t len)
 {
@@ -543,6 +664,7 @@ imsg_compose_event(struct imsgev *iev, uint16_t type, uint32_t peerid,
 {
 	int	ret;
 
+	trace(TRACE_IMSG_OUT, type, peerid, datalen, 0);
 	if ((ret = imsg_compose(&iev->ibuf, type, peerid,
 	    pid, fd, data, datalen)) != -1)
 		imsg_event_add(iev);
@@ -725,6 +847,9 @@ ldp_reload(void)
 
 	merge_config(ldpd_conf, xconf);
 
+	/* the redistribution policy might have changed */
+	kr_redist_update();
+
 	return (0);
 }
 
@@ -738,6 +863,7 @@ merge_config(struct ldpd_conf *conf, struct ldpd_conf *xconf)
 	merge_tnbrs(conf, xconf);
 	merge_nbrps(conf, xconf);
 	merge_l2vpns(conf, xconf);
+	merge_prefix_lists(conf, xconf);
 	free(xconf);
 }
 
@@ -786,6 +912,8 @@ merge_af(int af, struct ldpd_af_conf *af_conf, struct ldpd_af_conf *xa)
 	}
 	af_conf->thello_holdtime = xa->thello_holdtime;
 	af_conf->thello_interval = xa->thello_interval;
+	strlcpy(af_conf->alloc_plist, xa->alloc_plist,
+	    sizeof(af_conf->alloc_plist));
 
 	/* update flags */
 	if (ldpd_process == PROC_LDP_ENGINE &&
@@ -1188,6 +1316,22 @@ merge_l2vpn(struct ldpd_conf *xconf, struct l2vpn *l2vpn, struct l2vpn *xl)
 	l2vpn->br_ifindex = xl->br_ifindex;
 }
 
+static void
+merge_prefix_lists(struct ldpd_conf *conf, struct ldpd_conf *xconf)
+{
+	struct prefix_list	*plist;
+
+	/* prefix-lists hold no state, replace them as a whole */
+	while ((plist = LIST_FIRST(&conf->plist_list)) != NULL) {
+		LIST_REMOVE(plist, entry);
+		prefix_list_del(plist);
+	}
+	while ((plist = LIST_FIRST(&xconf->plist_list)) != NULL) {
+		LIST_REMOVE(plist, entry);
+		LIST_INSERT_HEAD(&conf->plist_list, plist, entry);
+	}
+}
+
 struct ldpd_conf *
 config_new_empty(void)
 {
@@ -1201,6 +1345,7 @@ config_new_empty(void)
 	LIST_INIT(&xconf->tnbr_list);
 	LIST_INIT(&xconf->nbrp_list);
 	LIST_INIT(&xconf->l2vpn_list);
+	LIST_INIT(&xconf->plist_list);
 
 	return (xconf);
 }
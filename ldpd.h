@@ -35,6 +35,8 @@
 
 #define CONF_FILE		"/etc/ldpd.conf"
 #define	LDPD_SOCKET		"/var/run/ldpd.sock"
+#define	LDPD_LIB_SNAPSHOT	"/var/db/ldpd.lib"
+#define	LDPD_LIB_SNAPSHOT_TMP	"/var/db/ldpd.lib.tmp"
 #define LDPD_USER		"_ldpd"
 
 #define LDPD_OPT_VERBOSE	0x00000001
@@ -43,6 +45,7 @@
 
 #define TCP_MD5_KEY_LEN		80
 #define L2VPN_NAME_LEN		32
+#define PREFIX_LIST_NAME_LEN	32
 
 #define	RT_BUF_SIZE		16384
 #define	MAX_RTSOCK_BUF		128 * 1024
@@ -85,10 +88,26 @@ enum imsg_type {
 	IMSG_CTL_IFINFO,
 	IMSG_CTL_END,
 	IMSG_CTL_LOG_VERBOSE,
+	IMSG_CTL_SHOW_PENDING_CONN,
+	IMSG_CTL_SHOW_NBR_CONNQ,
+	IMSG_CTL_SHOW_ACCEPT,
+	IMSG_CTL_SHOW_FIB,
+	IMSG_CTL_SHOW_TRACE,
+	IMSG_CTL_SHOW_STATS,
+	IMSG_CTL_SHOW_MEMORY,
+	IMSG_CTL_LIB_CURSOR,
+	IMSG_CTL_LIB_SNAPSHOT,
+	IMSG_CTL_SHOW_PROF,
+	IMSG_CTL_PROF,
 	IMSG_KLABEL_CHANGE,
 	IMSG_KLABEL_DELETE,
 	IMSG_KPWLABEL_CHANGE,
 	IMSG_KPWLABEL_DELETE,
+	IMSG_KNEXTHOP_DOWN,
+	IMSG_KLABEL_FAILED,
+	IMSG_LIB_SNAPSHOT,
+	IMSG_LIB_SNAPSHOT_DONE,
+	IMSG_CTL_CLIENT_GONE,
 	IMSG_IFSTATUS,
 	IMSG_NEWADDR,
 	IMSG_DELADDR,
@@ -162,6 +181,17 @@ enum iface_type {
 #define	NBR_STA_SESSION		(NBR_STA_INITIAL | NBR_STA_OPENREC | \
 				NBR_STA_OPENSENT | NBR_STA_OPER)
 
+/*
+ * Neighbor peerids carry a slot index in the low bits and a generation
+ * number in the high bits. Slot 0 is never used so that a peerid of zero
+ * keeps meaning "no neighbor".
+ */
+#define	PEERID_SLOT_BITS	16
+#define	PEERID_SLOT_MAX		((1 << PEERID_SLOT_BITS) - 1)
+#define	PEERID_SLOT(p)		((p) & PEERID_SLOT_MAX)
+#define	PEERID_GEN(p)		((p) >> PEERID_SLOT_BITS)
+#define	PEERID_MAKE(g, s)	(((uint32_t)(g) << PEERID_SLOT_BITS) | (s))
+
 /* neighbor events */
 enum nbr_event {
 	NBR_EVT_NOTHING,
@@ -214,6 +244,7 @@ struct map {
 	uint32_t	requestid;
 	uint32_t	pw_status;
 	uint8_t		flags;
+	uint64_t	ts;	/* originating event, see stats.c */
 };
 #define F_MAP_REQ_ID	0x01	/* optional request message id present */
 #define F_MAP_STATUS	0x02	/* status */
@@ -350,6 +381,32 @@ struct l2vpn {
 #define L2VPN_TYPE_VPWS		1
 #define L2VPN_TYPE_VPLS		2
 
+/* path-compressed prefix trie, see ptrie.c */
+struct ptrie_node {
+	struct ptrie_node	*parent;
+	struct ptrie_node	*child[2];
+	union ldpd_addr		 prefix;
+	uint8_t			 prefixlen;
+	void			*data;		/* NULL in glue nodes */
+};
+
+struct prefix_list_entry {
+	TAILQ_ENTRY(prefix_list_entry) entry;
+	int			 af;
+	union ldpd_addr		 prefix;
+	uint8_t			 prefixlen;
+	int			 flags;
+};
+#define F_PLIST_OR_LONGER	0x01	/* match more specific prefixes too */
+
+struct prefix_list {
+	LIST_ENTRY(prefix_list)	 entry;
+	char			 name[PREFIX_LIST_NAME_LEN];
+	TAILQ_HEAD(, prefix_list_entry) entries;
+	struct ptrie_node	*root_v4;
+	struct ptrie_node	*root_v6;
+};
+
 /* ldp_conf */
 enum ldpd_process {
 	PROC_MAIN,
@@ -373,12 +430,14 @@ struct ldpd_af_conf {
 	uint16_t		 thello_holdtime;
 	uint16_t		 thello_interval;
 	union ldpd_addr		 trans_addr;
+	char			 alloc_plist[PREFIX_LIST_NAME_LEN];
 	int			 flags;
 };
 #define	F_LDPD_AF_ENABLED	0x0001
 #define	F_LDPD_AF_THELLO_ACCEPT	0x0002
 #define	F_LDPD_AF_EXPNULL	0x0004
 #define	F_LDPD_AF_NO_GTSM	0x0008
+#define	F_LDPD_AF_HOST_ROUTES	0x0010
 
 struct ldpd_conf {
 	struct in_addr		 rtr_id;
@@ -388,6 +447,7 @@ struct ldpd_conf {
 	LIST_HEAD(, tnbr)	 tnbr_list;
 	LIST_HEAD(, nbr_params)	 nbrp_list;
 	LIST_HEAD(, l2vpn)	 l2vpn_list;
+	LIST_HEAD(, prefix_list) plist_list;
 	uint16_t		 trans_pref;
 	int			 flags;
 };
@@ -413,7 +473,7 @@ struct ldpd_global {
 	LIST_HEAD(, adj)	 adj_list;
 	struct in_addr		 mcast_addr_v4;
 	struct in6_addr		 mcast_addr_v6;
-	TAILQ_HEAD(, pending_conn) pending_conns;
+	RB_HEAD(pending_conn_head, pending_conn) pending_conns;
 };
 
 /* kroute */
@@ -427,7 +487,18 @@ struct kroute {
 	unsigned short		 ifindex;
 	uint8_t			 priority;
 	uint16_t		 flags;
+	uint32_t		 nhid;		/* shared nexthop, 0 if none */
+	uint64_t		 ts;		/* originating event, see stats.c */
+};
+
+struct knexthop {
+	uint32_t		 id;
+	int			 af;
+	union ldpd_addr		 nexthop;
+	unsigned short		 ifindex;
+	uint8_t			 flags;
 };
+#define F_KNH_DOWN		0x01
 
 struct kpw {
 	unsigned short		 ifindex;
@@ -483,6 +554,32 @@ struct ctl_adj {
 	union ldpd_addr		 trans_addr;
 };
 
+/* per-session counters, msgs_* are indexed by enum nbr_msg_stat */
+enum nbr_msg_stat {
+	NBR_MSG_NOTIFICATION,
+	NBR_MSG_INIT,
+	NBR_MSG_KEEPALIVE,
+	NBR_MSG_ADDR,
+	NBR_MSG_ADDRWITHDRAW,
+	NBR_MSG_MAPPING,
+	NBR_MSG_REQUEST,
+	NBR_MSG_WITHDRAW,
+	NBR_MSG_RELEASE,
+	NBR_MSG_ABORTREQ,
+	NBR_MSG_OTHER,
+	NBR_MSG_MAX
+};
+
+struct nbr_stats {
+	uint64_t		 msgs_sent[NBR_MSG_MAX];
+	uint64_t		 msgs_rcvd[NBR_MSG_MAX];
+	uint64_t		 pdus_sent;
+	uint64_t		 pdus_rcvd;
+	uint64_t		 bytes_sent;
+	uint64_t		 bytes_rcvd;
+	uint64_t		 writes;	/* write syscalls */
+};
+
 struct ctl_nbr {
 	int			 af;
 	struct in_addr		 id;
@@ -490,6 +587,190 @@ struct ctl_nbr {
 	union ldpd_addr		 raddr;
 	time_t			 uptime;
 	int			 nbr_state;
+	struct nbr_stats	 stats;
+	uint32_t		 wbuf_queued;	/* pdus waiting to be written */
+};
+
+struct ctl_pending_conn {
+	uint32_t		 count;
+	uint32_t		 limit;
+	uint64_t		 accepted;
+	uint64_t		 adopted;
+	uint64_t		 expired;
+	uint64_t		 refused;
+	uint32_t		 wait_avg;	/* msecs before adoption */
+	uint32_t		 wait_max;	/* msecs before adoption */
+};
+
+struct ctl_nbr_connq {
+	uint32_t		 active;
+	uint32_t		 limit;
+	uint32_t		 queued_prio;	/* pseudowire or link peers */
+	uint32_t		 queued;
+	uint64_t		 admitted;
+};
+
+struct ctl_accept {
+	uint64_t		 accepted;
+	uint64_t		 refused;	/* dropped for lack of fds */
+	uint64_t		 paused;
+	uint32_t		 pause_ms;	/* next pause duration */
+	int			 reserve;	/* reserve fd available */
+};
+
+struct ctl_fib {
+	uint32_t		 pending;	/* route ops waiting for a flush */
+	uint32_t		 pending_max;
+	uint64_t		 queued;
+	uint64_t		 written;
+	uint64_t		 saved;		/* superseded before being written */
+	uint64_t		 errors;
+	uint64_t		 flushes;
+	uint32_t		 latency_avg;	/* usecs, queued to written */
+	uint32_t		 latency_p50;
+	uint32_t		 latency_p99;
+	uint32_t		 latency_max;
+	uint32_t		 resyncs;
+	uint32_t		 resync_add;	/* counts from the last resync */
+	uint32_t		 resync_change;
+	uint32_t		 resync_delete;
+	uint32_t		 resync_noop;
+	uint64_t		 rt_overflows;	/* routing socket overflows */
+	uint64_t		 rt_resyncs;
+	uint32_t		 rt_resync_msecs; /* duration of the last one */
+	int			 rt_resyncing;
+	uint32_t		 startup_table_msecs;	/* 0 if not yet */
+	uint32_t		 startup_first_label_msecs;
+	uint32_t		 startup_full_lib_msecs;
+	uint32_t		 nh_count;	/* shared nexthop objects */
+	uint64_t		 nh_failures;
+	uint64_t		 nh_elided;	/* writes saved by failures */
+};
+
+/* binary event trace, IMSG_CTL_SHOW_TRACE carries arrays of these */
+struct trace_rec {
+	uint64_t		 ts;		/* nsecs, CLOCK_MONOTONIC */
+	uint8_t			 proc;		/* enum ldpd_process */
+	uint8_t			 type;
+	uint16_t		 arg;
+	uint32_t		 id;
+	uint32_t		 a1;
+	uint32_t		 a2;
+};
+
+/* type			   arg		id		a1	  a2 */
+#define TRACE_MSG_IN	1	/* msg type	lsr-id		size */
+#define TRACE_MSG_OUT	2	/* msg type	lsr-id		size */
+#define TRACE_IMSG_IN	3	/* imsg type	peerid		size */
+#define TRACE_IMSG_OUT	4	/* imsg type	peerid		size */
+#define TRACE_NBR_FSM	5	/* event	lsr-id		old	  new */
+#define TRACE_FIB_OP	6	/* action	local label	family	  error */
+#define TRACE_TIMER	7	/* timer	lsr-id, ifindex */
+
+enum trace_timer {
+	TRACE_TIMER_KEEPALIVE,
+	TRACE_TIMER_KEEPALIVE_TIMEOUT,
+	TRACE_TIMER_INIT_TIMEOUT,
+	TRACE_TIMER_INIT_DELAY,
+	TRACE_TIMER_ADJ_TIMEOUT,
+	TRACE_TIMER_LINK_HELLO,
+	TRACE_TIMER_TNBR_HELLO,
+	TRACE_TIMER_LDE_GC
+};
+
+/* convergence latency stages, see stats.c */
+enum stats_stage {
+	STATS_MAPPING_LDE,	/* label mapping received, lde */
+	STATS_MAPPING_FIB,	/* label mapping received, LSP written */
+	STATS_ROUTE_LDE,	/* route learned, lde */
+	STATS_ROUTE_MAPPING,	/* route learned, label mapping sent */
+	STATS_STAGE_MAX
+};
+
+struct ctl_stats {
+	uint8_t			 stage;		/* enum stats_stage */
+	uint64_t		 count;
+	uint64_t		 p50;		/* usecs */
+	uint64_t		 p90;
+	uint64_t		 p99;
+	uint64_t		 max;
+};
+
+/* allocation accounting, see mem.c */
+enum mem_type {
+	MEM_FEC_NODE,
+	MEM_FEC_NH,
+	MEM_LDE_NBR,
+	MEM_LDE_MAP,
+	MEM_LDE_REQ,
+	MEM_LDE_WDRAW,
+	MEM_NBR,
+	MEM_ADJ,
+	MEM_TCP_CONN,
+	MEM_SESSION_RBUF,
+	MEM_MAPPING_ENTRY,
+	MEM_KROUTE_PREFIX,
+	MEM_KROUTE_PRIO,
+	MEM_KROUTE_NODE,
+	MEM_KIF,
+	MEM_KR_OP,
+	MEM_KR_NH,
+	MEM_IMSG_WBUF,		/* gauge, queued on the imsg pipes */
+	MEM_SESSION_WBUF,	/* gauge, queued on the LDP sessions */
+	MEM_TYPE_MAX
+};
+
+struct ctl_mem {
+	uint8_t			 proc;		/* enum ldpd_process */
+	uint8_t			 type;		/* enum mem_type */
+	uint64_t		 objects;
+	uint64_t		 bytes;
+};
+
+/*
+ * Event callback profiler. PROF_CALLBACK(cb) defines the PROF(cb)
+ * trampoline, to be registered with libevent in place of cb.
+ */
+#define PROF_STALLS	4
+#define PROF_NAME_LEN	32
+
+struct prof_cb {
+	LIST_ENTRY(prof_cb)	 entry;
+	const char		*name;
+	int			 linked;
+	uint64_t		 calls;
+	uint64_t		 total;		/* usecs */
+	struct {
+		uint64_t	 usecs;
+		uint64_t	 when;		/* see stats_now() */
+	} stalls[PROF_STALLS];			/* longest runs first */
+};
+
+#define PROF_CALLBACK(cb)						\
+static struct prof_cb	 cb##_prof_cb = { .name = #cb };		\
+static void								\
+cb##_prof(int fd, short event, void *arg)				\
+{									\
+	prof_call(&cb##_prof_cb, cb, fd, event, arg);			\
+}
+#define PROF(cb)	cb##_prof
+
+/* IMSG_CTL_PROF */
+struct ctl_prof_req {
+	int			 proc;		/* enum ldpd_process */
+	int			 cmd;
+};
+#define PROF_CMD_ENABLE		1
+#define PROF_CMD_DISABLE	2
+#define PROF_CMD_RESET		3
+
+struct ctl_prof {
+	uint8_t			 proc;		/* enum ldpd_process */
+	char			 name[PROF_NAME_LEN];
+	uint64_t		 calls;
+	uint64_t		 total;		/* usecs */
+	uint64_t		 stall[PROF_STALLS];	/* usecs */
+	uint32_t		 stall_ago[PROF_STALLS];	/* secs */
 };
 
 struct ctl_rt {
@@ -503,6 +784,64 @@ struct ctl_rt {
 	uint8_t			 in_use;
 };
 
+/*
+ * Optional IMSG_CTL_SHOW_LIB filter. An empty request is answered with one
+ * ctl_rt per imsg, as before; a filtered one with arrays of ctl_rt. If
+ * page_size entries were sent before the end, IMSG_CTL_LIB_CURSOR returns
+ * this request with the cursor set, to be sent again for the next page.
+ */
+struct ctl_lib_req {
+	int			 af;		/* AF_UNSPEC for all */
+	union ldpd_addr		 prefix;
+	uint8_t			 prefixlen;
+	uint8_t			 flags;
+	struct in_addr		 nbr_id;	/* INADDR_ANY for all */
+	uint32_t		 label;		/* NO_LABEL for all */
+	uint32_t		 page_size;	/* 0 for no limit */
+	int			 cursor_af;	/* last FEC of the last page */
+	union ldpd_addr		 cursor_prefix;
+	uint8_t			 cursor_prefixlen;
+};
+#define F_CTL_LIB_SUBTREE	0x01	/* the prefix and more specifics */
+#define F_CTL_LIB_IN_USE	0x02
+#define F_CTL_LIB_CURSOR	0x04
+
+/*
+ * LIB snapshot file: a header followed by fixed-size records sorted by FEC
+ * (af, prefix, prefixlen) and then by neighbor, so that it can be mmap'ed
+ * and searched or merged without parsing. It is the LIB as of hdr.time.
+ */
+#define LIB_SNAPSHOT_MAGIC	0x4c444c42	/* "LDLB" */
+#define LIB_SNAPSHOT_VERSION	1
+
+struct lib_snapshot_hdr {
+	uint32_t		 magic;
+	uint16_t		 version;
+	uint16_t		 rec_size;
+	uint32_t		 count;
+	uint32_t		 pad;
+	int64_t			 time;		/* seconds since the epoch */
+};
+
+struct lib_snapshot_rec {
+	uint8_t			 af;
+	uint8_t			 prefixlen;
+	uint8_t			 in_use;
+	uint8_t			 pad;
+	uint32_t		 local_label;
+	uint32_t		 remote_label;	/* NO_LABEL if none */
+	struct in_addr		 nbr_id;	/* INADDR_ANY if none */
+	uint8_t			 prefix[16];
+};
+
+/* result of IMSG_CTL_LIB_SNAPSHOT and IMSG_LIB_SNAPSHOT_DONE */
+struct ctl_lib_snapshot {
+	int			 error;		/* errno, 0 on success */
+	uint32_t		 count;
+	uint64_t		 size;
+	uint32_t		 msecs;
+};
+
 struct ctl_pw {
 	uint16_t		 type;
 	char			 ifname[IF_NAMESIZE];
@@ -524,7 +863,37 @@ extern struct ldpd_global	 global;
 struct ldpd_conf	*parse_config(char *);
 int			 cmdline_symset(char *);
 
+/* FIB backend, see kroute.c */
+#define KR_ASYNC	1
+struct kr_backend {
+	const char	*name;
+	int		 (*init)(void);
+	int		 (*fetchifs)(void);
+	/* may return KR_ASYNC and call kr_table_loaded() once done */
+	int		 (*fetchtable)(void);
+	int		 (*fetchlabels)(void);	/* optional */
+	/*
+	 * Returns 0 or -1 once the route is written, or KR_ASYNC if the
+	 * write completes later through kr_route_done(). Asynchronous
+	 * writes must complete in the order they were issued.
+	 */
+	int		 (*send_route)(int, struct kroute *, int);
+	int		 (*pw_install)(const char *, struct kpw *);
+	int		 (*pw_uninstall)(const char *);
+	/*
+	 * Optional shared nexthops. FIB entries carrying a nhid forward
+	 * through that object; once it is installed with F_KNH_DOWN, or
+	 * uninstalled, the entries referencing it lose their labels.
+	 */
+	int		 (*nh_install)(struct knexthop *);
+	int		 (*nh_uninstall)(struct knexthop *);
+};
+
 /* kroute.c */
+void		 kr_set_backend(struct kr_backend *);
+int		 kr_table_add(struct kroute *);
+void		 kr_route_done(int);
+void		 kr_table_loaded(void);
 int		 kif_init(void);
 int		 kr_init(int);
 void		 kif_redistribute(const char *);
@@ -536,11 +905,56 @@ void		 kr_fib_decouple(void);
 void		 kr_change_egress_label(int, int);
 void		 kr_show_route(struct imsg *);
 void		 kr_ifinfo(char *, pid_t);
+void		 kr_show_fib(pid_t);
+void		 kr_redist_update(void);
+void		 kr_nexthop_down(struct knexthop *);
 struct kif	*kif_findname(char *);
 void		 kif_clear(void);
 int		 kmpw_set(struct kpw *);
 int		 kmpw_unset(struct kpw *);
 
+/* kroute_mock.c */
+int		 kr_mock_config(const char *);
+
+/* trace.c */
+void		 trace(uint8_t, uint16_t, uint32_t, uint32_t, uint32_t);
+void		 trace_ctl(pid_t, void (*)(int, pid_t, void *, uint16_t));
+
+/* stats.c */
+uint64_t	 stats_now(void);
+void		 stats_record(enum stats_stage, uint64_t);
+void		 stats_ctl(pid_t, void (*)(int, pid_t, void *, uint16_t));
+
+/* mem.c */
+void		 mem_add(enum mem_type, size_t);
+void		 mem_del(enum mem_type, size_t);
+void		 mem_msgbuf(enum mem_type, struct msgbuf *);
+void		 mem_ctl(pid_t, int, void (*)(int, pid_t, void *, uint16_t));
+
+/* prof.c */
+void		 prof_call(struct prof_cb *, void (*)(int, short, void *), int,
+		    short, void *);
+void		 prof_cmd(int);
+void		 prof_ctl(pid_t, void (*)(int, pid_t, void *, uint16_t));
+
+/* prefix_list.c */
+struct prefix_list	*prefix_list_new(const char *);
+struct prefix_list	*prefix_list_find(struct ldpd_conf *, const char *);
+int			 prefix_list_add(struct prefix_list *, int,
+			    union ldpd_addr *, uint8_t, int);
+int			 prefix_list_match(struct prefix_list *, int,
+			    union ldpd_addr *, uint8_t);
+void			 prefix_list_del(struct prefix_list *);
+
+/* ptrie.c */
+struct ptrie_node	*ptrie_insert(struct ptrie_node **, int,
+			    const union ldpd_addr *, uint8_t);
+void			 ptrie_remove(struct ptrie_node **,
+			    struct ptrie_node *);
+struct ptrie_node	*ptrie_match(struct ptrie_node *, int,
+			    const union ldpd_addr *, uint8_t);
+void			 ptrie_free(struct ptrie_node **, void (*)(void *));
+
 /* util.c */
 uint8_t		 mask2prefixlen(in_addr_t);
 uint8_t		 mask2prefixlen6(struct sockaddr_in6 *);
@@ -0,0 +1,317 @@
+/*	$OpenBSD$ */
+
+/*
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Offline readers for what ldpd records for debugging: the event trace
+ * rings of a running daemon (see trace.c) and the LIB snapshots it writes
+ * (see snapshot.c).
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <net/route.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ldpd.h"
+#include "log.h"
+#include "ldpdump.h"
+
+static __dead void	 usage(void);
+static int		 trace_show(void);
+static int		 trace_fetch(struct imsgbuf *, int, struct trace_rec **,
+			    size_t *);
+static int		 trace_compare(const void *, const void *);
+static const char	*trace_proc_name(uint8_t);
+static const char	*trace_timer_name(uint16_t);
+static const char	*trace_action_name(uint16_t);
+static void		 trace_print(struct trace_rec *);
+
+static __dead void
+usage(void)
+{
+	extern char *__progname;
+
+	fprintf(stderr, "usage: %s -S file [newfile]\n", __progname);
+	fprintf(stderr, "       %s -T\n", __progname);
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	char			*snapfile = NULL;
+	int			 ch, ret, tflag = 0;
+
+	log_init(1);
+	log_verbose(1);
+	ldpd_process = PROC_MAIN;
+
+	while ((ch = getopt(argc, argv, "S:T")) != -1) {
+		switch (ch) {
+		case 'S':
+			snapfile = optarg;
+			break;
+		case 'T':
+			tflag = 1;
+			break;
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (tflag) {
+		if (argc > 0 || snapfile != NULL)
+			usage();
+		exit(trace_show() == -1);
+	}
+	if (snapfile == NULL || argc > 1)
+		usage();
+
+	ret = lib_snapshot_show(snapfile, argc == 1 ? argv[0] : NULL);
+	exit(ret == -1 ? 2 : ret);
+}
+
+/*
+ * Fetch the ring of every process from a running ldpd and print the
+ * records merged in time order.
+ */
+static int
+trace_show(void)
+{
+	static const int	 procs[] = {
+		PROC_MAIN, PROC_LDP_ENGINE, PROC_LDE_ENGINE
+	};
+	struct sockaddr_un	 sun;
+	struct imsgbuf		 ibuf;
+	struct trace_rec	*recs = NULL;
+	size_t			 count = 0, i;
+	int			 fd, ret = -1;
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		log_warn("%s: socket", __func__);
+		return (-1);
+	}
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strlcpy(sun.sun_path, LDPD_SOCKET, sizeof(sun.sun_path));
+	if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) == -1) {
+		log_warn("%s: connect %s", __func__, LDPD_SOCKET);
+		close(fd);
+		return (-1);
+	}
+
+	imsg_init(&ibuf, fd);
+	for (i = 0; i < sizeof(procs) / sizeof(procs[0]); i++)
+		if (trace_fetch(&ibuf, procs[i], &recs, &count) == -1)
+			goto done;
+
+	qsort(recs, count, sizeof(*recs), trace_compare);
+	for (i = 0; i < count; i++)
+		trace_print(&recs[i]);
+	ret = 0;
+
+done:
+	imsg_clear(&ibuf);
+	close(fd);
+	free(recs);
+
+	return (ret);
+}
+
+/* append the ring of a process, sent as IMSG_CTL_SHOW_TRACE chunks */
+static int
+trace_fetch(struct imsgbuf *ibuf, int proc, struct trace_rec **recs,
+    size_t *count)
+{
+	struct imsg		 imsg;
+	struct trace_rec	*p;
+	size_t			 len, n;
+	ssize_t			 r;
+	int			 done = 0;
+
+	if (imsg_compose(ibuf, IMSG_CTL_SHOW_TRACE, 0, 0, -1, &proc,
+	    sizeof(proc)) == -1 || imsg_flush(ibuf) == -1) {
+		log_warn("%s: write", __func__);
+		return (-1);
+	}
+
+	while (!done) {
+		if ((r = imsg_read(ibuf)) == -1 && errno != EAGAIN) {
+			log_warn("%s: read", __func__);
+			return (-1);
+		}
+		if (r == 0) {
+			log_warnx("%s: connection closed", __func__);
+			return (-1);
+		}
+
+		while (!done) {
+			if ((r = imsg_get(ibuf, &imsg)) == -1) {
+				log_warn("%s: imsg_get", __func__);
+				return (-1);
+			}
+			if (r == 0)
+				break;
+
+			switch (imsg.hdr.type) {
+			case IMSG_CTL_SHOW_TRACE:
+				len = imsg.hdr.len - IMSG_HEADER_SIZE;
+				if (len % sizeof(**recs) != 0) {
+					log_warnx("%s: wrong imsg len",
+					    __func__);
+					imsg_free(&imsg);
+					return (-1);
+				}
+				n = len / sizeof(**recs);
+				if ((p = reallocarray(*recs, *count + n,
+				    sizeof(**recs))) == NULL)
+					fatal(__func__);
+				memcpy(&p[*count], imsg.data, len);
+				*recs = p;
+				*count += n;
+				break;
+			case IMSG_CTL_END:
+				done = 1;
+				break;
+			default:
+				break;
+			}
+			imsg_free(&imsg);
+		}
+	}
+
+	return (0);
+}
+
+static int
+trace_compare(const void *a, const void *b)
+{
+	const struct trace_rec	*ra = a, *rb = b;
+
+	if (ra->ts < rb->ts)
+		return (-1);
+	if (ra->ts > rb->ts)
+		return (1);
+	return (0);
+}
+
+static const char *
+trace_proc_name(uint8_t proc)
+{
+	switch (proc) {
+	case PROC_MAIN:
+		return ("parent");
+	case PROC_LDP_ENGINE:
+		return ("ldpe");
+	case PROC_LDE_ENGINE:
+		return ("lde");
+	default:
+		return ("?");
+	}
+}
+
+static const char *
+trace_timer_name(uint16_t timer)
+{
+	switch (timer) {
+	case TRACE_TIMER_KEEPALIVE:
+		return ("keepalive");
+	case TRACE_TIMER_KEEPALIVE_TIMEOUT:
+		return ("keepalive-timeout");
+	case TRACE_TIMER_INIT_TIMEOUT:
+		return ("init-timeout");
+	case TRACE_TIMER_INIT_DELAY:
+		return ("init-delay");
+	case TRACE_TIMER_ADJ_TIMEOUT:
+		return ("adjacency-timeout");
+	case TRACE_TIMER_LINK_HELLO:
+		return ("link-hello");
+	case TRACE_TIMER_TNBR_HELLO:
+		return ("targeted-hello");
+	case TRACE_TIMER_LDE_GC:
+		return ("lde-gc");
+	default:
+		return ("?");
+	}
+}
+
+static const char *
+trace_action_name(uint16_t action)
+{
+	switch (action) {
+	case RTM_ADD:
+		return ("add");
+	case RTM_CHANGE:
+		return ("change");
+	case RTM_DELETE:
+		return ("delete");
+	default:
+		return ("?");
+	}
+}
+
+static void
+trace_print(struct trace_rec *r)
+{
+	struct in_addr		 id;
+
+	id.s_addr = r->id;
+	printf("%llu.%09llu %-6s ", (unsigned long long)r->ts / 1000000000,
+	    (unsigned long long)r->ts % 1000000000, trace_proc_name(r->proc));
+
+	switch (r->type) {
+	case TRACE_MSG_IN:
+	case TRACE_MSG_OUT:
+		printf("%s %s lsr-id %s size %u\n",
+		    r->type == TRACE_MSG_IN ? "msg-in" : "msg-out",
+		    msg_name(r->arg), inet_ntoa(id), r->a1);
+		break;
+	case TRACE_IMSG_IN:
+	case TRACE_IMSG_OUT:
+		printf("%s type %u peerid %u size %u\n",
+		    r->type == TRACE_IMSG_IN ? "imsg-in" : "imsg-out",
+		    r->arg, r->id, r->a1);
+		break;
+	case TRACE_NBR_FSM:
+		printf("nbr-fsm lsr-id %s event %u %s -> %s\n", inet_ntoa(id),
+		    r->arg, nbr_state_name(r->a1), nbr_state_name(r->a2));
+		break;
+	case TRACE_FIB_OP:
+		printf("fib-op %s %s label %s%s\n", trace_action_name(r->arg),
+		    af_name(r->a1), log_label(r->id), r->a2 ? " failed" : "");
+		break;
+	case TRACE_TIMER:
+		if (r->arg == TRACE_TIMER_LINK_HELLO)
+			printf("timer %s ifindex %u\n",
+			    trace_timer_name(r->arg), r->id);
+		else
+			printf("timer %s %s\n", trace_timer_name(r->arg),
+			    inet_ntoa(id));
+		break;
+	default:
+		printf("unknown type %u\n", r->type);
+		break;
+	}
+}
@@ -0,0 +1,234 @@
+/*	$OpenBSD$ */
+
+/*
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * LIB snapshot reader. The lde writes the records sorted by FEC and
+ * neighbor (see lib_snapshot() in lde_lib.c), so a snapshot is used in
+ * place once mapped and two of them are compared with a single merge pass.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ldpd.h"
+#include "log.h"
+#include "ldpdump.h"
+
+struct lib_snapshot_map {
+	void			*base;
+	size_t			 size;
+	struct lib_snapshot_hdr	*hdr;
+	struct lib_snapshot_rec	*recs;
+};
+
+static int	 lib_snapshot_open(const char *, struct lib_snapshot_map *);
+static void	 lib_snapshot_close(struct lib_snapshot_map *);
+static int	 lib_snapshot_cmp(struct lib_snapshot_rec *,
+		    struct lib_snapshot_rec *);
+static int	 lib_snapshot_changed(struct lib_snapshot_rec *,
+		    struct lib_snapshot_rec *);
+static void	 lib_snapshot_print(char, struct lib_snapshot_rec *);
+static int	 lib_snapshot_diff(struct lib_snapshot_map *,
+		    struct lib_snapshot_map *);
+
+/*
+ * Print a snapshot or, if newpath is given, what changed from path to
+ * newpath. Like diff(1), returns 1 if there are differences.
+ */
+int
+lib_snapshot_show(const char *path, const char *newpath)
+{
+	struct lib_snapshot_map	 m, nm;
+	time_t			 t;
+	uint32_t		 i;
+	int			 ret;
+
+	if (lib_snapshot_open(path, &m) == -1)
+		return (-1);
+
+	if (newpath == NULL) {
+		t = m.hdr->time;
+		printf("# %u entries, %s", m.hdr->count, ctime(&t));
+		for (i = 0; i < m.hdr->count; i++)
+			lib_snapshot_print(' ', &m.recs[i]);
+		lib_snapshot_close(&m);
+		return (0);
+	}
+
+	if (lib_snapshot_open(newpath, &nm) == -1) {
+		lib_snapshot_close(&m);
+		return (-1);
+	}
+	ret = lib_snapshot_diff(&m, &nm);
+	lib_snapshot_close(&nm);
+	lib_snapshot_close(&m);
+
+	return (ret);
+}
+
+static int
+lib_snapshot_open(const char *path, struct lib_snapshot_map *m)
+{
+	struct stat		 st;
+	int			 fd;
+
+	memset(m, 0, sizeof(*m));
+	if ((fd = open(path, O_RDONLY)) == -1) {
+		log_warn("%s", path);
+		return (-1);
+	}
+	if (fstat(fd, &st) == -1) {
+		log_warn("%s", path);
+		close(fd);
+		return (-1);
+	}
+	if (st.st_size < (off_t)sizeof(struct lib_snapshot_hdr)) {
+		log_warnx("%s: not a LIB snapshot", path);
+		close(fd);
+		return (-1);
+	}
+
+	m->size = st.st_size;
+	m->base = mmap(NULL, m->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (m->base == MAP_FAILED) {
+		log_warn("%s: mmap", path);
+		return (-1);
+	}
+	m->hdr = m->base;
+	m->recs = (struct lib_snapshot_rec *)(m->hdr + 1);
+
+	if (m->hdr->magic != LIB_SNAPSHOT_MAGIC) {
+		log_warnx("%s: not a LIB snapshot", path);
+		goto fail;
+	}
+	if (m->hdr->version != LIB_SNAPSHOT_VERSION ||
+	    m->hdr->rec_size != sizeof(struct lib_snapshot_rec)) {
+		log_warnx("%s: unsupported snapshot version %u", path,
+		    m->hdr->version);
+		goto fail;
+	}
+	if (m->size != sizeof(struct lib_snapshot_hdr) +
+	    (size_t)m->hdr->count * sizeof(struct lib_snapshot_rec)) {
+		log_warnx("%s: truncated snapshot", path);
+		goto fail;
+	}
+
+	return (0);
+
+ fail:
+	lib_snapshot_close(m);
+	return (-1);
+}
+
+static void
+lib_snapshot_close(struct lib_snapshot_map *m)
+{
+	munmap(m->base, m->size);
+	memset(m, 0, sizeof(*m));
+}
+
+/* same order as the fec tree, then by neighbor */
+static int
+lib_snapshot_cmp(struct lib_snapshot_rec *a, struct lib_snapshot_rec *b)
+{
+	int		 r;
+
+	if (a->af < b->af)
+		return (-1);
+	if (a->af > b->af)
+		return (1);
+	if ((r = memcmp(a->prefix, b->prefix, sizeof(a->prefix))) != 0)
+		return (r);
+	if (a->prefixlen < b->prefixlen)
+		return (-1);
+	if (a->prefixlen > b->prefixlen)
+		return (1);
+	if (ntohl(a->nbr_id.s_addr) < ntohl(b->nbr_id.s_addr))
+		return (-1);
+	if (ntohl(a->nbr_id.s_addr) > ntohl(b->nbr_id.s_addr))
+		return (1);
+	return (0);
+}
+
+static int
+lib_snapshot_changed(struct lib_snapshot_rec *a, struct lib_snapshot_rec *b)
+{
+	return (a->local_label != b->local_label ||
+	    a->remote_label != b->remote_label || a->in_use != b->in_use);
+}
+
+static void
+lib_snapshot_print(char mark, struct lib_snapshot_rec *r)
+{
+	union ldpd_addr		 prefix;
+	char			 fec[INET6_ADDRSTRLEN + 4];
+
+	memcpy(&prefix, r->prefix, sizeof(prefix));
+	snprintf(fec, sizeof(fec), "%s/%u", log_addr(r->af, &prefix),
+	    r->prefixlen);
+
+	printf("%c %-20s %-15s %-9s %-9s %s\n", mark, fec,
+	    r->nbr_id.s_addr == INADDR_ANY ? "-" : inet_ntoa(r->nbr_id),
+	    log_label(r->local_label), log_label(r->remote_label),
+	    r->in_use ? "yes" : "no");
+}
+
+/* '-' for entries gone, '+' for new ones, both for entries that changed */
+static int
+lib_snapshot_diff(struct lib_snapshot_map *m, struct lib_snapshot_map *nm)
+{
+	uint32_t		 i = 0, j = 0;
+	uint32_t		 added = 0, removed = 0, changed = 0;
+	int			 r;
+
+	while (i < m->hdr->count || j < nm->hdr->count) {
+		if (i == m->hdr->count)
+			r = 1;
+		else if (j == nm->hdr->count)
+			r = -1;
+		else
+			r = lib_snapshot_cmp(&m->recs[i], &nm->recs[j]);
+
+		if (r < 0) {
+			lib_snapshot_print('-', &m->recs[i++]);
+			removed++;
+		} else if (r > 0) {
+			lib_snapshot_print('+', &nm->recs[j++]);
+			added++;
+		} else {
+			if (lib_snapshot_changed(&m->recs[i], &nm->recs[j])) {
+				lib_snapshot_print('-', &m->recs[i]);
+				lib_snapshot_print('+', &nm->recs[j]);
+				changed++;
+			}
+			i++;
+			j++;
+		}
+	}
+
+	printf("# %u added, %u removed, %u changed\n", added, removed,
+	    changed);
+
+	return (added || removed || changed);
+}
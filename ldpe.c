@@ -43,6 +43,13 @@ static void	 ldpe_setup_sockets(int, int, int, int);
 static void	 ldpe_close_sockets(int);
 static void	 ldpe_iface_af_ctl(struct ctl_conn *, int, unsigned int);
 
+PROF_CALLBACK(ldpe_sig_handler)
+PROF_CALLBACK(ldpe_dispatch_main)
+PROF_CALLBACK(ldpe_dispatch_lde)
+PROF_CALLBACK(ldpe_dispatch_pfkey)
+PROF_CALLBACK(disc_recv_packet)
+PROF_CALLBACK(session_accept)
+
 struct ldpd_conf	*leconf;
 struct ldpd_sysdep	 sysdep;
 
@@ -85,7 +92,8 @@ ldpe(int debug, int verbose)
 
 	LIST_INIT(&global.addr_list);
 	LIST_INIT(&global.adj_list);
-	TAILQ_INIT(&global.pending_conns);
+	RB_INIT(&global.pending_conns);
+	nbr_fsm_init();
 	if (inet_pton(AF_INET, AllRouters_v4, &global.mcast_addr_v4) != 1)
 		fatal("inet_pton");
 	if (inet_pton(AF_INET6, AllRouters_v6, &global.mcast_addr_v6) != 1)
@@ -112,8 +120,8 @@ ldpe(int debug, int verbose)
 	accept_init();
 
 	/* setup signal handler */
-	signal_set(&ev_sigint, SIGINT, ldpe_sig_handler, NULL);
-	signal_set(&ev_sigterm, SIGTERM, ldpe_sig_handler, NULL);
+	signal_set(&ev_sigint, SIGINT, PROF(ldpe_sig_handler), NULL);
+	signal_set(&ev_sigterm, SIGTERM, PROF(ldpe_sig_handler), NULL);
 	signal_add(&ev_sigint, NULL);
 	signal_add(&ev_sigterm, NULL);
 	signal(SIGPIPE, SIG_IGN);
@@ -123,7 +131,7 @@ ldpe(int debug, int verbose)
 	if ((iev_main = malloc(sizeof(struct imsgev))) == NULL)
 		fatal(NULL);
 	imsg_init(&iev_main->ibuf, 3);
-	iev_main->handler = ldpe_dispatch_main;
+	iev_main->handler = PROF(ldpe_dispatch_main);
 	iev_main->events = EV_READ;
 	event_set(&iev_main->ev, iev_main->ibuf.fd, iev_main->events,
 	    iev_main->handler, iev_main);
@@ -131,7 +139,7 @@ ldpe(int debug, int verbose)
 
 	if (sysdep.no_pfkey == 0) {
 		event_set(&pfkey_ev, global.pfkeysock, EV_READ | EV_PERSIST,
-		    ldpe_dispatch_pfkey, NULL);
+		    PROF(ldpe_dispatch_pfkey), NULL);
 		event_add(&pfkey_ev, NULL);
 	}
 
@@ -255,6 +263,9 @@ ldpe_dispatch_main(int fd, short event, void *bula)
 		if (n == 0)
 			break;
 
+		trace(TRACE_IMSG_IN, imsg.hdr.type, imsg.hdr.peerid,
+		    imsg.hdr.len - IMSG_HEADER_SIZE, 0);
+
 		switch (imsg.hdr.type) {
 		case IMSG_IFSTATUS:
 			if (imsg.hdr.len != IMSG_HEADER_SIZE +
@@ -299,7 +310,7 @@ ldpe_dispatch_main(int fd, short event, void *bula)
 			if ((iev_lde = malloc(sizeof(struct imsgev))) == NULL)
 				fatal(NULL);
 			imsg_init(&iev_lde->ibuf, fd);
-			iev_lde->handler = ldpe_dispatch_lde;
+			iev_lde->handler = PROF(ldpe_dispatch_lde);
 			iev_lde->events = EV_READ;
 			event_set(&iev_lde->ev, iev_lde->ibuf.fd,
 			    iev_lde->events, iev_lde->handler, iev_lde);
@@ -383,6 +394,7 @@ ldpe_dispatch_main(int fd, short event, void *bula)
 			LIST_INIT(&nconf->tnbr_list);
 			LIST_INIT(&nconf->nbrp_list);
 			LIST_INIT(&nconf->l2vpn_list);
+			LIST_INIT(&nconf->plist_list);
 			break;
 		case IMSG_RECONF_IFACE:
 			if ((niface = malloc(sizeof(struct iface))) == NULL)
@@ -445,9 +457,23 @@ ldpe_dispatch_main(int fd, short event, void *bula)
 		case IMSG_CTL_KROUTE:
 		case IMSG_CTL_KROUTE_ADDR:
 		case IMSG_CTL_IFINFO:
+		case IMSG_CTL_SHOW_FIB:
+		case IMSG_CTL_SHOW_TRACE:
+		case IMSG_CTL_SHOW_STATS:
+		case IMSG_CTL_SHOW_PROF:
+		case IMSG_CTL_LIB_SNAPSHOT:
 		case IMSG_CTL_END:
 			control_imsg_relay(&imsg);
 			break;
+		case IMSG_CTL_SHOW_MEMORY:
+			if (imsg.hdr.len == IMSG_HEADER_SIZE) {
+				/* the parent is done, on to the lde */
+				ldpe_imsg_compose_lde(IMSG_CTL_SHOW_MEMORY, 0,
+				    imsg.hdr.pid, NULL, 0);
+				break;
+			}
+			control_imsg_relay(&imsg);
+			break;
 		default:
 			log_debug("ldpe_dispatch_main: error handling imsg %d",
 			    imsg.hdr.type);
@@ -495,6 +521,9 @@ ldpe_dispatch_lde(int fd, short event, void *bula)
 		if (n == 0)
 			break;
 
+		trace(TRACE_IMSG_IN, imsg.hdr.type, imsg.hdr.peerid,
+		    imsg.hdr.len - IMSG_HEADER_SIZE, 0);
+
 		switch (imsg.hdr.type) {
 		case IMSG_MAPPING_ADD:
 		case IMSG_RELEASE_ADD:
@@ -578,6 +607,11 @@ ldpe_dispatch_lde(int fd, short event, void *bula)
 			break;
 		case IMSG_CTL_END:
 		case IMSG_CTL_SHOW_LIB:
+		case IMSG_CTL_LIB_CURSOR:
+		case IMSG_CTL_SHOW_TRACE:
+		case IMSG_CTL_SHOW_STATS:
+		case IMSG_CTL_SHOW_PROF:
+		case IMSG_CTL_SHOW_MEMORY:
 		case IMSG_CTL_SHOW_L2VPN_PW:
 		case IMSG_CTL_SHOW_L2VPN_BINDING:
 			control_imsg_relay(&imsg);
@@ -620,18 +654,19 @@ ldpe_setup_sockets(int af, int disc_socket, int edisc_socket,
 	/* discovery socket */
 	af_global->ldp_disc_socket = disc_socket;
 	event_set(&af_global->disc_ev, af_global->ldp_disc_socket,
-	    EV_READ|EV_PERSIST, disc_recv_packet, NULL);
+	    EV_READ|EV_PERSIST, PROF(disc_recv_packet), NULL);
 	event_add(&af_global->disc_ev, NULL);
 
 	/* extended discovery socket */
 	af_global->ldp_edisc_socket = edisc_socket;
 	event_set(&af_global->edisc_ev, af_global->ldp_edisc_socket,
-	    EV_READ|EV_PERSIST, disc_recv_packet, NULL);
+	    EV_READ|EV_PERSIST, PROF(disc_recv_packet), NULL);
 	event_add(&af_global->edisc_ev, NULL);
 
 	/* session socket */
 	af_global->ldp_session_socket = session_socket;
-	accept_add(af_global->ldp_session_socket, session_accept, NULL);
+	accept_add(af_global->ldp_session_socket, PROF(session_accept),
+	    NULL);
 }
 
 static void
@@ -783,6 +818,60 @@ ldpe_nbr_ctl(struct ctl_conn *c)
 	imsg_compose_event(&c->iev, IMSG_CTL_END, 0, 0, -1, NULL, 0);
 }
 
+void
+ldpe_pending_conn_ctl(struct ctl_conn *c)
+{
+	struct ctl_pending_conn	*pctl;
+
+	pctl = pending_conn_to_ctl();
+	imsg_compose_event(&c->iev, IMSG_CTL_SHOW_PENDING_CONN, 0, 0, -1,
+	    pctl, sizeof(struct ctl_pending_conn));
+	imsg_compose_event(&c->iev, IMSG_CTL_END, 0, 0, -1, NULL, 0);
+}
+
+void
+ldpe_nbr_connq_ctl(struct ctl_conn *c)
+{
+	struct ctl_nbr_connq	*cqctl;
+
+	cqctl = nbr_connq_to_ctl();
+	imsg_compose_event(&c->iev, IMSG_CTL_SHOW_NBR_CONNQ, 0, 0, -1,
+	    cqctl, sizeof(struct ctl_nbr_connq));
+	imsg_compose_event(&c->iev, IMSG_CTL_END, 0, 0, -1, NULL, 0);
+}
+
+void
+ldpe_accept_ctl(struct ctl_conn *c)
+{
+	struct ctl_accept	*actl;
+
+	actl = accept_to_ctl();
+	imsg_compose_event(&c->iev, IMSG_CTL_SHOW_ACCEPT, 0, 0, -1,
+	    actl, sizeof(struct ctl_accept));
+	imsg_compose_event(&c->iev, IMSG_CTL_END, 0, 0, -1, NULL, 0);
+}
+
+/*
+ * Report the ldpe counters, then have the parent and the lde add theirs.
+ * The parent ends its part with an empty IMSG_CTL_SHOW_MEMORY and the
+ * lde with IMSG_CTL_END.
+ */
+void
+ldpe_memory_ctl(struct ctl_conn *c)
+{
+	struct nbr	*nbr;
+
+	mem_msgbuf(MEM_IMSG_WBUF, &iev_main->ibuf.w);
+	mem_msgbuf(MEM_IMSG_WBUF, &iev_lde->ibuf.w);
+	RB_FOREACH(nbr, nbr_id_head, &nbrs_by_id)
+		if (nbr->tcp)
+			mem_msgbuf(MEM_SESSION_WBUF, &nbr->tcp->wbuf.wbuf);
+	mem_ctl(c->iev.ibuf.pid, IMSG_NONE, control_compose);
+
+	ldpe_imsg_compose_parent(IMSG_CTL_SHOW_MEMORY, c->iev.ibuf.pid,
+	    NULL, 0);
+}
+
 void
 mapping_list_add(struct mapping_head *mh, struct map *map)
 {
@@ -791,6 +880,7 @@ mapping_list_add(struct mapping_head *mh, struct map *map)
 	me = calloc(1, sizeof(*me));
 	if (me == NULL)
 		fatal(__func__);
+	mem_add(MEM_MAPPING_ENTRY, sizeof(*me));
 	me->map = *map;
 
 	TAILQ_INSERT_TAIL(mh, me, entry);
@@ -803,6 +893,7 @@ mapping_list_clr(struct mapping_head *mh)
 
 	while ((me = TAILQ_FIRST(mh)) != NULL) {
 		TAILQ_REMOVE(mh, me, entry);
+		mem_del(MEM_MAPPING_ENTRY, sizeof(*me));
 		free(me);
 	}
 }
@@ -62,7 +62,8 @@ struct tcp_conn {
 };
 
 struct nbr {
-	RB_ENTRY(nbr)		 id_tree, addr_tree, pid_tree;
+	RB_ENTRY(nbr)		 id_tree, addr_tree;
+	TAILQ_ENTRY(nbr)	 connq_entry;
 	struct tcp_conn		*tcp;
 	LIST_HEAD(, adj)	 adj_list;	/* adjacencies */
 	struct event		 ev_connect;
@@ -93,6 +94,7 @@ struct nbr {
 	int			 idtimer_cnt;
 	uint16_t		 keepalive;
 	uint16_t		 max_pdu_len;
+	struct nbr_stats	 stats;		/* reset with each session */
 
 	struct {
 		uint8_t			established;
@@ -104,22 +106,31 @@ struct nbr {
 	int			 flags;
 };
 #define F_NBR_GTSM_NEGOTIATED	 0x01
+#define F_NBR_CONNQ_QUEUED	 0x02
+#define F_NBR_CONNQ_ACTIVE	 0x04
+#define F_NBR_CONNQ_PRIO	 0x08
+
+/* maximum number of concurrent session setups in the active role */
+#define NBR_CONNQ_MAX		 32
+/* seconds a session setup may wait for its connect() to complete */
+#define NBR_CONNECT_TIMEOUT	 10
 
 RB_HEAD(nbr_id_head, nbr);
 RB_PROTOTYPE(nbr_id_head, nbr, id_tree, nbr_id_compare)
 RB_HEAD(nbr_addr_head, nbr);
 RB_PROTOTYPE(nbr_addr_head, nbr, addr_tree, nbr_addr_compare)
-RB_HEAD(nbr_pid_head, nbr);
-RB_PROTOTYPE(nbr_pid_head, nbr, pid_tree, nbr_pid_compare)
 
 struct pending_conn {
-	TAILQ_ENTRY(pending_conn)	 entry;
+	RB_ENTRY(pending_conn)		 entry;
 	int				 fd;
 	int				 af;
 	union ldpd_addr			 addr;
+	struct timespec			 since;
 	struct event			 ev_timeout;
 };
+RB_PROTOTYPE(pending_conn_head, pending_conn, entry, pending_conn_compare)
 #define PENDING_CONN_TIMEOUT	5
+#define PENDING_CONN_MAX	1024
 
 struct mapping_entry {
 	TAILQ_ENTRY(mapping_entry)	entry;
@@ -135,14 +146,31 @@ extern struct ldpd_conf		*leconf;
 extern struct ldpd_sysdep	 sysdep;
 extern struct nbr_id_head	 nbrs_by_id;
 extern struct nbr_addr_head	 nbrs_by_addr;
-extern struct nbr_pid_head	 nbrs_by_pid;
 
 /* accept.c */
 void	accept_init(void);
 int	accept_add(int, void (*)(int, short, void *), void *);
 void	accept_del(int);
+int	accept_sock(int, struct sockaddr *, socklen_t *);
 void	accept_pause(void);
 void	accept_unpause(void);
+struct ctl_accept *accept_to_ctl(void);
+
+/* codec.c */
+int	 gen_pdu_hdr(struct ibuf *, uint16_t, struct in_addr);
+int	 gen_msg_hdr(struct ibuf *, uint16_t, uint16_t);
+int	 gen_hello_prms_tlv(struct ibuf *, uint16_t, uint16_t);
+int	 gen_opt4_hello_prms_tlv(struct ibuf *, uint16_t, uint32_t);
+int	 gen_opt16_hello_prms_tlv(struct ibuf *, uint16_t, uint8_t *);
+int	 gen_init_prms_tlv(struct ibuf *, uint16_t, struct in_addr);
+int	 gen_address_list_tlv(struct ibuf *, uint16_t, int,
+	    struct if_addr_head *, unsigned int);
+int	 gen_label_tlv(struct ibuf *, uint32_t);
+int	 gen_reqid_tlv(struct ibuf *, uint32_t);
+int	 gen_pw_status_tlv(struct ibuf *, uint32_t);
+int	 gen_fec_tlv(struct ibuf *, struct map *);
+int	 gen_status_tlv(struct ibuf *, uint32_t, uint32_t, uint16_t);
+ssize_t	 session_get_pdu(struct ibuf_read *, char **);
 
 /* hello.c */
 int	 send_hello(enum hello_type, struct iface_af *, struct tnbr *);
@@ -163,7 +191,6 @@ void	 send_notification(uint32_t, struct tcp_conn *, uint32_t,
 	    uint16_t);
 void	 send_notification_nbr(struct nbr *, uint32_t, uint32_t, uint16_t);
 int	 recv_notification(struct nbr *, char *, uint16_t);
-int	 gen_status_tlv(struct ibuf *, uint32_t, uint32_t, uint16_t);
 
 /* address.c */
 void	 send_address_single(struct nbr *, struct if_addr *, int);
@@ -174,8 +201,6 @@ int	 recv_address(struct nbr *, char *, uint16_t);
 #define PREFIX_SIZE(x)	(((x) + 7) / 8)
 void	 send_labelmessage(struct nbr *, uint16_t, struct mapping_head *);
 int	 recv_labelmessage(struct nbr *, char *, uint16_t, uint16_t);
-int	 gen_pw_status_tlv(struct ibuf *, uint32_t);
-int	 gen_fec_tlv(struct ibuf *, struct map *);
 int	 tlv_decode_fec_elm(struct nbr *, struct ldp_msg *, char *,
 	    uint16_t, struct map *);
 
@@ -193,6 +218,10 @@ struct ctl_conn;
 void		 ldpe_iface_ctl(struct ctl_conn *, unsigned int);
 void		 ldpe_adj_ctl(struct ctl_conn *);
 void		 ldpe_nbr_ctl(struct ctl_conn *);
+void		 ldpe_pending_conn_ctl(struct ctl_conn *);
+void		 ldpe_nbr_connq_ctl(struct ctl_conn *);
+void		 ldpe_accept_ctl(struct ctl_conn *);
+void		 ldpe_memory_ctl(struct ctl_conn *);
 void		 mapping_list_add(struct mapping_head *, struct map *);
 void		 mapping_list_clr(struct mapping_head *);
 
@@ -224,6 +253,7 @@ void		 tnbr_update_all(int);
 struct ctl_adj	*adj_to_ctl(struct adj *);
 
 /* neighbor.c */
+void			 nbr_fsm_init(void);
 int			 nbr_fsm(struct nbr *, enum nbr_event);
 struct nbr		*nbr_new(struct in_addr, int, int, union ldpd_addr *,
 			    uint32_t);
@@ -248,11 +278,11 @@ struct nbr_params	*nbr_params_new(struct in_addr);
 struct nbr_params	*nbr_params_find(struct ldpd_conf *, struct in_addr);
 uint16_t		 nbr_get_keepalive(int, struct in_addr);
 struct ctl_nbr		*nbr_to_ctl(struct nbr *);
+struct ctl_nbr_connq	*nbr_connq_to_ctl(void);
 void			 nbr_clear_ctl(struct ctl_nbr *);
 
 /* packet.c */
 int			 gen_ldp_hdr(struct ibuf *, uint16_t);
-int			 gen_msg_hdr(struct ibuf *, uint16_t, uint16_t);
 int			 send_packet(int, int, union ldpd_addr *,
 			    struct iface_af *, void *, size_t);
 void			 disc_recv_packet(int, short, void *);
@@ -261,9 +291,14 @@ void			 session_accept_nbr(struct nbr *, int);
 void			 session_shutdown(struct nbr *, uint32_t, uint32_t,
 			    uint32_t);
 void			 session_close(struct nbr *);
+void			 session_enqueue(struct tcp_conn *, struct ibuf *,
+			    uint16_t, unsigned int);
 struct tcp_conn		*tcp_new(int, struct nbr *);
+void			 pending_conn_adopt(struct pending_conn *,
+			    struct nbr *);
 void			 pending_conn_del(struct pending_conn *);
 struct pending_conn	*pending_conn_find(int, union ldpd_addr *);
+struct ctl_pending_conn	*pending_conn_to_ctl(void);
 
 char	*pkt_ptr;	/* packet buffer */
 
@@ -0,0 +1,1030 @@
+/*	$OpenBSD$ */
+
+/*
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * LDP load generator. A number of peers is emulated over loopback against
+ * a running ldpd, each from its own address: targeted hellos, the session
+ * (the peers have the higher transport addresses, so they connect), an
+ * address message and then a label mapping for every FEC, at a bounded
+ * rate, followed by a withdraw for each.
+ *
+ * The messages are built with the encoders of the ldpe (see codec.c),
+ * so that what the peers send is what ldpd itself would send.
+ *
+ * How far ldpd got is read from its convergence statistics (see stats.c)
+ * through the control socket: the mappings counted by the lde tell how
+ * fast they were ingested and the LSPs counted by the parent when every
+ * FEC reached the FIB, normally the in-memory backend preloaded with the
+ * same FECs (-M latency,errors,fecs:peers).
+ */
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netmpls/mpls.h>
+#include <arpa/inet.h>
+#include <err.h>
+#include <errno.h>
+#include <event.h>
+#include <imsg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ldpd.h"
+#include "ldpe.h"
+#include "log.h"
+
+/* keep in sync with kroute_mock.c */
+#define LG_PEER_BASE		0x7f000101	/* 127.0.1.1 */
+#define LG_FEC_BASE		0x0a000000	/* 10.0.0.0 */
+#define LG_MAX_PEERS		1000
+#define LG_MAX_FECS		(1 << 24)
+
+#define LG_HOLDTIME		45	/* targeted hello holdtime */
+#define LG_HELLO_INTERVAL	5
+#define LG_KEEPALIVE		180	/* proposed in the init message */
+#define LG_KEEPALIVE_INTERVAL	10
+#define LG_SESSION_TIMEOUT	60	/* secs for every session to come up */
+#define LG_IDLE_TIMEOUT		10	/* secs without progress in a phase */
+#define LG_TICK_MSECS		10	/* label messages are sent every tick */
+#define LG_STATS_MSECS		100	/* ldpd counters are read every tick */
+#define LG_MAX_QUEUED		32	/* pdus queued per peer */
+#define LG_MAX_RATE		1000000
+
+/* a /32 prefix FEC element: type, family, prefix length and 4 bytes */
+#define LG_FEC_ELM_SIZE		(FEC_ELM_PREFIX_MIN_LEN + 4)
+
+/* labels wrap around beyond a million FECs, ldpd doesn't care */
+#define LG_LABEL(fec)							\
+	(MPLS_LABEL_RESERVED_MAX + 1 +					\
+	    (fec) % (MPLS_LABEL_MAX - MPLS_LABEL_RESERVED_MAX))
+
+enum lg_state {
+	LG_HELLO,
+	LG_CONNECTING,
+	LG_INITSENT,
+	LG_OPER,
+	LG_FAILED
+};
+
+enum lg_phase {
+	LG_PHASE_BASELINE,	/* reading the counters before the run */
+	LG_PHASE_MAPPING,
+	LG_PHASE_WITHDRAW,
+	LG_PHASE_DONE
+};
+
+struct lg_peer {
+	unsigned int		 id;
+	struct in_addr		 addr;
+	enum lg_state		 state;
+	int			 udp_fd;
+	int			 fd;
+	struct event		 ev_connect;
+	struct event		 ev_read;
+	struct event		 ev_write;
+	struct msgbuf		 wbuf;
+	struct ibuf_read	*rbuf;
+	int			 init_rcvd;
+	time_t			 hello_last;
+	time_t			 ka_last;
+	uint64_t		 t_connect;
+	uint64_t		 t_up;
+	uint32_t		 credit;	/* messages, in thousandths */
+	uint32_t		 next;		/* next FEC of the phase */
+	uint64_t		 released;
+};
+
+static __dead void usage(void);
+static void	 lg_start(void);
+static void	 lg_timer(int, short, void *);
+static void	 lg_tick(int, short, void *);
+static void	 lg_send_hello(struct lg_peer *);
+static void	 lg_connect(struct lg_peer *);
+static void	 lg_connect_cb(int, short, void *);
+static void	 lg_session_start(struct lg_peer *);
+static void	 lg_peer_fail(struct lg_peer *, const char *);
+static void	 lg_read(int, short, void *);
+static void	 lg_write(int, short, void *);
+static void	 lg_enqueue(struct lg_peer *, struct ibuf *);
+static int	 lg_recv_msg(struct lg_peer *, uint16_t, char *, uint16_t);
+static struct ibuf *lg_pdu_open(struct lg_peer *, uint16_t, uint16_t);
+static void	 lg_send_init(struct lg_peer *);
+static void	 lg_send_keepalive(struct lg_peer *);
+static void	 lg_send_address(struct lg_peer *);
+static uint32_t	 lg_send_labels(struct lg_peer *, uint16_t, uint32_t);
+static uint32_t	 lg_peer_fecs(struct lg_peer *);
+static void	 lg_ctl_query(int, short, void *);
+static void	 lg_ctl_read(int, short, void *);
+static void	 lg_progress(void);
+static void	 lg_next_phase(void);
+static int	 lg_report(void);
+static struct sockaddr *lg_sa(struct in_addr, uint16_t);
+static uint64_t	 lg_now(void);
+static double	 lg_secs(uint64_t, uint64_t);
+
+static struct {
+	struct lg_peer		*peers;
+	unsigned int		 npeers;
+	uint32_t		 nfecs;
+	uint32_t		 rate;		/* per peer and second */
+	struct in_addr		 target;
+	int			 verbose;
+	enum lg_phase		 phase;
+	struct event		 ev_timer;
+	struct event		 ev_tick;
+
+	struct imsgbuf		 ctl;
+	struct event		 ev_ctl;
+	struct event		 ev_query;
+	int			 ctl_proc;	/* process being queried */
+	uint64_t		 lde_count, fib_count;
+	uint64_t		 lde_base, fib_base;
+	uint64_t		 lde_last, fib_last;
+
+	uint64_t		 t_start;
+	uint64_t		 t_progress;	/* last time a counter moved */
+	uint64_t		 t_map_first, t_map_last;
+	uint64_t		 t_lde_done, t_fib_done;
+	uint64_t		 t_wdraw_first, t_wdraw_done;
+	uint64_t		 mappings_sent, withdraws_sent;
+	uint64_t		 released;
+	unsigned int		 up, failed;
+} lg;
+
+static __dead void
+usage(void)
+{
+	extern char *__progname;
+
+	fprintf(stderr, "usage: %s [-v] [-r rate] peers fecs address\n",
+	    __progname);
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sockaddr_un	 sun;
+	struct rlimit		 rl;
+	struct lg_peer		*p;
+	const char		*errstr;
+	unsigned int		 i;
+	int			 ch, fd;
+
+	while ((ch = getopt(argc, argv, "r:v")) != -1) {
+		switch (ch) {
+		case 'r':
+			lg.rate = strtonum(optarg, 0, LG_MAX_RATE, &errstr);
+			if (errstr)
+				errx(1, "rate is %s: %s", errstr, optarg);
+			break;
+		case 'v':
+			lg.verbose = 1;
+			break;
+		default:
+			usage();
+			/* NOTREACHED */
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 3)
+		usage();
+
+	lg.npeers = strtonum(argv[0], 1, LG_MAX_PEERS, &errstr);
+	if (errstr)
+		errx(1, "number of peers is %s: %s", errstr, argv[0]);
+	lg.nfecs = strtonum(argv[1], 1, LG_MAX_FECS, &errstr);
+	if (errstr)
+		errx(1, "number of fecs is %s: %s", errstr, argv[1]);
+	if (inet_pton(AF_INET, argv[2], &lg.target) != 1)
+		errx(1, "invalid address: %s", argv[2]);
+	if (ntohl(lg.target.s_addr) >= LG_PEER_BASE)
+		errx(1, "address must be lower than the peer addresses "
+		    "(127.0.1.1 and up) for the peers to open the sessions");
+
+	/* two sockets per peer */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == -1)
+		err(1, "getrlimit");
+	rl.rlim_cur = rl.rlim_max;
+	if (setrlimit(RLIMIT_NOFILE, &rl) == -1)
+		err(1, "setrlimit");
+	if (rl.rlim_cur < lg.npeers * 2 + 16)
+		errx(1, "too many peers for the file descriptor limit");
+
+	event_init();
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+		err(1, "socket");
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strlcpy(sun.sun_path, LDPD_SOCKET, sizeof(sun.sun_path));
+	if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) == -1)
+		err(1, "connect: %s", LDPD_SOCKET);
+	imsg_init(&lg.ctl, fd);
+	event_set(&lg.ev_ctl, fd, EV_READ | EV_PERSIST, lg_ctl_read, NULL);
+	event_add(&lg.ev_ctl, NULL);
+	evtimer_set(&lg.ev_query, lg_ctl_query, NULL);
+
+	if ((lg.peers = calloc(lg.npeers, sizeof(*lg.peers))) == NULL)
+		err(1, NULL);
+	for (i = 0; i < lg.npeers; i++) {
+		p = &lg.peers[i];
+		p->id = i;
+		p->addr.s_addr = htonl(LG_PEER_BASE + i);
+		p->fd = -1;
+		p->udp_fd = -1;
+		p->state = LG_HELLO;
+	}
+	evtimer_set(&lg.ev_timer, lg_timer, NULL);
+	evtimer_set(&lg.ev_tick, lg_tick, NULL);
+
+	/* read the counters left by earlier runs, then start */
+	lg.phase = LG_PHASE_BASELINE;
+	lg.ctl_proc = PROC_LDE_ENGINE;
+	lg_ctl_query(0, 0, NULL);
+
+	event_dispatch();
+
+	return (lg_report());
+}
+
+static void
+lg_start(void)
+{
+	struct lg_peer	*p;
+	struct sockaddr	*sa;
+	struct timeval	 tv;
+	unsigned int	 i;
+
+	for (i = 0; i < lg.npeers; i++) {
+		p = &lg.peers[i];
+		p->udp_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+		if (p->udp_fd == -1)
+			err(1, "socket");
+		sa = lg_sa(p->addr, 0);
+		if (bind(p->udp_fd, sa, sa->sa_len) == -1)
+			err(1, "bind %s (not configured on lo0?)",
+			    inet_ntoa(p->addr));
+	}
+
+	printf("%u peers, %u fecs each, %u mappings/s per peer\n", lg.npeers,
+	    lg.nfecs, lg.rate);
+	lg.t_start = lg.t_progress = lg_now();
+	lg.phase = LG_PHASE_MAPPING;
+	lg_timer(0, 0, NULL);
+
+	timerclear(&tv);
+	tv.tv_usec = LG_TICK_MSECS * 1000;
+	evtimer_add(&lg.ev_tick, &tv);
+}
+
+/* hellos, connections, keepalives and timeouts, once a second */
+static void
+lg_timer(int fd, short event, void *arg)
+{
+	struct lg_peer	*p;
+	struct timeval	 tv;
+	time_t		 now;
+	unsigned int	 i;
+
+	now = time(NULL);
+	for (i = 0; i < lg.npeers; i++) {
+		p = &lg.peers[i];
+		if (p->state == LG_FAILED)
+			continue;
+
+		if (now - p->hello_last >= LG_HELLO_INTERVAL) {
+			lg_send_hello(p);
+			p->hello_last = now;
+		} else if (p->state == LG_HELLO)
+			/* give ldpd a second to form the adjacency */
+			lg_connect(p);
+
+		if (p->state == LG_OPER &&
+		    now - p->ka_last >= LG_KEEPALIVE_INTERVAL) {
+			lg_send_keepalive(p);
+			p->ka_last = now;
+		}
+
+		if (p->state != LG_OPER && lg_secs(lg.t_start, lg_now()) >
+		    LG_SESSION_TIMEOUT)
+			lg_peer_fail(p, "session timeout");
+	}
+
+	timerclear(&tv);
+	tv.tv_sec = 1;
+	evtimer_add(&lg.ev_timer, &tv);
+}
+
+/* send what the rate and the queues allow of the current phase */
+static void
+lg_tick(int fd, short event, void *arg)
+{
+	struct lg_peer	*p;
+	struct timeval	 tv;
+	uint16_t	 type;
+	uint32_t	 n, sent;
+	unsigned int	 i;
+
+	if (lg.phase == LG_PHASE_MAPPING)
+		type = MSG_TYPE_LABELMAPPING;
+	else
+		type = MSG_TYPE_LABELWITHDRAW;
+
+	for (i = 0; i < lg.npeers; i++) {
+		p = &lg.peers[i];
+		if (p->state != LG_OPER || p->next == lg.nfecs)
+			continue;
+
+		if (lg.rate) {
+			p->credit += lg.rate * LG_TICK_MSECS;
+			n = p->credit / 1000;
+		} else
+			n = lg.nfecs;
+
+		while (n > 0 && p->next < lg.nfecs &&
+		    p->wbuf.queued < LG_MAX_QUEUED) {
+			sent = lg_send_labels(p, type, n);
+			n -= sent;
+			if (lg.rate)
+				p->credit -= sent * 1000;
+		}
+		/* don't accumulate credit while the socket is full */
+		if (lg.rate && n > 0)
+			p->credit %= 1000;
+	}
+
+	timerclear(&tv);
+	tv.tv_usec = LG_TICK_MSECS * 1000;
+	evtimer_add(&lg.ev_tick, &tv);
+}
+
+static void
+lg_send_hello(struct lg_peer *p)
+{
+	struct ibuf	*buf;
+	struct sockaddr	*sa;
+
+	buf = lg_pdu_open(p, MSG_TYPE_HELLO, sizeof(struct hello_prms_tlv) +
+	    sizeof(struct hello_prms_opt4_tlv));
+	if (gen_hello_prms_tlv(buf, LG_HOLDTIME,
+	    F_HELLO_TARGETED | F_HELLO_REQ_TARG) == -1 ||
+	    gen_opt4_hello_prms_tlv(buf, TLV_TYPE_IPV4TRANSADDR,
+	    p->addr.s_addr) == -1)
+		err(1, "%s", __func__);
+
+	sa = lg_sa(lg.target, LDP_PORT);
+	if (sendto(p->udp_fd, buf->buf, buf->wpos, 0, sa, sa->sa_len) == -1 &&
+	    lg.verbose)
+		warn("peer %s: hello", inet_ntoa(p->addr));
+	ibuf_free(buf);
+}
+
+static void
+lg_connect(struct lg_peer *p)
+{
+	struct sockaddr	*sa;
+
+	p->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (p->fd == -1) {
+		lg_peer_fail(p, strerror(errno));
+		return;
+	}
+
+	sa = lg_sa(p->addr, 0);
+	if (bind(p->fd, sa, sa->sa_len) == -1) {
+		close(p->fd);
+		p->fd = -1;
+		lg_peer_fail(p, strerror(errno));
+		return;
+	}
+
+	p->t_connect = lg_now();
+	p->state = LG_CONNECTING;
+	sa = lg_sa(lg.target, LDP_PORT);
+	if (connect(p->fd, sa, sa->sa_len) == -1) {
+		if (errno == EINPROGRESS) {
+			event_set(&p->ev_connect, p->fd, EV_WRITE,
+			    lg_connect_cb, p);
+			event_add(&p->ev_connect, NULL);
+			return;
+		}
+		if (lg.verbose)
+			warn("peer %s: connect", inet_ntoa(p->addr));
+		close(p->fd);
+		p->fd = -1;
+		p->state = LG_HELLO;
+		return;
+	}
+
+	lg_session_start(p);
+}
+
+static void
+lg_connect_cb(int fd, short event, void *arg)
+{
+	struct lg_peer	*p = arg;
+	int		 error;
+	socklen_t	 len;
+
+	len = sizeof(error);
+	if (getsockopt(p->fd, SOL_SOCKET, SO_ERROR, &error, &len) == -1) {
+		lg_peer_fail(p, strerror(errno));
+		return;
+	}
+
+	/* ldpd may not have seen a hello yet, try again later */
+	if (error) {
+		if (lg.verbose)
+			warnx("peer %s: connect: %s", inet_ntoa(p->addr),
+			    strerror(error));
+		close(p->fd);
+		p->fd = -1;
+		p->state = LG_HELLO;
+		return;
+	}
+
+	lg_session_start(p);
+}
+
+static void
+lg_session_start(struct lg_peer *p)
+{
+	if ((p->rbuf = calloc(1, sizeof(*p->rbuf))) == NULL)
+		err(1, NULL);
+	msgbuf_init(&p->wbuf);
+	p->wbuf.fd = p->fd;
+	event_set(&p->ev_write, p->fd, EV_WRITE, lg_write, p);
+	event_set(&p->ev_read, p->fd, EV_READ | EV_PERSIST, lg_read, p);
+	event_add(&p->ev_read, NULL);
+
+	lg_send_init(p);
+	p->state = LG_INITSENT;
+}
+
+/* a failed peer is not retried, its share is left out of the targets */
+static void
+lg_peer_fail(struct lg_peer *p, const char *why)
+{
+	warnx("peer %s: %s", inet_ntoa(p->addr), why);
+
+	switch (p->state) {
+	case LG_CONNECTING:
+		event_del(&p->ev_connect);
+		break;
+	case LG_INITSENT:
+	case LG_OPER:
+		event_del(&p->ev_read);
+		event_del(&p->ev_write);
+		msgbuf_clear(&p->wbuf);
+		free(p->rbuf);
+		p->rbuf = NULL;
+		break;
+	default:
+		break;
+	}
+	if (p->fd != -1) {
+		close(p->fd);
+		p->fd = -1;
+	}
+
+	if (p->state == LG_OPER)
+		lg.up--;
+	p->state = LG_FAILED;
+	lg.failed++;
+}
+
+static void
+lg_read(int fd, short event, void *arg)
+{
+	struct lg_peer	*p = arg;
+	struct ldp_hdr	*ldp_hdr;
+	struct ldp_msg	*msg;
+	char		*buf, *pdu;
+	ssize_t		 n, len;
+	uint16_t	 pdu_len, msg_size;
+
+	if ((n = read(fd, p->rbuf->buf + p->rbuf->wpos,
+	    sizeof(p->rbuf->buf) - p->rbuf->wpos)) == -1) {
+		if (errno != EINTR && errno != EAGAIN)
+			lg_peer_fail(p, strerror(errno));
+		return;
+	}
+	if (n == 0) {
+		lg_peer_fail(p, "connection closed by ldpd");
+		return;
+	}
+	p->rbuf->wpos += n;
+
+	while ((len = session_get_pdu(p->rbuf, &buf)) > 0) {
+		pdu = buf;
+		ldp_hdr = (struct ldp_hdr *)pdu;
+		pdu_len = ntohs(ldp_hdr->length) + LDP_HDR_DEAD_LEN;
+		if (ntohs(ldp_hdr->version) != LDP_VERSION ||
+		    pdu_len < LDP_HDR_SIZE) {
+			free(buf);
+			lg_peer_fail(p, "bad pdu");
+			return;
+		}
+
+		pdu += LDP_HDR_SIZE;
+		len -= LDP_HDR_SIZE;
+		while (len >= LDP_MSG_SIZE) {
+			msg = (struct ldp_msg *)pdu;
+			msg_size = ntohs(msg->length) + LDP_MSG_DEAD_LEN;
+			if (msg_size < LDP_MSG_SIZE || msg_size > len) {
+				free(buf);
+				lg_peer_fail(p, "bad message length");
+				return;
+			}
+			if (lg_recv_msg(p, ntohs(msg->type) & ~UNKNOWN_FLAG,
+			    pdu, msg_size) == -1) {
+				free(buf);
+				return;
+			}
+			pdu += msg_size;
+			len -= msg_size;
+		}
+		free(buf);
+	}
+	if (len == -1)
+		err(1, "%s", __func__);
+}
+
+static void
+lg_write(int fd, short event, void *arg)
+{
+	struct lg_peer	*p = arg;
+
+	if (msgbuf_write(&p->wbuf) <= 0 && errno != EAGAIN) {
+		lg_peer_fail(p, "write error");
+		return;
+	}
+
+	if (p->wbuf.queued)
+		event_add(&p->ev_write, NULL);
+}
+
+static void
+lg_enqueue(struct lg_peer *p, struct ibuf *buf)
+{
+	ibuf_close(&p->wbuf, buf);
+	event_add(&p->ev_write, NULL);
+}
+
+static int
+lg_recv_msg(struct lg_peer *p, uint16_t type, char *buf, uint16_t len)
+{
+	struct status_tlv	 st;
+
+	switch (type) {
+	case MSG_TYPE_NOTIFICATION:
+		if (len < LDP_MSG_SIZE + STATUS_SIZE)
+			break;
+		memcpy(&st, buf + LDP_MSG_SIZE, sizeof(st));
+		if (!(ntohl(st.status_code) & STATUS_FATAL)) {
+			if (lg.verbose)
+				warnx("peer %s: notification 0x%08x",
+				    inet_ntoa(p->addr),
+				    ntohl(st.status_code));
+			break;
+		}
+		lg_peer_fail(p, "fatal notification");
+		return (-1);
+	case MSG_TYPE_INIT:
+		if (p->state != LG_INITSENT)
+			break;
+		p->init_rcvd = 1;
+		lg_send_keepalive(p);
+		p->ka_last = time(NULL);
+		break;
+	case MSG_TYPE_KEEPALIVE:
+		if (p->state != LG_INITSENT || !p->init_rcvd)
+			break;
+		p->t_up = lg_now();
+		p->state = LG_OPER;
+		lg.up++;
+		lg_send_address(p);
+		break;
+	case MSG_TYPE_LABELRELEASE:
+		p->released++;
+		lg.released++;
+		lg.t_progress = lg_now();
+		break;
+	default:
+		/* the mappings of ldpd itself are of no interest */
+		break;
+	}
+
+	return (0);
+}
+
+/* a pdu of the peer holding a single message with room for len bytes */
+static struct ibuf *
+lg_pdu_open(struct lg_peer *p, uint16_t type, uint16_t len)
+{
+	struct ibuf	*buf;
+	uint16_t	 size;
+
+	size = LDP_HDR_SIZE + LDP_MSG_SIZE + len;
+	if ((buf = ibuf_open(size)) == NULL)
+		err(1, "%s", __func__);
+
+	if (gen_pdu_hdr(buf, size, p->addr) == -1 ||
+	    gen_msg_hdr(buf, type, size - LDP_HDR_SIZE) == -1)
+		err(1, "%s", __func__);
+
+	return (buf);
+}
+
+static void
+lg_send_init(struct lg_peer *p)
+{
+	struct ibuf	*buf;
+
+	buf = lg_pdu_open(p, MSG_TYPE_INIT, SESS_PRMS_SIZE);
+
+	/* the session parameters name the ldpd end of the session */
+	if (gen_init_prms_tlv(buf, LG_KEEPALIVE, lg.target) == -1)
+		err(1, "%s", __func__);
+
+	lg_enqueue(p, buf);
+}
+
+static void
+lg_send_keepalive(struct lg_peer *p)
+{
+	lg_enqueue(p, lg_pdu_open(p, MSG_TYPE_KEEPALIVE, 0));
+}
+
+/* the peer address resolves the nexthop of its share of the FECs */
+static void
+lg_send_address(struct lg_peer *p)
+{
+	struct if_addr_head	 addr_list;
+	struct if_addr		 if_addr;
+	struct ibuf		*buf;
+	uint16_t		 size;
+
+	memset(&if_addr, 0, sizeof(if_addr));
+	if_addr.af = AF_INET;
+	if_addr.addr.v4 = p->addr;
+	LIST_INIT(&addr_list);
+	LIST_INSERT_HEAD(&addr_list, &if_addr, entry);
+
+	size = ADDR_LIST_SIZE + sizeof(struct in_addr);
+	buf = lg_pdu_open(p, MSG_TYPE_ADDR, size);
+	if (gen_address_list_tlv(buf, size, AF_INET, &addr_list, 1) == -1)
+		err(1, "%s", __func__);
+
+	lg_enqueue(p, buf);
+}
+
+/* queue one pdu with up to max label messages, returns how many */
+static uint32_t
+lg_send_labels(struct lg_peer *p, uint16_t type, uint32_t max)
+{
+	struct ibuf	*buf;
+	struct ldp_hdr	*ldp_hdr;
+	struct map	 map;
+	uint32_t	 count = 0;
+	uint16_t	 msg_size, size;
+	int		 error = 0;
+
+	if ((buf = ibuf_open(LDP_MAX_LEN + LDP_HDR_DEAD_LEN)) == NULL)
+		err(1, "%s", __func__);
+
+	/* real size will be set up later */
+	if (gen_pdu_hdr(buf, 0, p->addr) == -1)
+		err(1, "%s", __func__);
+	size = LDP_HDR_PDU_LEN;
+
+	msg_size = LDP_MSG_SIZE + TLV_HDR_SIZE + LG_FEC_ELM_SIZE;
+	if (type == MSG_TYPE_LABELMAPPING)
+		msg_size += LABEL_TLV_SIZE;
+
+	memset(&map, 0, sizeof(map));
+	map.type = MAP_TYPE_PREFIX;
+	map.fec.prefix.af = AF_INET;
+	map.fec.prefix.prefixlen = 32;
+
+	while (count < max && p->next < lg.nfecs &&
+	    size + msg_size <= LDP_MAX_LEN) {
+		map.fec.prefix.prefix.v4.s_addr = htonl(LG_FEC_BASE + p->next);
+
+		error |= gen_msg_hdr(buf, type, msg_size);
+		error |= gen_fec_tlv(buf, &map);
+		if (type == MSG_TYPE_LABELMAPPING)
+			error |= gen_label_tlv(buf, LG_LABEL(p->next));
+		size += msg_size;
+		p->next++;
+		count++;
+	}
+	if (error)
+		err(1, "%s", __func__);
+
+	ldp_hdr = ibuf_seek(buf, 0, sizeof(struct ldp_hdr));
+	ldp_hdr->length = htons(size);
+	lg_enqueue(p, buf);
+
+	if (type == MSG_TYPE_LABELMAPPING) {
+		if (lg.mappings_sent == 0)
+			lg.t_map_first = lg_now();
+		lg.mappings_sent += count;
+		lg.t_map_last = lg_now();
+	} else {
+		if (lg.withdraws_sent == 0)
+			lg.t_wdraw_first = lg_now();
+		lg.withdraws_sent += count;
+	}
+
+	return (count);
+}
+
+/* how many FECs have their route through the peer, see kroute_mock.c */
+static uint32_t
+lg_peer_fecs(struct lg_peer *p)
+{
+	return (lg.nfecs / lg.npeers + (p->id < lg.nfecs % lg.npeers));
+}
+
+/* ask the lde, then the parent, for their convergence counters */
+static void
+lg_ctl_query(int fd, short event, void *arg)
+{
+	int	 proc = lg.ctl_proc;
+
+	if (proc == PROC_LDE_ENGINE)
+		lg.lde_count = 0;
+	else
+		lg.fib_count = 0;
+
+	imsg_compose(&lg.ctl, IMSG_CTL_SHOW_STATS, 0, 0, -1, &proc,
+	    sizeof(proc));
+	if (imsg_flush(&lg.ctl) == -1)
+		err(1, "control socket");
+}
+
+static void
+lg_ctl_read(int fd, short event, void *arg)
+{
+	struct imsg		 imsg;
+	struct ctl_stats	 sctl;
+	struct timeval		 tv;
+	ssize_t			 n;
+
+	if ((n = imsg_read(&lg.ctl)) == -1 && errno != EAGAIN)
+		err(1, "control socket");
+	if (n == 0)
+		errx(1, "control socket closed by ldpd");
+
+	for (;;) {
+		if ((n = imsg_get(&lg.ctl, &imsg)) == -1)
+			err(1, "control socket");
+		if (n == 0)
+			break;
+
+		switch (imsg.hdr.type) {
+		case IMSG_CTL_SHOW_STATS:
+			if (imsg.hdr.len != IMSG_HEADER_SIZE + sizeof(sctl))
+				errx(1, "%s: wrong imsg len", __func__);
+			memcpy(&sctl, imsg.data, sizeof(sctl));
+			if (lg.ctl_proc == PROC_LDE_ENGINE &&
+			    sctl.stage == STATS_MAPPING_LDE)
+				lg.lde_count = sctl.count;
+			else if (lg.ctl_proc == PROC_MAIN &&
+			    sctl.stage == STATS_MAPPING_FIB)
+				lg.fib_count = sctl.count;
+			break;
+		case IMSG_CTL_END:
+			if (lg.ctl_proc == PROC_LDE_ENGINE) {
+				lg.ctl_proc = PROC_MAIN;
+				lg_ctl_query(0, 0, NULL);
+				break;
+			}
+
+			lg.ctl_proc = PROC_LDE_ENGINE;
+			if (lg.phase == LG_PHASE_BASELINE) {
+				lg.lde_base = lg.lde_last = lg.lde_count;
+				lg.fib_base = lg.fib_last = lg.fib_count;
+				lg_start();
+			} else
+				lg_progress();
+
+			if (lg.phase != LG_PHASE_DONE) {
+				timerclear(&tv);
+				tv.tv_usec = LG_STATS_MSECS * 1000;
+				evtimer_add(&lg.ev_query, &tv);
+			}
+			break;
+		default:
+			break;
+		}
+		imsg_free(&imsg);
+	}
+}
+
+/* check the counters against what the peers that came up have sent */
+static void
+lg_progress(void)
+{
+	struct lg_peer	*p;
+	uint64_t	 now, lde_target = 0, fib_target = 0;
+	unsigned int	 i;
+	int		 sending = 0;
+
+	now = lg_now();
+	if (lg.lde_count != lg.lde_last || lg.fib_count != lg.fib_last) {
+		lg.lde_last = lg.lde_count;
+		lg.fib_last = lg.fib_count;
+		lg.t_progress = now;
+	}
+
+	for (i = 0; i < lg.npeers; i++) {
+		p = &lg.peers[i];
+		if (p->state == LG_FAILED)
+			continue;
+		if (p->state != LG_OPER || p->next < lg.nfecs)
+			sending = 1;
+		lde_target += lg.nfecs;
+		fib_target += lg_peer_fecs(p);
+	}
+
+	switch (lg.phase) {
+	case LG_PHASE_MAPPING:
+		if (sending)
+			break;
+		if (lg.t_lde_done == 0 &&
+		    lg.lde_count - lg.lde_base >= lde_target)
+			lg.t_lde_done = now;
+		if (lg.t_fib_done == 0 &&
+		    lg.fib_count - lg.fib_base >= fib_target)
+			lg.t_fib_done = now;
+
+		if ((lg.t_lde_done && lg.t_fib_done) ||
+		    lg_secs(lg.t_progress, now) > LG_IDLE_TIMEOUT)
+			lg_next_phase();
+		break;
+	case LG_PHASE_WITHDRAW:
+		if (sending)
+			break;
+		if (lg.released >= lde_target) {
+			lg.t_wdraw_done = now;
+			lg_next_phase();
+		} else if (lg_secs(lg.t_progress, now) > LG_IDLE_TIMEOUT)
+			lg_next_phase();
+		break;
+	default:
+		break;
+	}
+}
+
+static void
+lg_next_phase(void)
+{
+	unsigned int	 i;
+
+	switch (lg.phase) {
+	case LG_PHASE_MAPPING:
+		lg.phase = LG_PHASE_WITHDRAW;
+		lg.t_progress = lg_now();
+		for (i = 0; i < lg.npeers; i++) {
+			lg.peers[i].next = 0;
+			lg.peers[i].credit = 0;
+		}
+		break;
+	case LG_PHASE_WITHDRAW:
+		lg.phase = LG_PHASE_DONE;
+		event_loopexit(NULL);
+		break;
+	default:
+		break;
+	}
+}
+
+static int
+lg_report(void)
+{
+	struct lg_peer	*p;
+	uint64_t	 up, min = UINT64_MAX, max = 0, total = 0;
+	uint64_t	 ingested;
+	unsigned int	 i;
+	int		 ret = 0;
+
+	for (i = 0; i < lg.npeers; i++) {
+		p = &lg.peers[i];
+		if (p->state != LG_OPER)
+			continue;
+		up = p->t_up - p->t_connect;
+		if (up < min)
+			min = up;
+		if (up > max)
+			max = up;
+		total += up;
+	}
+
+	printf("sessions: %u of %u up", lg.up, lg.npeers);
+	if (lg.up)
+		printf(", setup min/avg/max %.3f/%.3f/%.3f ms",
+		    min / 1000000.0, total / lg.up / 1000000.0,
+		    max / 1000000.0);
+	printf("\n");
+	if (lg.up < lg.npeers)
+		ret = 1;
+
+	printf("mappings: %llu sent", (unsigned long long)lg.mappings_sent);
+	if (lg.t_map_last)
+		printf(" in %.3f s (%.0f/s)",
+		    lg_secs(lg.t_map_first, lg.t_map_last),
+		    lg.mappings_sent / lg_secs(lg.t_map_first, lg.t_map_last));
+	printf("\n");
+
+	ingested = lg.lde_last - lg.lde_base;
+	printf("lde: %llu ingested", (unsigned long long)ingested);
+	if (lg.t_lde_done)
+		printf(" in %.3f s (%.0f/s)",
+		    lg_secs(lg.t_map_first, lg.t_lde_done),
+		    ingested / lg_secs(lg.t_map_first, lg.t_lde_done));
+	else {
+		printf(", incomplete");
+		ret = 1;
+	}
+	printf("\n");
+
+	printf("fib: %llu LSPs written",
+	    (unsigned long long)(lg.fib_last - lg.fib_base));
+	if (lg.t_fib_done)
+		printf(", every FEC installed after %.3f s",
+		    lg_secs(lg.t_map_first, lg.t_fib_done));
+	else {
+		printf(", incomplete");
+		ret = 1;
+	}
+	printf("\n");
+
+	printf("withdraws: %llu sent, %llu released",
+	    (unsigned long long)lg.withdraws_sent,
+	    (unsigned long long)lg.released);
+	if (lg.t_wdraw_done)
+		printf(" in %.3f s",
+		    lg_secs(lg.t_wdraw_first, lg.t_wdraw_done));
+	else {
+		printf(", incomplete");
+		ret = 1;
+	}
+	printf("\n");
+
+	return (ret);
+}
+
+static struct sockaddr *
+lg_sa(struct in_addr addr, uint16_t port)
+{
+	static struct sockaddr_in	 sin;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_len = sizeof(sin);
+	sin.sin_family = AF_INET;
+	sin.sin_addr = addr;
+	sin.sin_port = htons(port);
+
+	return ((struct sockaddr *)&sin);
+}
+
+static uint64_t
+lg_now(void)
+{
+	struct timespec	 ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+static double
+lg_secs(uint64_t from, uint64_t to)
+{
+	if (to <= from)
+		return (0.000001);
+	return ((to - from) / 1000000000.0);
+}
@@ -34,6 +34,9 @@
 #include "lde.h"
 #include "log.h"
 
+/* the wrapper in log.h is of no use here */
+#undef log_debug
+
 static const char * const procnames[] = {
 	"parent",
 	"ldpe",
@@ -43,7 +46,7 @@ static const char * const procnames[] = {
 static void	 vlog(int, const char *, va_list);
 
 static int	 debug;
-static int	 verbose;
+int		 log_verbosity;
 
 void
 log_init(int n_debug)
@@ -61,7 +64,7 @@ log_init(int n_debug)
 void
 log_verbose(int v)
 {
-	verbose = v;
+	log_verbosity = v;
 }
 
 void
@@ -142,7 +145,7 @@ log_debug(const char *emsg, ...)
 {
 	va_list	 ap;
 
-	if (verbose & LDPD_OPT_VERBOSE) {
+	if (log_verbosity & LDPD_OPT_VERBOSE) {
 		va_start(ap, emsg);
 		vlog(LOG_DEBUG, emsg, ap);
 		va_end(ap);
@@ -588,7 +591,7 @@ static char *msgtypes[] = {
 void
 log_rtmsg(unsigned char rtm_type)
 {
-	if (!(verbose & LDPD_OPT_VERBOSE2))
+	if (!(log_verbosity & LDPD_OPT_VERBOSE2))
 		return;
 
 	if (rtm_type > 0 &&
@@ -26,6 +26,8 @@ union ldpd_addr;
 struct hello_source;
 struct fec;
 
+extern int	 log_verbosity;
+
 void		 log_init(int);
 void		 log_verbose(int);
 void		 logit(int, const char *, ...)
@@ -60,4 +62,13 @@ const char	*status_code_name(uint32_t);
 const char	*pw_type_name(uint16_t);
 void		 log_rtmsg(unsigned char);
 
+/*
+ * The arguments of log_debug() often format labels, FECs and addresses
+ * into static buffers. Test the verbosity before evaluating any of them.
+ */
+#define log_debug(...)	do {						\
+	if (log_verbosity & LDPD_OPT_VERBOSE)				\
+		log_debug(__VA_ARGS__);					\
+} while (0)
+
 #endif /* _LOG_H_ */
@@ -0,0 +1,83 @@
+/*	$OpenBSD$ */
+
+/*
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Allocation accounting. The long-lived objects of each process are
+ * counted where they are allocated and freed. Buffers queued for writing
+ * belong to libutil, so they are gauges instead: the process adds what its
+ * msgbufs hold right before reporting and the gauges are then cleared.
+ */
+
+#include <sys/types.h>
+#include <string.h>
+
+#include "ldpd.h"
+#include "log.h"
+
+static struct {
+	uint64_t	 objects;
+	uint64_t	 bytes;
+} mem_acct[MEM_TYPE_MAX];
+
+void
+mem_add(enum mem_type type, size_t size)
+{
+	mem_acct[type].objects++;
+	mem_acct[type].bytes += size;
+}
+
+void
+mem_del(enum mem_type type, size_t size)
+{
+	mem_acct[type].objects--;
+	mem_acct[type].bytes -= size;
+}
+
+void
+mem_msgbuf(enum mem_type type, struct msgbuf *msgbuf)
+{
+	struct ibuf	*buf;
+
+	TAILQ_FOREACH(buf, &msgbuf->bufs, entry)
+		mem_add(type, buf->wpos - buf->rpos);
+}
+
+/* send the counters of this process, then the closing imsg if any */
+void
+mem_ctl(pid_t pid, int end, void (*compose)(int, pid_t, void *, uint16_t))
+{
+	struct ctl_mem	 mctl;
+	int		 type;
+
+	for (type = 0; type < MEM_TYPE_MAX; type++) {
+		if (mem_acct[type].objects == 0)
+			continue;
+
+		memset(&mctl, 0, sizeof(mctl));
+		mctl.proc = ldpd_process;
+		mctl.type = type;
+		mctl.objects = mem_acct[type].objects;
+		mctl.bytes = mem_acct[type].bytes;
+		compose(IMSG_CTL_SHOW_MEMORY, pid, &mctl, sizeof(mctl));
+	}
+
+	memset(&mem_acct[MEM_IMSG_WBUF], 0, sizeof(mem_acct[MEM_IMSG_WBUF]));
+	memset(&mem_acct[MEM_SESSION_WBUF], 0,
+	    sizeof(mem_acct[MEM_SESSION_WBUF]));
+
+	if (end != IMSG_NONE)
+		compose(end, pid, NULL, 0);
+}
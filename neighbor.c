@@ -35,8 +35,8 @@
 
 static __inline int	 nbr_id_compare(struct nbr *, struct nbr *);
 static __inline int	 nbr_addr_compare(struct nbr *, struct nbr *);
-static __inline int	 nbr_pid_compare(struct nbr *, struct nbr *);
 static void		 nbr_update_peerid(struct nbr *);
+static void		 nbr_release_peerid(struct nbr *);
 static void		 nbr_ktimer(int, short, void *);
 static void		 nbr_start_ktimer(struct nbr *);
 static void		 nbr_ktimeout(int, short, void *);
@@ -46,10 +46,23 @@ static void		 nbr_start_itimeout(struct nbr *);
 static void		 nbr_idtimer(int, short, void *);
 static int		 nbr_act_session_operational(struct nbr *);
 static void		 nbr_send_labelmappings(struct nbr *);
+static int		 nbr_connect(struct nbr *);
+static void		 nbr_connect_cb(int, short, void *);
+static int		 nbr_connq_priority(struct nbr *);
+static void		 nbr_connq_dequeue(struct nbr *);
+static void		 nbr_connq_release(struct nbr *);
+static void		 nbr_connq_schedule(void);
+static void		 nbr_connq_run(int, short, void *);
+
+PROF_CALLBACK(nbr_ktimer)
+PROF_CALLBACK(nbr_ktimeout)
+PROF_CALLBACK(nbr_itimeout)
+PROF_CALLBACK(nbr_idtimer)
+PROF_CALLBACK(nbr_connect_cb)
+PROF_CALLBACK(nbr_connq_run)
 
 RB_GENERATE(nbr_id_head, nbr, id_tree, nbr_id_compare)
 RB_GENERATE(nbr_addr_head, nbr, addr_tree, nbr_addr_compare)
-RB_GENERATE(nbr_pid_head, nbr, pid_tree, nbr_pid_compare)
 
 struct {
 	int		state;
@@ -77,6 +90,15 @@ struct {
     {-1,		NBR_EVT_NOTHING,	NBR_ACT_NOTHING,	0},
 };
 
+/*
+ * Dense view of nbr_fsm_tbl indexed by [state][event], holding the index of
+ * the first matching row or -1. Built once by nbr_fsm_init(); only the rows
+ * of the single state bits are used.
+ */
+#define NBR_FSM_NSTATES		((NBR_STA_PRESENT | NBR_STA_SESSION) + 1)
+#define NBR_FSM_NEVENTS		(NBR_EVT_INIT_SENT + 1)
+static int nbr_fsm_idx[NBR_FSM_NSTATES][NBR_FSM_NEVENTS];
+
 const char * const nbr_event_names[] = {
 	"NOTHING",
 	"ADJACENCY MATCHED",
@@ -102,7 +124,33 @@ const char * const nbr_action_names[] = {
 
 struct nbr_id_head nbrs_by_id = RB_INITIALIZER(&nbrs_by_id);
 struct nbr_addr_head nbrs_by_addr = RB_INITIALIZER(&nbrs_by_addr);
-struct nbr_pid_head nbrs_by_pid = RB_INITIALIZER(&nbrs_by_pid);
+
+/* peerid slot table, see PEERID_MAKE() */
+struct peerid_slot {
+	struct nbr	*nbr;
+	uint32_t	 next_free;
+	uint16_t	 gen;
+};
+static struct peerid_slot	*peerid_slots;
+static uint32_t			 peerid_nslots;
+static uint32_t			 peerid_free;
+
+/*
+ * Session setup scheduler for the active role: neighbors wait in one of the
+ * two queues until one of the NBR_CONNQ_MAX setup slots is available. A slot
+ * is held from connect() until the session is operational or torn down.
+ */
+static TAILQ_HEAD(, nbr)	 nbr_connq_prio =
+				    TAILQ_HEAD_INITIALIZER(nbr_connq_prio);
+static TAILQ_HEAD(, nbr)	 nbr_connq =
+				    TAILQ_HEAD_INITIALIZER(nbr_connq);
+static struct event		 nbr_connq_ev;
+static struct {
+	uint32_t	active;
+	uint32_t	queued_prio;
+	uint32_t	queued;
+	uint64_t	admitted;
+} nbr_connq_stats;
 
 static __inline int
 nbr_id_compare(struct nbr *a, struct nbr *b)
@@ -121,10 +169,31 @@ nbr_addr_compare(struct nbr *a, struct nbr *b)
 	return (ldp_addrcmp(a->af, &a->raddr, &b->raddr));
 }
 
-static __inline int
-nbr_pid_compare(struct nbr *a, struct nbr *b)
+void
+nbr_fsm_init(void)
 {
-	return (a->peerid - b->peerid);
+	unsigned int	 e;
+	int		 s, i, n;
+
+	for (s = 0; s < NBR_FSM_NSTATES; s++)
+		for (e = 0; e < NBR_FSM_NEVENTS; e++)
+			nbr_fsm_idx[s][e] = -1;
+
+	for (n = 0; nbr_fsm_tbl[n].state != -1; n++) {
+		if (nbr_fsm_tbl[n].state == 0 ||
+		    (nbr_fsm_tbl[n].state & ~(NBR_FSM_NSTATES - 1)))
+			fatalx("nbr_fsm_init: invalid state mask");
+		if (nbr_fsm_tbl[n].new_state & (nbr_fsm_tbl[n].new_state - 1))
+			fatalx("nbr_fsm_init: invalid new state");
+		if (nbr_fsm_tbl[n].event >= NBR_FSM_NEVENTS)
+			fatalx("nbr_fsm_init: invalid event");
+	}
+
+	/* walk the table backwards so that the first matching row wins */
+	for (i = n - 1; i >= 0; i--)
+		for (s = 1; s < NBR_FSM_NSTATES; s <<= 1)
+			if (nbr_fsm_tbl[i].state & s)
+				nbr_fsm_idx[s][nbr_fsm_tbl[i].event] = i;
 }
 
 int
@@ -132,29 +201,26 @@ nbr_fsm(struct nbr *nbr, enum nbr_event event)
 {
 	struct timeval	now;
 	int		old_state;
-	int		new_state = 0;
+	int		new_state;
 	int		i;
 
 	old_state = nbr->state;
-	for (i = 0; nbr_fsm_tbl[i].state != -1; i++)
-		if ((nbr_fsm_tbl[i].state & old_state) &&
-		    (nbr_fsm_tbl[i].event == event)) {
-			new_state = nbr_fsm_tbl[i].new_state;
-			break;
-		}
-
-	if (nbr_fsm_tbl[i].state == -1) {
+	i = nbr_fsm_idx[old_state][event];
+	if (i == -1) {
 		/* event outside of the defined fsm, ignore it. */
 		log_warnx("%s: lsr-id %s, event %s not expected in "
 		    "state %s", __func__, inet_ntoa(nbr->id),
 		    nbr_event_names[event], nbr_state_name(old_state));
 		return (0);
 	}
+	new_state = nbr_fsm_tbl[i].new_state;
 
 	if (new_state != 0)
 		nbr->state = new_state;
 
 	if (old_state != nbr->state) {
+		trace(TRACE_NBR_FSM, event, nbr->id.s_addr, old_state,
+		    nbr->state);
 		log_debug("%s: event %s resulted in action %s and "
 		    "changing state for lsr-id %s from %s to %s",
 		    __func__, nbr_event_names[event],
@@ -166,6 +232,11 @@ nbr_fsm(struct nbr *nbr, enum nbr_event event)
 			gettimeofday(&now, NULL);
 			nbr->uptime = now.tv_sec;
 		}
+
+		/* session setup is over, free the connection slot */
+		if (nbr->state == NBR_STA_OPER ||
+		    nbr->state == NBR_STA_PRESENT)
+			nbr_connq_release(nbr);
 	}
 
 	if (nbr->state == NBR_STA_OPER || nbr->state == NBR_STA_PRESENT)
@@ -232,6 +303,7 @@ nbr_new(struct in_addr id, int af, int ds_tlv, union ldpd_addr *addr,
 
 	if ((nbr = calloc(1, sizeof(*nbr))) == NULL)
 		fatal(__func__);
+	mem_add(MEM_NBR, sizeof(*nbr));
 
 	LIST_INIT(&nbr->adj_list);
 	nbr->state = NBR_STA_PRESENT;
@@ -267,20 +339,18 @@ nbr_new(struct in_addr id, int af, int ds_tlv, union ldpd_addr *addr,
 	TAILQ_INIT(&nbr->abortreq_list);
 
 	/* set event structures */
-	evtimer_set(&nbr->keepalive_timeout, nbr_ktimeout, nbr);
-	evtimer_set(&nbr->keepalive_timer, nbr_ktimer, nbr);
-	evtimer_set(&nbr->init_timeout, nbr_itimeout, nbr);
-	evtimer_set(&nbr->initdelay_timer, nbr_idtimer, nbr);
+	evtimer_set(&nbr->keepalive_timeout, PROF(nbr_ktimeout), nbr);
+	evtimer_set(&nbr->keepalive_timer, PROF(nbr_ktimer), nbr);
+	evtimer_set(&nbr->init_timeout, PROF(nbr_itimeout), nbr);
+	evtimer_set(&nbr->initdelay_timer, PROF(nbr_idtimer), nbr);
 
 	nbrp = nbr_params_find(leconf, nbr->id);
 	if (nbrp && pfkey_establish(nbr, nbrp) == -1)
 		fatalx("pfkey setup failed");
 
 	pconn = pending_conn_find(nbr->af, &nbr->raddr);
-	if (pconn) {
-		session_accept_nbr(nbr, pconn->fd);
-		pending_conn_del(pconn);
-	}
+	if (pconn)
+		pending_conn_adopt(pconn, nbr);
 
 	return (nbr);
 }
@@ -295,6 +365,9 @@ nbr_del(struct nbr *nbr)
 
 	if (nbr_pending_connect(nbr))
 		event_del(&nbr->ev_connect);
+	if (nbr->flags & F_NBR_CONNQ_QUEUED)
+		nbr_connq_dequeue(nbr);
+	nbr_connq_release(nbr);
 	nbr_stop_ktimer(nbr);
 	nbr_stop_ktimeout(nbr);
 	nbr_stop_itimeout(nbr);
@@ -306,29 +379,70 @@ nbr_del(struct nbr *nbr)
 	mapping_list_clr(&nbr->release_list);
 	mapping_list_clr(&nbr->abortreq_list);
 
-	if (nbr->peerid)
-		RB_REMOVE(nbr_pid_head, &nbrs_by_pid, nbr);
+	nbr_release_peerid(nbr);
 	RB_REMOVE(nbr_id_head, &nbrs_by_id, nbr);
 	RB_REMOVE(nbr_addr_head, &nbrs_by_addr, nbr);
 
+	mem_del(MEM_NBR, sizeof(*nbr));
 	free(nbr);
 }
 
 static void
 nbr_update_peerid(struct nbr *nbr)
 {
-	static uint32_t	 peercnt = 1;
+	struct peerid_slot	*ps;
+	uint32_t		 slot, nslots, i;
+
+	nbr_release_peerid(nbr);
+
+	/* grow the slot table when the free list is empty */
+	if (peerid_free == 0) {
+		nslots = peerid_nslots ? peerid_nslots * 2 : 64;
+		if (nslots > PEERID_SLOT_MAX + 1)
+			nslots = PEERID_SLOT_MAX + 1;
+		if (nslots <= peerid_nslots)
+			fatalx("nbr_update_peerid: out of peerids");
+		ps = reallocarray(peerid_slots, nslots, sizeof(*ps));
+		if (ps == NULL)
+			fatal(__func__);
+		memset(ps + peerid_nslots, 0,
+		    (nslots - peerid_nslots) * sizeof(*ps));
+		/* slot 0 is reserved */
+		for (i = nslots - 1; i > 0 && i >= peerid_nslots; i--) {
+			ps[i].next_free = peerid_free;
+			peerid_free = i;
+		}
+		peerid_slots = ps;
+		peerid_nslots = nslots;
+	}
 
-	if (nbr->peerid)
-		RB_REMOVE(nbr_pid_head, &nbrs_by_pid, nbr);
+	slot = peerid_free;
+	ps = &peerid_slots[slot];
+	peerid_free = ps->next_free;
+	ps->next_free = 0;
+	ps->nbr = nbr;
+
+	/*
+	 * Bump the generation so that imsgs still in flight for a previous
+	 * user of this slot can't be matched against the new neighbor.
+	 */
+	ps->gen++;
+	nbr->peerid = PEERID_MAKE(ps->gen, slot);
+}
+
+static void
+nbr_release_peerid(struct nbr *nbr)
+{
+	struct peerid_slot	*ps;
 
-	/* get next unused peerid */
-	while (nbr_find_peerid(++peercnt))
-		;
-	nbr->peerid = peercnt;
+	if (nbr->peerid == 0)
+		return;
 
-	if (RB_INSERT(nbr_pid_head, &nbrs_by_pid, nbr) != NULL)
-		fatalx("nbr_update_peerid: RB_INSERT(nbrs_by_pid) failed");
+	ps = &peerid_slots[PEERID_SLOT(nbr->peerid)];
+	ps->nbr = NULL;
+	ps->next_free = peerid_free;
+	peerid_free = PEERID_SLOT(nbr->peerid);
+	nbr->peerid = 0;
 }
 
 struct nbr *
@@ -351,9 +465,18 @@ nbr_find_addr(int af, union ldpd_addr *addr)
 struct nbr *
 nbr_find_peerid(uint32_t peerid)
 {
-	struct nbr	n;
-	n.peerid = peerid;
-	return (RB_FIND(nbr_pid_head, &nbrs_by_pid, &n));
+	struct nbr	*nbr;
+	uint32_t	 slot;
+
+	slot = PEERID_SLOT(peerid);
+	if (slot == 0 || slot >= peerid_nslots)
+		return (NULL);
+
+	nbr = peerid_slots[slot].nbr;
+	if (nbr == NULL || nbr->peerid != peerid)
+		return (NULL);
+
+	return (nbr);
 }
 
 int
@@ -387,6 +510,7 @@ nbr_ktimer(int fd, short event, void *arg)
 {
 	struct nbr	*nbr = arg;
 
+	trace(TRACE_TIMER, TRACE_TIMER_KEEPALIVE, nbr->id.s_addr, 0, 0);
 	send_keepalive(nbr);
 	nbr_start_ktimer(nbr);
 }
@@ -418,6 +542,7 @@ nbr_ktimeout(int fd, short event, void *arg)
 {
 	struct nbr *nbr = arg;
 
+	trace(TRACE_TIMER, TRACE_TIMER_KEEPALIVE_TIMEOUT, nbr->id.s_addr, 0, 0);
 	log_debug("%s: lsr-id %s", __func__, inet_ntoa(nbr->id));
 
 	session_shutdown(nbr, S_KEEPALIVE_TMR, 0, 0);
@@ -450,6 +575,7 @@ nbr_itimeout(int fd, short event, void *arg)
 {
 	struct nbr *nbr = arg;
 
+	trace(TRACE_TIMER, TRACE_TIMER_INIT_TIMEOUT, nbr->id.s_addr, 0, 0);
 	log_debug("%s: lsr-id %s", __func__, inet_ntoa(nbr->id));
 
 	nbr_fsm(nbr, NBR_EVT_CLOSE_SESSION);
@@ -481,6 +607,7 @@ nbr_idtimer(int fd, short event, void *arg)
 {
 	struct nbr *nbr = arg;
 
+	trace(TRACE_TIMER, TRACE_TIMER_INIT_DELAY, nbr->id.s_addr, 0, 0);
 	log_debug("%s: lsr-id %s", __func__, inet_ntoa(nbr->id));
 
 	nbr_establish_connection(nbr);
@@ -548,9 +675,20 @@ nbr_connect_cb(int fd, short event, void *arg)
 	int		 error;
 	socklen_t	 len;
 
+	/* don't let an unresponsive peer hold its setup slot */
+	if (event == EV_TIMEOUT) {
+		close(nbr->fd);
+		log_debug("%s: timed out connecting to %s", __func__,
+		    log_addr(nbr->af, &nbr->raddr));
+		nbr_connq_release(nbr);
+		return;
+	}
+
 	len = sizeof(error);
 	if (getsockopt(nbr->fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0) {
 		log_warn("%s: getsockopt SOL_SOCKET SO_ERROR", __func__);
+		close(nbr->fd);
+		nbr_connq_release(nbr);
 		return;
 	}
 
@@ -559,6 +697,7 @@ nbr_connect_cb(int fd, short event, void *arg)
 		errno = error;
 		log_debug("%s: error while connecting to %s: %s", __func__,
 		    log_addr(nbr->af, &nbr->raddr), strerror(errno));
+		nbr_connq_release(nbr);
 		return;
 	}
 
@@ -567,11 +706,149 @@ nbr_connect_cb(int fd, short event, void *arg)
 
 int
 nbr_establish_connection(struct nbr *nbr)
+{
+	/* reconnect right away if we already own a setup slot */
+	if (nbr->flags & F_NBR_CONNQ_ACTIVE) {
+		if (nbr_connect(nbr) == -1) {
+			nbr_connq_release(nbr);
+			return (-1);
+		}
+		return (0);
+	}
+	if (nbr->flags & F_NBR_CONNQ_QUEUED)
+		return (0);
+
+	if (nbr_connq_priority(nbr)) {
+		TAILQ_INSERT_TAIL(&nbr_connq_prio, nbr, connq_entry);
+		nbr_connq_stats.queued_prio++;
+		nbr->flags |= F_NBR_CONNQ_PRIO;
+	} else {
+		TAILQ_INSERT_TAIL(&nbr_connq, nbr, connq_entry);
+		nbr_connq_stats.queued++;
+	}
+	nbr->flags |= F_NBR_CONNQ_QUEUED;
+	nbr_connq_schedule();
+
+	return (0);
+}
+
+/*
+ * Neighbors carrying pseudowires or reachable through a link adjacency (and
+ * thus likely IGP nexthops) are connected first.
+ */
+static int
+nbr_connq_priority(struct nbr *nbr)
+{
+	struct l2vpn		*l2vpn;
+	struct l2vpn_pw		*pw;
+	struct adj		*adj;
+
+	LIST_FOREACH(l2vpn, &leconf->l2vpn_list, entry)
+		LIST_FOREACH(pw, &l2vpn->pw_list, entry)
+			if (pw->lsr_id.s_addr == nbr->id.s_addr)
+				return (1);
+
+	LIST_FOREACH(adj, &nbr->adj_list, nbr_entry)
+		if (adj->source.type == HELLO_LINK)
+			return (1);
+
+	return (0);
+}
+
+static void
+nbr_connq_dequeue(struct nbr *nbr)
+{
+	if (nbr->flags & F_NBR_CONNQ_PRIO) {
+		TAILQ_REMOVE(&nbr_connq_prio, nbr, connq_entry);
+		nbr_connq_stats.queued_prio--;
+	} else {
+		TAILQ_REMOVE(&nbr_connq, nbr, connq_entry);
+		nbr_connq_stats.queued--;
+	}
+	nbr->flags &= ~(F_NBR_CONNQ_QUEUED | F_NBR_CONNQ_PRIO);
+}
+
+static void
+nbr_connq_release(struct nbr *nbr)
+{
+	if (!(nbr->flags & F_NBR_CONNQ_ACTIVE))
+		return;
+
+	nbr->flags &= ~F_NBR_CONNQ_ACTIVE;
+	nbr_connq_stats.active--;
+	nbr_connq_schedule();
+}
+
+/* run the scheduler from the event loop to avoid reentering the fsm */
+static void
+nbr_connq_schedule(void)
+{
+	struct timeval	 tv;
+
+	if (TAILQ_EMPTY(&nbr_connq_prio) && TAILQ_EMPTY(&nbr_connq))
+		return;
+
+	if (!event_initialized(&nbr_connq_ev))
+		evtimer_set(&nbr_connq_ev, PROF(nbr_connq_run), NULL);
+	if (evtimer_pending(&nbr_connq_ev, NULL))
+		return;
+
+	timerclear(&tv);
+	if (evtimer_add(&nbr_connq_ev, &tv) == -1)
+		fatal(__func__);
+}
+
+/* ARGSUSED */
+static void
+nbr_connq_run(int fd, short event, void *arg)
+{
+	struct nbr	*nbr;
+
+	while (nbr_connq_stats.active < NBR_CONNQ_MAX) {
+		if ((nbr = TAILQ_FIRST(&nbr_connq_prio)) == NULL &&
+		    (nbr = TAILQ_FIRST(&nbr_connq)) == NULL)
+			break;
+		nbr_connq_dequeue(nbr);
+
+		/* the neighbor might have moved on while it was queued */
+		if (nbr->state != NBR_STA_PRESENT || nbr_pending_connect(nbr))
+			continue;
+
+		nbr->flags |= F_NBR_CONNQ_ACTIVE;
+		nbr_connq_stats.active++;
+		nbr_connq_stats.admitted++;
+		if (nbr_connect(nbr) == -1)
+			nbr_connq_release(nbr);
+	}
+
+	if (nbr_connq_stats.queued_prio + nbr_connq_stats.queued > 0)
+		log_debug("%s: %u session setups in progress, %u queued",
+		    __func__, nbr_connq_stats.active,
+		    nbr_connq_stats.queued_prio + nbr_connq_stats.queued);
+}
+
+struct ctl_nbr_connq *
+nbr_connq_to_ctl(void)
+{
+	static struct ctl_nbr_connq	 cqctl;
+
+	cqctl.active = nbr_connq_stats.active;
+	cqctl.limit = NBR_CONNQ_MAX;
+	cqctl.queued_prio = nbr_connq_stats.queued_prio;
+	cqctl.queued = nbr_connq_stats.queued;
+	cqctl.admitted = nbr_connq_stats.admitted;
+
+	return (&cqctl);
+}
+
+static int
+nbr_connect(struct nbr *nbr)
 {
 	struct sockaddr_storage	 local_sa;
 	struct sockaddr_storage	 remote_sa;
 	struct adj		*adj;
 	struct nbr_params	*nbrp;
+	struct timeval		 tv;
 	int			 opt = 1;
 
 	nbr->fd = socket(nbr->af,
@@ -627,8 +904,10 @@ nbr_establish_connection(struct nbr *nbr)
 	    remote_sa.ss_len) == -1) {
 		if (errno == EINPROGRESS) {
 			event_set(&nbr->ev_connect, nbr->fd, EV_WRITE,
-			    nbr_connect_cb, nbr);
-			event_add(&nbr->ev_connect, NULL);
+			    PROF(nbr_connect_cb), nbr);
+			timerclear(&tv);
+			tv.tv_sec = NBR_CONNECT_TIMEOUT;
+			event_add(&nbr->ev_connect, &tv);
 			return (0);
 		}
 		log_warn("%s: error while connecting to %s", __func__,
@@ -800,6 +1079,8 @@ nbr_to_ctl(struct nbr *nbr)
 	nctl.laddr = nbr->laddr;
 	nctl.raddr = nbr->raddr;
 	nctl.nbr_state = nbr->state;
+	nctl.stats = nbr->stats;
+	nctl.wbuf_queued = nbr->tcp ? nbr->tcp->wbuf.wbuf.queued : 0;
 
 	gettimeofday(&now, NULL);
 	if (nbr->state == NBR_STA_OPER) {
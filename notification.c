@@ -69,7 +69,7 @@ send_notification_full(struct tcp_conn *tcp, struct notify_msg *nm)
 		    inet_ntoa(tcp->nbr->id), status_code_name(nm->status_code),
 		    (nm->status_code & STATUS_FATAL) ? " (fatal)" : "");
 
-	evbuf_enqueue(&tcp->wbuf, buf);
+	session_enqueue(tcp, buf, MSG_TYPE_NOTIFICATION, 1);
 }
 
 /* send a notification without optional tlvs */
@@ -218,22 +218,3 @@ recv_notification(struct nbr *nbr, char *buf, uint16_t len)
 	return (0);
 }
 
-int
-gen_status_tlv(struct ibuf *buf, uint32_t status_code, uint32_t msg_id,
-    uint16_t msg_type)
-{
-	struct status_tlv	st;
-
-	memset(&st, 0, sizeof(st));
-	st.type = htons(TLV_TYPE_STATUS);
-	st.length = htons(STATUS_TLV_LEN);
-	st.status_code = htonl(status_code);
-	/*
-	 * For convenience, msg_id and msg_type are already in network
-	 * byte order.
-	 */
-	st.msg_id = msg_id;
-	st.msg_type = msg_type;
-
-	return (ibuf_add(buf, &st, STATUS_SIZE));
-}
@@ -19,6 +19,7 @@
  */
 
 #include <sys/types.h>
+#include <sys/time.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
@@ -27,6 +28,7 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "ldpd.h"
 #include "ldpe.h"
@@ -36,39 +38,34 @@ static struct iface		*disc_find_iface(unsigned int, int,
 				    union ldpd_addr *, int);
 static void			 session_read(int, short, void *);
 static void			 session_write(int, short, void *);
-static ssize_t			 session_get_pdu(struct ibuf_read *, char **);
+static enum nbr_msg_stat	 session_msg_stat(uint16_t);
 static void			 tcp_close(struct tcp_conn *);
+static __inline int		 pending_conn_compare(struct pending_conn *,
+				    struct pending_conn *);
 static struct pending_conn	*pending_conn_new(int, int, union ldpd_addr *);
+static uint32_t			 pending_conn_age(struct pending_conn *);
 static void			 pending_conn_timeout(int, short, void *);
 
-int
-gen_ldp_hdr(struct ibuf *buf, uint16_t size)
-{
-	struct ldp_hdr	ldp_hdr;
+PROF_CALLBACK(session_read)
+PROF_CALLBACK(session_write)
+PROF_CALLBACK(pending_conn_timeout)
 
-	memset(&ldp_hdr, 0, sizeof(ldp_hdr));
-	ldp_hdr.version = htons(LDP_VERSION);
-	/* exclude the 'Version' and 'PDU Length' fields from the total */
-	ldp_hdr.length = htons(size - LDP_HDR_DEAD_LEN);
-	ldp_hdr.lsr_id = leconf->rtr_id.s_addr;
-	ldp_hdr.lspace_id = 0;
+RB_GENERATE(pending_conn_head, pending_conn, entry, pending_conn_compare)
 
-	return (ibuf_add(buf, &ldp_hdr, LDP_HDR_SIZE));
-}
+static struct {
+	uint32_t	count;
+	uint64_t	accepted;
+	uint64_t	adopted;
+	uint64_t	expired;
+	uint64_t	refused;
+	uint64_t	wait_total;
+	uint32_t	wait_max;
+} pconn_stats;
 
 int
-gen_msg_hdr(struct ibuf *buf, uint16_t type, uint16_t size)
+gen_ldp_hdr(struct ibuf *buf, uint16_t size)
 {
-	static int	msgcnt = 0;
-	struct ldp_msg	msg;
-
-	memset(&msg, 0, sizeof(msg));
-	msg.type = htons(type);
-	/* exclude the 'Type' and 'Length' fields from the total */
-	msg.length = htons(size - LDP_MSG_DEAD_LEN);
-	msg.id = htonl(++msgcnt);
-
-	return (ibuf_add(buf, &msg, sizeof(msg)));
+	return (gen_pdu_hdr(buf, size, leconf->rtr_id));
 }
 
 /* send packets */
@@ -320,21 +317,9 @@ session_accept(int fd, short event, void *bula)
 	if (!(event & EV_READ))
 		return;
 
-	newfd = accept4(fd, (struct sockaddr *)&src, &len,
-	    SOCK_NONBLOCK | SOCK_CLOEXEC);
-	if (newfd == -1) {
-		/*
-		 * Pause accept if we are out of file descriptors, or
-		 * libevent will haunt us here too.
-		 */
-		if (errno == ENFILE || errno == EMFILE) {
-			accept_pause();
-		} else if (errno != EWOULDBLOCK && errno != EINTR &&
-		    errno != ECONNABORTED)
-			log_debug("%s: accept error: %s", __func__,
-			    strerror(errno));
+	newfd = accept_sock(fd, (struct sockaddr *)&src, &len);
+	if (newfd == -1)
 		return;
-	}
 
 	sa2addr((struct sockaddr *)&src, &af, &addr);
 
@@ -357,9 +342,11 @@ session_accept(int fd, short event, void *bula)
 		 * taking a more drastic measure.
 		 */
 		pconn = pending_conn_find(af, &addr);
-		if (pconn)
+		if (pconn) {
+			/* only one pending connection per source */
+			pconn_stats.refused++;
 			close(newfd);
-		else
+		} else
 			pending_conn_new(newfd, af, &addr);
 		return;
 	}
@@ -477,6 +464,8 @@ session_read(int fd, short event, void *arg)
 			free(buf);
 			return;
 		}
+		nbr->stats.pdus_rcvd++;
+		nbr->stats.bytes_rcvd += len;
 		pdu += LDP_HDR_SIZE;
 		len -= LDP_HDR_SIZE;
 
@@ -497,6 +486,8 @@ session_read(int fd, short event, void *arg)
 			}
 			msg_size = msg_len + LDP_MSG_DEAD_LEN;
 			pdu_len -= msg_size;
+			nbr->stats.msgs_rcvd[session_msg_stat(type)]++;
+			trace(TRACE_MSG_IN, type, nbr->id.s_addr, msg_size, 0);
 
 			/* check for error conditions earlier */
 			switch (type) {
@@ -597,6 +588,8 @@ session_write(int fd, short event, void *arg)
 	if (!(event & EV_WRITE))
 		return;
 
+	if (nbr)
+		nbr->stats.writes++;
 	if (msgbuf_write(&tcp->wbuf.wbuf) <= 0)
 		if (errno != EAGAIN && nbr)
 			nbr_fsm(nbr, NBR_EVT_CLOSE_SESSION);
@@ -613,6 +606,52 @@ session_write(int fd, short event, void *arg)
 	evbuf_event_add(&tcp->wbuf);
 }
 
+/* queue a pdu holding count messages of the given type */
+void
+session_enqueue(struct tcp_conn *tcp, struct ibuf *buf, uint16_t type,
+    unsigned int count)
+{
+	struct nbr	*nbr = tcp->nbr;
+
+	if (nbr) {
+		nbr->stats.msgs_sent[session_msg_stat(type)] += count;
+		nbr->stats.pdus_sent++;
+		nbr->stats.bytes_sent += ibuf_size(buf);
+	}
+	trace(TRACE_MSG_OUT, type, nbr ? nbr->id.s_addr : 0, ibuf_size(buf),
+	    0);
+	evbuf_enqueue(&tcp->wbuf, buf);
+}
+
+static enum nbr_msg_stat
+session_msg_stat(uint16_t type)
+{
+	switch (type) {
+	case MSG_TYPE_NOTIFICATION:
+		return (NBR_MSG_NOTIFICATION);
+	case MSG_TYPE_INIT:
+		return (NBR_MSG_INIT);
+	case MSG_TYPE_KEEPALIVE:
+		return (NBR_MSG_KEEPALIVE);
+	case MSG_TYPE_ADDR:
+		return (NBR_MSG_ADDR);
+	case MSG_TYPE_ADDRWITHDRAW:
+		return (NBR_MSG_ADDRWITHDRAW);
+	case MSG_TYPE_LABELMAPPING:
+		return (NBR_MSG_MAPPING);
+	case MSG_TYPE_LABELREQUEST:
+		return (NBR_MSG_REQUEST);
+	case MSG_TYPE_LABELWITHDRAW:
+		return (NBR_MSG_WITHDRAW);
+	case MSG_TYPE_LABELRELEASE:
+		return (NBR_MSG_RELEASE);
+	case MSG_TYPE_LABELABORTREQ:
+		return (NBR_MSG_ABORTREQ);
+	default:
+		return (NBR_MSG_OTHER);
+	}
+}
+
 void
 session_shutdown(struct nbr *nbr, uint32_t status, uint32_t msg_id,
     uint32_t msg_type)
@@ -649,35 +688,6 @@ session_close(struct nbr *nbr)
 	nbr_stop_itimeout(nbr);
 }
 
-static ssize_t
-session_get_pdu(struct ibuf_read *r, char **b)
-{
-	struct ldp_hdr	l;
-	size_t		av, dlen, left;
-
-	av = r->wpos;
-	if (av < sizeof(l))
-		return (0);
-
-	memcpy(&l, r->buf, sizeof(l));
-	dlen = ntohs(l.length) + LDP_HDR_DEAD_LEN;
-	if (dlen > av)
-		return (0);
-
-	if ((*b = malloc(dlen)) == NULL)
-		return (-1);
-
-	memcpy(*b, r->buf, dlen);
-	if (dlen < av) {
-		left = av - dlen;
-		memmove(r->buf, r->buf + dlen, left);
-		r->wpos = left;
-	} else
-		r->wpos = 0;
-
-	return (dlen);
-}
-
 struct tcp_conn *
 tcp_new(int fd, struct nbr *nbr)
 {
@@ -685,16 +695,19 @@ tcp_new(int fd, struct nbr *nbr)
 
 	if ((tcp = calloc(1, sizeof(*tcp))) == NULL)
 		fatal(__func__);
+	mem_add(MEM_TCP_CONN, sizeof(*tcp));
 
 	tcp->fd = fd;
-	evbuf_init(&tcp->wbuf, tcp->fd, session_write, tcp);
+	evbuf_init(&tcp->wbuf, tcp->fd, PROF(session_write), tcp);
 
 	if (nbr) {
 		if ((tcp->rbuf = calloc(1, sizeof(struct ibuf_read))) == NULL)
 			fatal(__func__);
+		mem_add(MEM_SESSION_RBUF, sizeof(struct ibuf_read));
+		memset(&nbr->stats, 0, sizeof(nbr->stats));
 
 		event_set(&tcp->rev, tcp->fd, EV_READ | EV_PERSIST,
-		    session_read, nbr);
+		    PROF(session_read), nbr);
 		event_add(&tcp->rev, NULL);
 		tcp->nbr = nbr;
 	}
@@ -711,29 +724,54 @@ tcp_close(struct tcp_conn *tcp)
 
 	if (tcp->nbr) {
 		event_del(&tcp->rev);
+		mem_del(MEM_SESSION_RBUF, sizeof(struct ibuf_read));
 		free(tcp->rbuf);
 		tcp->nbr->tcp = NULL;
 	}
 
 	close(tcp->fd);
 	accept_unpause();
+	mem_del(MEM_TCP_CONN, sizeof(*tcp));
 	free(tcp);
 }
 
+static __inline int
+pending_conn_compare(struct pending_conn *a, struct pending_conn *b)
+{
+	if (a->af < b->af)
+		return (-1);
+	if (a->af > b->af)
+		return (1);
+
+	return (ldp_addrcmp(a->af, &a->addr, &b->addr));
+}
+
 static struct pending_conn *
 pending_conn_new(int fd, int af, union ldpd_addr *addr)
 {
 	struct pending_conn	*pconn;
 	struct timeval		 tv;
 
+	if (pconn_stats.count >= PENDING_CONN_MAX) {
+		log_debug("%s: too many pending connections, rejecting %s",
+		    __func__, log_addr(af, addr));
+		pconn_stats.refused++;
+		close(fd);
+		return (NULL);
+	}
+
 	if ((pconn = calloc(1, sizeof(*pconn))) == NULL)
 		fatal(__func__);
 
 	pconn->fd = fd;
 	pconn->af = af;
 	pconn->addr = *addr;
-	evtimer_set(&pconn->ev_timeout, pending_conn_timeout, pconn);
-	TAILQ_INSERT_TAIL(&global.pending_conns, pconn, entry);
+	clock_gettime(CLOCK_MONOTONIC, &pconn->since);
+	evtimer_set(&pconn->ev_timeout, PROF(pending_conn_timeout), pconn);
+	if (RB_INSERT(pending_conn_head, &global.pending_conns, pconn) != NULL)
+		fatalx("pending_conn_new: RB_INSERT failed");
+	pconn_stats.count++;
+	pconn_stats.accepted++;
 
 	timerclear(&tv);
 	tv.tv_sec = PENDING_CONN_TIMEOUT;
@@ -750,21 +788,66 @@ pending_conn_del(struct pending_conn *pconn)
 	    evtimer_del(&pconn->ev_timeout) == -1)
 		fatal(__func__);
 
-	TAILQ_REMOVE(&global.pending_conns, pconn, entry);
+	RB_REMOVE(pending_conn_head, &global.pending_conns, pconn);
+	pconn_stats.count--;
 	free(pconn);
 }
 
+void
+pending_conn_adopt(struct pending_conn *pconn, struct nbr *nbr)
+{
+	uint32_t	 wait;
+
+	wait = pending_conn_age(pconn);
+	pconn_stats.adopted++;
+	pconn_stats.wait_total += wait;
+	if (wait > pconn_stats.wait_max)
+		pconn_stats.wait_max = wait;
+
+	session_accept_nbr(nbr, pconn->fd);
+	pending_conn_del(pconn);
+}
+
 struct pending_conn *
 pending_conn_find(int af, union ldpd_addr *addr)
 {
-	struct pending_conn	*pconn;
+	struct pending_conn	 pconn;
+
+	pconn.af = af;
+	pconn.addr = *addr;
+	return (RB_FIND(pending_conn_head, &global.pending_conns, &pconn));
+}
+
+/* milliseconds since the connection was accepted */
+static uint32_t
+pending_conn_age(struct pending_conn *pconn)
+{
+	struct timespec	 now, diff;
 
-	TAILQ_FOREACH(pconn, &global.pending_conns, entry)
-		if (af == pconn->af &&
-		    ldp_addrcmp(af, addr, &pconn->addr) == 0)
-			return (pconn);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	timespecsub(&now, &pconn->since, &diff);
 
-	return (NULL);
+	return (diff.tv_sec * 1000 + diff.tv_nsec / 1000000);
+}
+
+struct ctl_pending_conn *
+pending_conn_to_ctl(void)
+{
+	static struct ctl_pending_conn	 pctl;
+
+	pctl.count = pconn_stats.count;
+	pctl.limit = PENDING_CONN_MAX;
+	pctl.accepted = pconn_stats.accepted;
+	pctl.adopted = pconn_stats.adopted;
+	pctl.expired = pconn_stats.expired;
+	pctl.refused = pconn_stats.refused;
+	if (pconn_stats.adopted > 0)
+		pctl.wait_avg = pconn_stats.wait_total / pconn_stats.adopted;
+	else
+		pctl.wait_avg = 0;
+	pctl.wait_max = pconn_stats.wait_max;
+
+	return (&pctl);
 }
 
 static void
@@ -784,5 +867,6 @@ pending_conn_timeout(int fd, short event, void *arg)
 	send_notification(S_NO_HELLO, tcp, 0, 0);
 	msgbuf_write(&tcp->wbuf.wbuf);
 
+	pconn_stats.expired++;
 	pending_conn_del(pconn);
 }
@@ -99,10 +99,13 @@ static struct nbr_params *conf_get_nbrp(struct in_addr);
 static struct l2vpn	*conf_get_l2vpn(char *);
 static struct l2vpn_if	*conf_get_l2vpn_if(struct l2vpn *, struct kif *);
 static struct l2vpn_pw	*conf_get_l2vpn_pw(struct l2vpn *, struct kif *);
+static struct prefix_list *conf_get_plist(char *);
 static void		 clear_config(struct ldpd_conf *xconf);
 static uint32_t		 get_rtr_id(void);
 static int		 get_address(const char *, union ldpd_addr *);
 static int		 get_af_address(const char *, int *, union ldpd_addr *);
+static int		 get_af_prefix(const char *, int *, union ldpd_addr *,
+			    uint8_t *);
 
 static struct file		*file, *topfile;
 static struct files		 files = TAILQ_HEAD_INITIALIZER(files);
@@ -118,6 +121,7 @@ static struct tnbr		*tnbr;
 static struct nbr_params	*nbrp;
 static struct l2vpn		*l2vpn;
 static struct l2vpn_pw		*pw;
+static struct prefix_list	*plist;
 
 static struct config_defaults	 globaldefs;
 static struct config_defaults	 afdefs;
@@ -143,12 +147,13 @@ static int			 pushback_index;
 %token	ETHERNET ETHERNETTAGGED STATUSTLV CONTROLWORD
 %token	PSEUDOWIRE NEIGHBORID NEIGHBORADDR PWID
 %token	EXTTAG
+%token	REDISTRIBUTE HOSTROUTESONLY ALLOCATE FOR PREFIXLIST ORLONGER
 %token	YES NO
 %token	INCLUDE
 %token	ERROR
 %token	<v.string>	STRING
 %token	<v.number>	NUMBER
-%type	<v.number>	yesno ldp_af l2vpn_type pw_type
+%type	<v.number>	yesno ldp_af l2vpn_type pw_type plist_flags
 %type	<v.string>	string
 
 %%
@@ -161,6 +166,7 @@ grammar		: /* empty */
 		| grammar af '\n'
 		| grammar neighbor '\n'
 		| grammar l2vpn '\n'
+		| grammar prefixlist '\n'
 		| grammar error '\n'		{ file->errors++; }
 		;
 
@@ -328,6 +334,19 @@ afoptsl		:  TRANSADDRESS STRING {
 			if ($2 == 0)
 				defs->afflags |= F_LDPD_AF_NO_GTSM;
 		}
+		| REDISTRIBUTE HOSTROUTESONLY {
+			defs->afflags |= F_LDPD_AF_HOST_ROUTES;
+		}
+		| ALLOCATE FOR PREFIXLIST STRING {
+			if (strlcpy(af_conf->alloc_plist, $4,
+			    sizeof(af_conf->alloc_plist)) >=
+			    sizeof(af_conf->alloc_plist)) {
+				yyerror("prefix-list name too long");
+				free($4);
+				YYERROR;
+			}
+			free($4);
+		}
 		| af_defaults
 		| iface_defaults
 		| tnbr_defaults
@@ -781,6 +800,49 @@ l2vpnopts_l	: l2vpnopts_l l2vpnopts nl
 		| l2vpnopts optnl
 		;
 
+plist_flags	: ORLONGER		{ $$ = F_PLIST_OR_LONGER; }
+		| /* empty */		{ $$ = 0; }
+		;
+
+plistopts	: STRING plist_flags {
+			int		 family;
+			union ldpd_addr	 addr;
+			uint8_t		 prefixlen;
+
+			if (get_af_prefix($1, &family, &addr,
+			    &prefixlen) == -1) {
+				yyerror("error parsing prefix %s", $1);
+				free($1);
+				YYERROR;
+			}
+			free($1);
+			if (prefix_list_add(plist, family, &addr, prefixlen,
+			    $2) == -1) {
+				yyerror("duplicate prefix-list entry");
+				YYERROR;
+			}
+		}
+		;
+
+prefixlist	: PREFIXLIST STRING {
+			plist = conf_get_plist($2);
+			free($2);
+			if (plist == NULL)
+				YYERROR;
+		} plist_block {
+			plist = NULL;
+		}
+		;
+
+plist_block	: '{' optnl plistopts_l '}'
+		| '{' optnl '}'
+		| /* nothing */
+		;
+
+plistopts_l	: plistopts_l plistopts nl
+		| plistopts optnl
+		;
+
 %%
 
 struct keywords {
@@ -816,6 +878,7 @@ lookup(char *s)
 	/* this has to be sorted always */
 	static const struct keywords keywords[] = {
 		{"address-family",		AF},
+		{"allocate",			ALLOCATE},
 		{"bridge",			BRIDGE},
 		{"control-word",		CONTROLWORD},
 		{"ds-cisco-interop",		DSCISCOINTEROP},
@@ -823,8 +886,10 @@ lookup(char *s)
 		{"ethernet-tagged",		ETHERNETTAGGED},
 		{"explicit-null",		EXPNULL},
 		{"fib-update",			FIBUPDATE},
+		{"for",				FOR},
 		{"gtsm-enable",			GTSMENABLE},
 		{"gtsm-hops",			GTSMHOPS},
+		{"host-routes-only",		HOSTROUTESONLY},
 		{"include",			INCLUDE},
 		{"interface",			INTERFACE},
 		{"ipv4",			IPV4},
@@ -838,10 +903,13 @@ lookup(char *s)
 		{"neighbor-addr",		NEIGHBORADDR},
 		{"neighbor-id",			NEIGHBORID},
 		{"no",				NO},
+		{"or-longer",			ORLONGER},
 		{"password",			PASSWORD},
+		{"prefix-list",			PREFIXLIST},
 		{"pseudowire",			PSEUDOWIRE},
 		{"pw-id",			PWID},
 		{"pw-type",			PWTYPE},
+		{"redistribute",		REDISTRIBUTE},
 		{"router-id",			ROUTERID},
 		{"status-tlv",			STATUSTLV},
 		{"targeted-hello-accept",	THELLOACCEPT},
@@ -1209,6 +1277,20 @@ parse_config(char *filename)
 		}
 	}
 
+	/* the allocation policies must refer to existing prefix-lists */
+	if (conf->ipv4.alloc_plist[0] != '\0' &&
+	    prefix_list_find(conf, conf->ipv4.alloc_plist) == NULL) {
+		logit(LOG_CRIT, "%s: prefix-list %s not defined", filename,
+		    conf->ipv4.alloc_plist);
+		errors++;
+	}
+	if (conf->ipv6.alloc_plist[0] != '\0' &&
+	    prefix_list_find(conf, conf->ipv6.alloc_plist) == NULL) {
+		logit(LOG_CRIT, "%s: prefix-list %s not defined", filename,
+		    conf->ipv6.alloc_plist);
+		errors++;
+	}
+
 	/* free global config defaults */
 	if (errors) {
 		clear_config(conf);
@@ -1437,6 +1519,26 @@ conf_get_l2vpn_pw(struct l2vpn *l, struct kif *kif)
 	return (p);
 }
 
+static struct prefix_list *
+conf_get_plist(char *name)
+{
+	struct prefix_list	*p;
+
+	if (strlen(name) >= PREFIX_LIST_NAME_LEN) {
+		yyerror("prefix-list name too long");
+		return (NULL);
+	}
+
+	if (prefix_list_find(conf, name)) {
+		yyerror("prefix-list %s already configured", name);
+		return (NULL);
+	}
+
+	p = prefix_list_new(name);
+	LIST_INSERT_HEAD(&conf->plist_list, p, entry);
+	return (p);
+}
+
 static void
 clear_config(struct ldpd_conf *xconf)
 {
@@ -1446,6 +1548,7 @@ clear_config(struct ldpd_conf *xconf)
 	struct l2vpn		*l;
 	struct l2vpn_if		*f;
 	struct l2vpn_pw		*p;
+	struct prefix_list	*pl;
 
 	while ((i = LIST_FIRST(&xconf->iface_list)) != NULL) {
 		LIST_REMOVE(i, entry);
@@ -1475,6 +1578,11 @@ clear_config(struct ldpd_conf *xconf)
 		free(l);
 	}
 
+	while ((pl = LIST_FIRST(&xconf->plist_list)) != NULL) {
+		LIST_REMOVE(pl, entry);
+		prefix_list_del(pl);
+	}
+
 	free(xconf);
 }
 
@@ -1541,3 +1649,30 @@ get_af_address(const char *s, int *family, union ldpd_addr *addr)
 
 	return (-1);
 }
+
+/* parse "address/prefixlen" */
+static int
+get_af_prefix(const char *s, int *family, union ldpd_addr *addr,
+    uint8_t *prefixlen)
+{
+	char		*p, *ps;
+	const char	*errstr;
+	int		 maxlen;
+
+	if ((p = strrchr(s, '/')) == NULL)
+		return (-1);
+	if ((ps = strndup(s, p - s)) == NULL)
+		fatal(__func__);
+	if (get_af_address(ps, family, addr) == -1) {
+		free(ps);
+		return (-1);
+	}
+	free(ps);
+
+	maxlen = (*family == AF_INET) ? 32 : 128;
+	*prefixlen = strtonum(p + 1, 0, maxlen, &errstr);
+	if (errstr)
+		return (-1);
+
+	return (0);
+}
@@ -0,0 +1,149 @@
+/*	$OpenBSD$ */
+
+/*
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Prefix-lists used by the label allocation policy. Each list keeps its
+ * entries in configuration order for printconf and, per address-family,
+ * a prefix trie (see ptrie.c) whose nodes say how their prefix matches.
+ * A lookup walks at most prefixlen nodes regardless of the number of
+ * entries in the list.
+ */
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ldpd.h"
+#include "log.h"
+
+/* trie node data */
+struct prefix_list_node {
+	int			 match;
+};
+#define PLIST_MATCH_EXACT	0x01
+#define PLIST_MATCH_LONGER	0x02
+
+static struct ptrie_node	**prefix_list_root(struct prefix_list *, int);
+
+struct prefix_list *
+prefix_list_new(const char *name)
+{
+	struct prefix_list	*plist;
+
+	if ((plist = calloc(1, sizeof(*plist))) == NULL)
+		fatal("prefix_list_new: calloc");
+
+	strlcpy(plist->name, name, sizeof(plist->name));
+	TAILQ_INIT(&plist->entries);
+
+	return (plist);
+}
+
+struct prefix_list *
+prefix_list_find(struct ldpd_conf *xconf, const char *name)
+{
+	struct prefix_list	*plist;
+
+	LIST_FOREACH(plist, &xconf->plist_list, entry)
+		if (strcmp(plist->name, name) == 0)
+			return (plist);
+
+	return (NULL);
+}
+
+static struct ptrie_node **
+prefix_list_root(struct prefix_list *plist, int af)
+{
+	switch (af) {
+	case AF_INET:
+		return (&plist->root_v4);
+	case AF_INET6:
+		return (&plist->root_v6);
+	default:
+		fatalx("prefix_list_root: unknown af");
+	}
+}
+
+/* returns -1 if the same entry is already present */
+int
+prefix_list_add(struct prefix_list *plist, int af, union ldpd_addr *prefix,
+    uint8_t prefixlen, int flags)
+{
+	struct prefix_list_entry	*ple;
+	struct prefix_list_node		*pn;
+	struct ptrie_node		*n;
+	union ldpd_addr			 addr;
+	int				 match;
+
+	ldp_applymask(af, &addr, prefix, prefixlen);
+	match = (flags & F_PLIST_OR_LONGER) ?
+	    PLIST_MATCH_LONGER : PLIST_MATCH_EXACT;
+
+	n = ptrie_insert(prefix_list_root(plist, af), af, &addr, prefixlen);
+	if (n->data == NULL &&
+	    (n->data = calloc(1, sizeof(struct prefix_list_node))) == NULL)
+		fatal("prefix_list_add: calloc");
+	pn = n->data;
+	if (pn->match & match)
+		return (-1);
+	pn->match |= match;
+
+	if ((ple = calloc(1, sizeof(*ple))) == NULL)
+		fatal("prefix_list_add: calloc");
+	ple->af = af;
+	ple->prefix = addr;
+	ple->prefixlen = prefixlen;
+	ple->flags = flags;
+	TAILQ_INSERT_TAIL(&plist->entries, ple, entry);
+
+	return (0);
+}
+
+int
+prefix_list_match(struct prefix_list *plist, int af, union ldpd_addr *prefix,
+    uint8_t prefixlen)
+{
+	struct ptrie_node	*n;
+	struct prefix_list_node	*pn;
+
+	/* the covering entries, from the most specific one up */
+	n = ptrie_match(*prefix_list_root(plist, af), af, prefix, prefixlen);
+	for (; n != NULL; n = n->parent) {
+		if ((pn = n->data) == NULL)
+			continue;
+		if (pn->match & PLIST_MATCH_LONGER)
+			return (1);
+		if (n->prefixlen == prefixlen &&
+		    (pn->match & PLIST_MATCH_EXACT))
+			return (1);
+	}
+
+	return (0);
+}
+
+void
+prefix_list_del(struct prefix_list *plist)
+{
+	struct prefix_list_entry	*ple;
+
+	while ((ple = TAILQ_FIRST(&plist->entries)) != NULL) {
+		TAILQ_REMOVE(&plist->entries, ple, entry);
+		free(ple);
+	}
+	ptrie_free(&plist->root_v4, free);
+	ptrie_free(&plist->root_v6, free);
+	free(plist);
+}
@@ -33,6 +33,7 @@ static void	print_tnbr(struct tnbr *);
 static void	print_nbrp(struct nbr_params *);
 static void	print_l2vpn(struct l2vpn *);
 static void	print_pw(struct l2vpn_pw *);
+static void	print_plist(struct prefix_list *);
 
 static void
 print_mainconf(struct ldpd_conf *conf)
@@ -82,6 +83,11 @@ print_af(int af, struct ldpd_conf *conf, struct ldpd_af_conf *af_conf)
 	printf("\tkeepalive %u\n", af_conf->keepalive);
 	printf("\ttransport-address %s\n", log_addr(af, &af_conf->trans_addr));
 
+	if (af_conf->flags & F_LDPD_AF_HOST_ROUTES)
+		printf("\tredistribute host-routes-only\n");
+	if (af_conf->alloc_plist[0] != '\0')
+		printf("\tallocate for prefix-list %s\n", af_conf->alloc_plist);
+
 	LIST_FOREACH(iface, &conf->iface_list, entry) {
 		ia = iface_af_get(iface, af);
 		if (ia->enabled)
@@ -183,14 +189,31 @@ print_pw(struct l2vpn_pw *pw)
 	printf("\t}\n");
 }
 
+static void
+print_plist(struct prefix_list *plist)
+{
+	struct prefix_list_entry	*ple;
+
+	printf("\nprefix-list %s {\n", plist->name);
+	TAILQ_FOREACH(ple, &plist->entries, entry)
+		printf("\t%s/%u%s\n", log_addr(ple->af, &ple->prefix),
+		    ple->prefixlen,
+		    (ple->flags & F_PLIST_OR_LONGER) ? " or-longer" : "");
+	printf("}\n");
+}
+
 void
 print_config(struct ldpd_conf *conf)
 {
 	struct nbr_params	*nbrp;
 	struct l2vpn		*l2vpn;
+	struct prefix_list	*plist;
 
 	print_mainconf(conf);
 
+	LIST_FOREACH(plist, &conf->plist_list, entry)
+		print_plist(plist);
+
 	if (conf->ipv4.flags & F_LDPD_AF_ENABLED)
 		print_af(AF_INET, conf, &conf->ipv4);
 	if (conf->ipv6.flags & F_LDPD_AF_ENABLED)
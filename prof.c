@@ -0,0 +1,127 @@
+/*	$OpenBSD$ */
+
+/*
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Event callback profiler. Every callback is registered with libevent
+ * through its PROF() trampoline; while profiling is off the trampoline
+ * only calls it, once it is enabled through the control socket each run is
+ * timed. A callback is reported from its first profiled run on, with the
+ * number of runs, the total time and the longest ones.
+ */
+
+#include <sys/types.h>
+#include <string.h>
+
+#include "ldpd.h"
+#include "log.h"
+
+static void	 prof_record(struct prof_cb *, uint64_t, uint64_t);
+
+static LIST_HEAD(, prof_cb)	 prof_cbs = LIST_HEAD_INITIALIZER(prof_cbs);
+static int			 prof_enabled;
+
+void
+prof_call(struct prof_cb *p, void (*cb)(int, short, void *), int fd,
+    short event, void *arg)
+{
+	uint64_t	 start;
+
+	if (!prof_enabled) {
+		cb(fd, event, arg);
+		return;
+	}
+
+	start = stats_now();
+	cb(fd, event, arg);
+	prof_record(p, start, (stats_now() - start) / 1000);
+}
+
+static void
+prof_record(struct prof_cb *p, uint64_t start, uint64_t usecs)
+{
+	int		 i;
+
+	if (!p->linked) {
+		LIST_INSERT_HEAD(&prof_cbs, p, entry);
+		p->linked = 1;
+	}
+	p->calls++;
+	p->total += usecs;
+
+	/* keep the longest runs, longest first */
+	for (i = PROF_STALLS; i > 0 && usecs > p->stalls[i - 1].usecs; i--)
+		if (i < PROF_STALLS)
+			p->stalls[i] = p->stalls[i - 1];
+	if (i < PROF_STALLS) {
+		p->stalls[i].usecs = usecs;
+		p->stalls[i].when = start;
+	}
+}
+
+void
+prof_cmd(int cmd)
+{
+	struct prof_cb	*p;
+
+	switch (cmd) {
+	case PROF_CMD_ENABLE:
+		prof_enabled = 1;
+		break;
+	case PROF_CMD_DISABLE:
+		prof_enabled = 0;
+		break;
+	case PROF_CMD_RESET:
+		LIST_FOREACH(p, &prof_cbs, entry) {
+			p->calls = 0;
+			p->total = 0;
+			memset(p->stalls, 0, sizeof(p->stalls));
+		}
+		break;
+	default:
+		log_warnx("%s: unknown command %d", __func__, cmd);
+		break;
+	}
+}
+
+/* send the callbacks run since the last reset, followed by IMSG_CTL_END */
+void
+prof_ctl(pid_t pid, void (*compose)(int, pid_t, void *, uint16_t))
+{
+	struct prof_cb	*p;
+	struct ctl_prof	 pctl;
+	uint64_t	 now;
+	int		 i;
+
+	now = stats_now();
+	LIST_FOREACH(p, &prof_cbs, entry) {
+		if (p->calls == 0)
+			continue;
+
+		memset(&pctl, 0, sizeof(pctl));
+		pctl.proc = ldpd_process;
+		strlcpy(pctl.name, p->name, sizeof(pctl.name));
+		pctl.calls = p->calls;
+		pctl.total = p->total;
+		for (i = 0; i < PROF_STALLS && p->stalls[i].when != 0; i++) {
+			pctl.stall[i] = p->stalls[i].usecs;
+			pctl.stall_ago[i] = (now - p->stalls[i].when) /
+			    1000000000;
+		}
+		compose(IMSG_CTL_SHOW_PROF, pid, &pctl, sizeof(pctl));
+	}
+
+	compose(IMSG_CTL_END, pid, NULL, 0);
+}
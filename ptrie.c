@@ -0,0 +1,200 @@
+/*	$OpenBSD$ */
+
+/*
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Path-compressed binary trie of prefixes, one per address family, for
+ * longest prefix matches. Nodes without data are glue nodes created where
+ * two prefixes diverge; they always have two children. The prefixes given
+ * must already be masked to their length.
+ */
+
+#include <sys/types.h>
+#include <stdlib.h>
+
+#include "ldpd.h"
+#include "log.h"
+
+static const uint8_t	*ptrie_key(int, const union ldpd_addr *);
+static int		 ptrie_common(const uint8_t *, const uint8_t *, int);
+static void		 ptrie_free_node(struct ptrie_node *, void (*)(void *));
+
+#define PTRIE_BIT(k, i)	(((k)[(i) >> 3] >> (7 - ((i) & 7))) & 1)
+
+static const uint8_t *
+ptrie_key(int af, const union ldpd_addr *addr)
+{
+	switch (af) {
+	case AF_INET:
+		return ((const uint8_t *)&addr->v4);
+	case AF_INET6:
+		return (addr->v6.s6_addr);
+	default:
+		fatalx("ptrie_key: unknown af");
+	}
+}
+
+/* number of leading bits a and b have in common, up to maxlen */
+static int
+ptrie_common(const uint8_t *a, const uint8_t *b, int maxlen)
+{
+	int		 i;
+	uint8_t		 diff;
+
+	for (i = 0; i < maxlen; i += 8) {
+		diff = a[i >> 3] ^ b[i >> 3];
+		if (diff == 0)
+			continue;
+		while (!(diff & 0x80)) {
+			diff <<= 1;
+			i++;
+		}
+		break;
+	}
+
+	return (i < maxlen ? i : maxlen);
+}
+
+/*
+ * Return the node of prefix/prefixlen, creating it if needed. The caller
+ * sets its data; it is NULL for a new node or a former glue node.
+ */
+struct ptrie_node *
+ptrie_insert(struct ptrie_node **root, int af, const union ldpd_addr *prefix,
+    uint8_t prefixlen)
+{
+	struct ptrie_node	**np, *n, *parent = NULL, *new, *glue;
+	const uint8_t		 *key, *nkey = NULL;
+	int			  common;
+
+	key = ptrie_key(af, prefix);
+	np = root;
+	while ((n = *np) != NULL) {
+		nkey = ptrie_key(af, &n->prefix);
+		if (n->prefixlen > prefixlen ||
+		    ptrie_common(nkey, key, n->prefixlen) != n->prefixlen)
+			break;
+		if (n->prefixlen == prefixlen)
+			return (n);
+		parent = n;
+		np = &n->child[PTRIE_BIT(key, n->prefixlen)];
+	}
+
+	if ((new = calloc(1, sizeof(*new))) == NULL)
+		fatal(__func__);
+	new->prefix = *prefix;
+	new->prefixlen = prefixlen;
+	new->parent = parent;
+	*np = new;
+	if (n == NULL)
+		return (new);
+
+	common = ptrie_common(nkey, key, prefixlen);
+	if (common == prefixlen) {
+		/* the new prefix covers n */
+		new->child[PTRIE_BIT(nkey, common)] = n;
+		n->parent = new;
+		return (new);
+	}
+
+	/* n and the new prefix diverge, join them with a glue node */
+	if ((glue = calloc(1, sizeof(*glue))) == NULL)
+		fatal(__func__);
+	ldp_applymask(af, &glue->prefix, prefix, common);
+	glue->prefixlen = common;
+	glue->parent = parent;
+	glue->child[PTRIE_BIT(key, common)] = new;
+	glue->child[PTRIE_BIT(nkey, common)] = n;
+	new->parent = glue;
+	n->parent = glue;
+	*np = glue;
+
+	return (new);
+}
+
+/* drop the data of a node and the nodes no longer needed */
+void
+ptrie_remove(struct ptrie_node **root, struct ptrie_node *n)
+{
+	struct ptrie_node	**np, *child, *parent;
+
+	n->data = NULL;
+	while (n != NULL && n->data == NULL &&
+	    (n->child[0] == NULL || n->child[1] == NULL)) {
+		child = n->child[0] ? n->child[0] : n->child[1];
+		parent = n->parent;
+		if (parent == NULL)
+			np = root;
+		else if (parent->child[0] == n)
+			np = &parent->child[0];
+		else
+			np = &parent->child[1];
+
+		*np = child;
+		if (child)
+			child->parent = parent;
+		free(n);
+
+		/* only a childless removal can turn the parent into glue */
+		n = child ? NULL : parent;
+	}
+}
+
+/*
+ * The most specific node with data covering prefix/prefixlen, or NULL. Its
+ * ancestors with data are the less specific ones.
+ */
+struct ptrie_node *
+ptrie_match(struct ptrie_node *root, int af, const union ldpd_addr *prefix,
+    uint8_t prefixlen)
+{
+	struct ptrie_node	*n, *best = NULL;
+	const uint8_t		*key;
+
+	key = ptrie_key(af, prefix);
+	for (n = root; n != NULL && n->prefixlen <= prefixlen;
+	    n = n->child[PTRIE_BIT(key, n->prefixlen)]) {
+		if (ptrie_common(ptrie_key(af, &n->prefix), key,
+		    n->prefixlen) != n->prefixlen)
+			break;
+		if (n->data)
+			best = n;
+		if (n->prefixlen == prefixlen)
+			break;
+	}
+
+	return (best);
+}
+
+static void
+ptrie_free_node(struct ptrie_node *n, void (*cb)(void *))
+{
+	if (n == NULL)
+		return;
+
+	ptrie_free_node(n->child[0], cb);
+	ptrie_free_node(n->child[1], cb);
+	if (n->data && cb)
+		cb(n->data);
+	free(n);
+}
+
+/* free the whole trie, passing the data of every node to cb */
+void
+ptrie_free(struct ptrie_node **root, void (*cb)(void *))
+{
+	ptrie_free_node(*root, cb);
+	*root = NULL;
+}
@@ -0,0 +1,158 @@
+/*	$OpenBSD$ */
+
+/*
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Convergence latency. The event that starts a stage (a label mapping
+ * received by the ldpe, a route learned by the parent) is timestamped and
+ * the timestamp travels in the map and kroute imsgs down the pipeline.
+ * The process where a stage ends records the elapsed time in a log-linear
+ * histogram: each power of two is split in STATS_SUB_COUNT linear buckets,
+ * so every recorded value is off by less than 1/STATS_SUB_COUNT.
+ *
+ * All processes use CLOCK_MONOTONIC, which is shared on the same host.
+ */
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ldpd.h"
+#include "log.h"
+
+#define STATS_SUB_BITS		4
+#define STATS_SUB_COUNT		(1 << STATS_SUB_BITS)
+#define STATS_BUCKETS		((64 - STATS_SUB_BITS + 1) * STATS_SUB_COUNT)
+
+struct stats_hist {
+	uint64_t	 count;
+	uint64_t	 max;
+	uint64_t	 bucket[STATS_BUCKETS];
+};
+
+static unsigned int	 stats_bucket(uint64_t);
+static uint64_t		 stats_bucket_value(unsigned int);
+static uint64_t		 stats_percentile(struct stats_hist *, unsigned int);
+
+static struct stats_hist	 stats_hist[STATS_STAGE_MAX];
+
+/* nsecs, only meaningful as the origin of a stage */
+uint64_t
+stats_now(void)
+{
+	struct timespec	 ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/* record the end of a stage started at since, if it was timestamped */
+void
+stats_record(enum stats_stage stage, uint64_t since)
+{
+	struct stats_hist	*h;
+	uint64_t		 now, usecs;
+
+	if (since == 0)
+		return;
+
+	now = stats_now();
+	usecs = (now > since) ? (now - since) / 1000 : 0;
+
+	h = &stats_hist[stage];
+	h->bucket[stats_bucket(usecs)]++;
+	h->count++;
+	if (usecs > h->max)
+		h->max = usecs;
+}
+
+static unsigned int
+stats_bucket(uint64_t v)
+{
+	unsigned int	 msb, shift;
+
+	if (v < STATS_SUB_COUNT)
+		return (v);
+
+	for (msb = STATS_SUB_BITS; (v >> msb) > 1; msb++)
+		;	/* nothing */
+	shift = msb - STATS_SUB_BITS;
+
+	return ((shift + 1) * STATS_SUB_COUNT +
+	    ((v >> shift) & (STATS_SUB_COUNT - 1)));
+}
+
+/* highest value that falls into the bucket */
+static uint64_t
+stats_bucket_value(unsigned int b)
+{
+	unsigned int	 shift;
+
+	if (b < STATS_SUB_COUNT)
+		return (b);
+
+	shift = b / STATS_SUB_COUNT - 1;
+	return (((uint64_t)(STATS_SUB_COUNT + b % STATS_SUB_COUNT + 1)
+	    << shift) - 1);
+}
+
+static uint64_t
+stats_percentile(struct stats_hist *h, unsigned int pct)
+{
+	uint64_t	 rank, seen = 0;
+	unsigned int	 b;
+
+	if (h->count == 0)
+		return (0);
+
+	rank = (h->count * pct + 99) / 100;
+	for (b = 0; b < STATS_BUCKETS; b++) {
+		seen += h->bucket[b];
+		if (seen >= rank)
+			break;
+	}
+	if (b == STATS_BUCKETS || stats_bucket_value(b) > h->max)
+		return (h->max);
+
+	return (stats_bucket_value(b));
+}
+
+/* send the stages ending in this process, followed by IMSG_CTL_END */
+void
+stats_ctl(pid_t pid, void (*compose)(int, pid_t, void *, uint16_t))
+{
+	struct ctl_stats	 sctl;
+	struct stats_hist	*h;
+	int			 stage;
+
+	for (stage = 0; stage < STATS_STAGE_MAX; stage++) {
+		h = &stats_hist[stage];
+		if (h->count == 0)
+			continue;
+
+		memset(&sctl, 0, sizeof(sctl));
+		sctl.stage = stage;
+		sctl.count = h->count;
+		sctl.p50 = stats_percentile(h, 50);
+		sctl.p90 = stats_percentile(h, 90);
+		sctl.p99 = stats_percentile(h, 99);
+		sctl.max = h->max;
+
+		compose(IMSG_CTL_SHOW_STATS, pid, &sctl, sizeof(sctl));
+	}
+
+	compose(IMSG_CTL_END, pid, NULL, 0);
+}
@@ -0,0 +1,90 @@
+/*	$OpenBSD$ */
+
+/*
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Always-on event trace. Every process records fixed-size binary records
+ * into its own ring, overwriting the oldest ones; nothing is formatted
+ * until ldpdump(8) fetches the rings through the control socket.
+ */
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "ldpd.h"
+#include "log.h"
+
+#define TRACE_RING_SIZE		8192	/* records, a power of two */
+#define TRACE_CHUNK		\
+	((MAX_IMSGSIZE - IMSG_HEADER_SIZE) / sizeof(struct trace_rec))
+
+static struct {
+	struct trace_rec	 rec[TRACE_RING_SIZE];
+	uint64_t		 head;
+} trace_ring;
+
+void
+trace(uint8_t type, uint16_t arg, uint32_t id, uint32_t a1, uint32_t a2)
+{
+	struct trace_rec	*r;
+	struct timespec		 ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	r = &trace_ring.rec[trace_ring.head++ & (TRACE_RING_SIZE - 1)];
+	r->ts = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	r->proc = ldpd_process;
+	r->type = type;
+	r->arg = arg;
+	r->id = id;
+	r->a1 = a1;
+	r->a2 = a2;
+}
+
+/*
+ * Send the ring, oldest record first, followed by IMSG_CTL_END. The ring
+ * is copied beforehand since sending the imsgs records new events.
+ */
+void
+trace_ctl(pid_t pid, void (*compose)(int, pid_t, void *, uint16_t))
+{
+	struct trace_rec	*recs;
+	uint64_t		 start, end, i;
+	size_t			 count, n;
+
+	end = trace_ring.head;
+	start = (end > TRACE_RING_SIZE) ? end - TRACE_RING_SIZE : 0;
+	count = end - start;
+
+	if (count > 0) {
+		if ((recs = calloc(count, sizeof(*recs))) == NULL)
+			fatal(__func__);
+		for (i = start; i < end; i++)
+			recs[i - start] =
+			    trace_ring.rec[i & (TRACE_RING_SIZE - 1)];
+
+		for (i = 0; i < count; i += n) {
+			n = count - i;
+			if (n > TRACE_CHUNK)
+				n = TRACE_CHUNK;
+			compose(IMSG_CTL_SHOW_TRACE, pid, &recs[i],
+			    n * sizeof(*recs));
+		}
+		free(recs);
+	}
+
+	compose(IMSG_CTL_END, pid, NULL, 0);
+}